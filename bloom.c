@@ -0,0 +1,329 @@
+/**
+ * Bloom - quarter-resolution glow for emissive sources
+ * See bloom.h. Weights are 8.8 fixed point summing to 256, so every tap
+ * and the bilinear upsample fit in 16-bit lanes: two pixels per SSE2
+ * register, 255 * 256 at most. Rows carry `radius` zero pixels of
+ * padding on the left and right so the horizontal pass needs no clamping.
+ * Linear-light adds go through the tables in lut.h one channel at a time
+ * (SSE2 has no table lookup); the SSE2 path still weighs four pixels at
+ * once, and channels with no glow are skipped.
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bloom.h"
+#include "lut.h"
+#include "row_pool.h"
+
+#define BLOOM_SCALE 4              /* Target pixels per bloom pixel */
+#define BLOOM_MAX_RADIUS 24        /* Taps each side */
+
+struct Bloom {
+    int width, height;             /* Target */
+    int qw, qh;                    /* Bloom buffers, without padding */
+    int stride;                    /* Pixels per padded row, multiple of 4 */
+    int radius;
+    int linear;                    /* Add the glow in linear light */
+    uint16_t weights[2 * BLOOM_MAX_RADIUS + 1];
+    uint32_t *source;              /* Emitted light */
+    uint32_t *scratch;             /* Horizontal pass */
+    uint32_t *blurred;             /* Vertical pass */
+    uint32_t *rows;                /* Upsample rows, qw + 2 for each row pool slot */
+    int x0, x1, y0, y1;            /* Source box holding light; empty if y0 >= y1 */
+    int bx0, bx1, by0, by1;        /* Box of blurred valid this frame */
+    uint32_t *target;
+    uint8_t *counts;
+    uint64_t changed;
+};
+
+static uint32_t *bloom_buffer(const Bloom *b) {
+    size_t bytes = (size_t)b->stride * b->qh * sizeof(uint32_t);
+    uint32_t *buffer = aligned_alloc(16, bytes);
+    if (buffer) memset(buffer, 0, bytes);
+    return buffer;
+}
+
+Bloom *bloom_create(int width, int height, float sigma, int linear) {
+    Bloom *b = calloc(1, sizeof(Bloom));
+    if (!b) return NULL;
+
+    float q_sigma = sigma / BLOOM_SCALE;
+    int radius = (int)ceilf(3 * q_sigma);
+    if (radius < 1) radius = 1;
+    if (radius > BLOOM_MAX_RADIUS) radius = BLOOM_MAX_RADIUS;
+    if (q_sigma < 0.5f) q_sigma = 0.5f;
+
+    b->width = width;
+    b->height = height;
+    b->qw = (width + BLOOM_SCALE - 1) / BLOOM_SCALE;
+    b->qh = (height + BLOOM_SCALE - 1) / BLOOM_SCALE;
+    b->radius = radius;
+    b->linear = linear;
+    b->stride = (b->qw + 2 * radius + 3) & ~3;
+    b->x0 = b->qw;
+    b->y0 = b->qh;
+
+    /* Round each weight, then give the centre whatever is left of 256 */
+    float raw[2 * BLOOM_MAX_RADIUS + 1], total = 0;
+    for (int k = -radius; k <= radius; k++) {
+        raw[k + radius] = expf(-(k * k) / (2 * q_sigma * q_sigma));
+        total += raw[k + radius];
+    }
+    int sum = 0;
+    for (int k = 0; k <= 2 * radius; k++) {
+        b->weights[k] = (uint16_t)lrintf(raw[k] * 256 / total);
+        sum += b->weights[k];
+    }
+    b->weights[radius] += 256 - sum;
+
+    b->source = bloom_buffer(b);
+    b->scratch = bloom_buffer(b);
+    b->blurred = bloom_buffer(b);
+    b->rows = malloc((size_t)ROW_POOL_SLOTS * (b->qw + 2) * sizeof(uint32_t));
+    if (!b->source || !b->scratch || !b->blurred || !b->rows) {
+        bloom_destroy(b);
+        return NULL;
+    }
+    return b;
+}
+
+void bloom_clear(Bloom *b) {
+    if (b->y0 < b->y1) {
+        memset(b->source + (size_t)b->y0 * b->stride, 0,
+               (size_t)(b->y1 - b->y0) * b->stride * sizeof(uint32_t));
+    }
+    b->x0 = b->qw;
+    b->x1 = 0;
+    b->y0 = b->qh;
+    b->y1 = 0;
+}
+
+static inline uint32_t add_saturate(uint32_t a, uint32_t c) {
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t v = ((a >> shift) & 0xFF) + ((c >> shift) & 0xFF);
+        out |= (v > 0xFF ? 0xFF : v) << shift;
+    }
+    return out;
+}
+
+void bloom_emit(Bloom *b, int x, int y, int radius, uint32_t color) {
+    int qx = x >> 2, qy = y >> 2;
+    int qr = (radius + BLOOM_SCALE / 2) / BLOOM_SCALE;
+    int col0 = qx - qr < 0 ? 0 : qx - qr;
+    int col1 = qx + qr + 1 > b->qw ? b->qw : qx + qr + 1;
+    int row0 = qy - qr < 0 ? 0 : qy - qr;
+    int row1 = qy + qr + 1 > b->qh ? b->qh : qy + qr + 1;
+    if (col0 >= col1 || row0 >= row1) return;
+
+    for (int row = row0; row < row1; row++) {
+        for (int col = col0; col < col1; col++) {
+            int dx = col - qx, dy = row - qy;
+            if (dx * dx + dy * dy > qr * qr + qr) continue;
+
+            uint32_t *p = &b->source[(size_t)row * b->stride + b->radius + col];
+            *p = add_saturate(*p, color);
+        }
+    }
+
+    if (col0 < b->x0) b->x0 = col0;
+    if (col1 > b->x1) b->x1 = col1;
+    if (row0 < b->y0) b->y0 = row0;
+    if (row1 > b->y1) b->y1 = row1;
+}
+
+/* Weighted sum of taps `step` pixels apart, for pixel pairs from src into dst */
+static void blur_span(uint32_t *dst, const uint32_t *src, int n, ptrdiff_t step,
+                      const uint16_t *weights, int taps) {
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 2 <= n; i += 2) {
+        __m128i acc = zero;
+        for (int k = 0; k < taps; k++) {
+            __m128i p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src + i + k * step)), zero);
+            acc = _mm_add_epi16(acc, _mm_mullo_epi16(p, _mm_set1_epi16((short)weights[k])));
+        }
+        _mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(_mm_srli_epi16(acc, 8), zero));
+    }
+#endif
+
+    for (; i < n; i++) {
+        uint32_t out = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            uint32_t acc = 0;
+            for (int k = 0; k < taps; k++) {
+                acc += ((src[i + k * step] >> shift) & 0xFF) * weights[k];
+            }
+            out |= (acc >> 8) << shift;
+        }
+        dst[i] = out;
+    }
+}
+
+static void horizontal_task(int begin, int end, void *ctx) {
+    Bloom *b = ctx;
+    for (int row = b->y0 + begin; row < b->y0 + end; row++) {
+        size_t offset = (size_t)row * b->stride + b->bx0;
+        blur_span(b->scratch + offset + b->radius, b->source + offset, b->bx1 - b->bx0, 1,
+                  b->weights, 2 * b->radius + 1);
+    }
+}
+
+/* Taps outside the rows that hold light would read zeros, so they are skipped */
+static void vertical_task(int begin, int end, void *ctx) {
+    Bloom *b = ctx;
+    for (int row = b->by0 + begin; row < b->by0 + end; row++) {
+        int first = row - b->radius < b->y0 ? b->y0 : row - b->radius;
+        int last = row + b->radius >= b->y1 ? b->y1 - 1 : row + b->radius;
+        size_t column = b->radius + b->bx0;
+        blur_span(b->blurred + (size_t)row * b->stride + column,
+                  b->scratch + (size_t)first * b->stride + column, b->bx1 - b->bx0, b->stride,
+                  b->weights + first - (row - b->radius), last - first + 1);
+    }
+}
+
+/* Blurred row r clamped to the buffer, or NULL where it holds no light */
+static const uint32_t *blurred_row(const Bloom *b, int r) {
+    if (r < 0) r = 0;
+    if (r >= b->qh) r = b->qh - 1;
+    if (r < b->by0 || r >= b->by1) return NULL;
+    return b->blurred + (size_t)r * b->stride + b->radius;
+}
+
+/* a + (b - a) * w / 256 per channel, for w in 0..256 */
+static inline uint32_t lerp_pixel(uint32_t a, uint32_t c, uint32_t w) {
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        out |= ((((a >> shift) & 0xFF) * (256 - w) + ((c >> shift) & 0xFF) * w) >> 8) << shift;
+    }
+    return out;
+}
+
+/*
+ * Glow v added to sRGB pixel p in linear light; alpha saturates as usual.
+ * No glow leaves a channel as it was: the tables round-trip exactly.
+ */
+static inline uint32_t add_linear(uint32_t p, uint32_t v) {
+    uint32_t a = (p >> 24) + (v >> 24);
+    return (a > 0xFF ? 0xFF : a) << 24 |
+           linear_to_srgb(srgb_to_linear(p >> 16) + srgb_to_linear(v >> 16)) << 16 |
+           linear_to_srgb(srgb_to_linear(p >> 8) + srgb_to_linear(v >> 8)) << 8 |
+           linear_to_srgb(srgb_to_linear(p) + srgb_to_linear(v));
+}
+
+/* Add one upsampled pixel to the target */
+static inline uint64_t add_pixel(Bloom *b, int y, int x, uint32_t v) {
+    if (!v) return 0;
+    size_t index = (size_t)y * b->width + x;
+    b->target[index] = b->linear ? add_linear(b->target[index], v) : add_saturate(b->target[index], v);
+    if (b->counts && b->counts[index] < UINT8_MAX) b->counts[index]++;
+    return 1;
+}
+
+/*
+ * Target row y samples bloom rows (2y - 3) / 8 and the one below it; the
+ * fraction only takes the values 1/8, 3/8, 5/8 and 7/8, and the same holds
+ * along x. tmp holds the vertically blended row with one clamped pixel on
+ * each side; only the columns of the blurred box are ever non-zero, and
+ * only those and one either side are read, so nothing else is cleared.
+ */
+static void upsample_task(int begin, int end, void *ctx) {
+    Bloom *b = ctx;
+    uint32_t *tmp = b->rows + (size_t)row_pool_slot() * (b->qw + 2);
+    uint64_t changed = 0;
+
+    int y_first = b->by0 * BLOOM_SCALE - 2 < 0 ? 0 : b->by0 * BLOOM_SCALE - 2;
+    for (int y = y_first + begin; y < y_first + end; y++) {
+        int t = 2 * y - 3;
+        const uint32_t *r0 = blurred_row(b, t >> 3);
+        const uint32_t *r1 = blurred_row(b, (t >> 3) + 1);
+        uint32_t wy = (uint32_t)(t & 7) * 32;
+
+        for (int i = b->bx0; i < b->bx1; i++) {
+            uint32_t a = r0 ? r0[i] : 0, c = r1 ? r1[i] : 0;
+            tmp[i + 1] = (a | c) ? lerp_pixel(a, c, wy) : 0;
+        }
+        tmp[b->bx0] = 0;
+        tmp[b->bx1 + 1] = 0;
+        tmp[0] = tmp[1];
+        tmp[b->qw + 1] = tmp[b->qw];
+
+        /* Pixels 4i - 2 .. 4i + 1 lie between tmp[i] and tmp[i + 1] */
+        for (int i = b->bx0; i <= b->bx1; i++) {
+            uint32_t a = tmp[i], c = tmp[i + 1];
+            if (!(a | c)) continue;
+
+            int x = 4 * i - 2;
+#ifdef __SSE2__
+            if (x >= 0 && x + 4 <= b->width && !b->counts) {
+                const __m128i zero = _mm_setzero_si128();
+                __m128i pa = _mm_unpacklo_epi8(_mm_set1_epi32((int)a), zero);
+                __m128i pc = _mm_unpacklo_epi8(_mm_set1_epi32((int)c), zero);
+                __m128i w01 = _mm_set_epi16(96, 96, 96, 96, 32, 32, 32, 32);
+                __m128i w23 = _mm_set_epi16(224, 224, 224, 224, 160, 160, 160, 160);
+                __m128i full = _mm_set1_epi16(256);
+                __m128i lo = _mm_add_epi16(_mm_mullo_epi16(pa, _mm_sub_epi16(full, w01)), _mm_mullo_epi16(pc, w01));
+                __m128i hi = _mm_add_epi16(_mm_mullo_epi16(pa, _mm_sub_epi16(full, w23)), _mm_mullo_epi16(pc, w23));
+                __m128i v = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+
+                __m128i *dst = (__m128i *)(b->target + (size_t)y * b->width + x);
+                if (b->linear) {
+                    uint32_t glow[4], *p = b->target + (size_t)y * b->width + x;
+                    _mm_storeu_si128((__m128i *)glow, v);
+                    for (int j = 0; j < 4; j++) p[j] = add_linear(p[j], glow[j]);
+                } else {
+                    _mm_storeu_si128(dst, _mm_adds_epu8(_mm_loadu_si128(dst), v));
+                }
+                int empty = _mm_movemask_epi8(_mm_cmpeq_epi32(v, zero));
+                changed += 4 - __builtin_popcount(empty) / 4;
+                continue;
+            }
+#endif
+            for (int j = 0; j < 4; j++) {
+                if (x + j < 0 || x + j >= b->width) continue;
+                changed += add_pixel(b, y, x + j, lerp_pixel(a, c, 32 + 64 * j));
+            }
+        }
+    }
+
+    __atomic_add_fetch(&b->changed, changed, __ATOMIC_RELAXED);
+}
+
+uint64_t bloom_apply(Bloom *b, uint32_t *target, uint8_t *counts) {
+    if (b->y0 >= b->y1) return 0;
+
+    b->bx0 = b->x0 - b->radius < 0 ? 0 : b->x0 - b->radius;
+    b->bx1 = b->x1 + b->radius > b->qw ? b->qw : b->x1 + b->radius;
+    b->by0 = b->y0 - b->radius < 0 ? 0 : b->y0 - b->radius;
+    b->by1 = b->y1 + b->radius > b->qh ? b->qh : b->y1 + b->radius;
+    b->target = target;
+    b->counts = counts;
+    b->changed = 0;
+
+    row_pool_run(b->y1 - b->y0, horizontal_task, b);
+    row_pool_run(b->by1 - b->by0, vertical_task, b);
+
+    int y_first = b->by0 * BLOOM_SCALE - 2 < 0 ? 0 : b->by0 * BLOOM_SCALE - 2;
+    int y_end = b->by1 * BLOOM_SCALE + 2 > b->height ? b->height : b->by1 * BLOOM_SCALE + 2;
+    row_pool_run(y_end - y_first, upsample_task, b);
+
+    return b->changed;
+}
+
+void bloom_destroy(Bloom *b) {
+    if (!b) return;
+    free(b->source);
+    free(b->scratch);
+    free(b->blurred);
+    free(b->rows);
+    free(b);
+}
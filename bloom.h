@@ -0,0 +1,40 @@
+/**
+ * Bloom - quarter-resolution glow for emissive sources
+ * Sources are splatted into a buffer a quarter of the target's size in
+ * each direction, blurred with a separable Gaussian and added back to
+ * the target with bilinear upsampling. The cost depends on the target
+ * size and on how many rows hold light, not on how many sources there
+ * are. Both blur passes and the upsample are split by rows over the row
+ * pool, with SSE2 where available. The glow can be added to the target
+ * either straight onto its sRGB values or in linear light.
+ */
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdint.h>
+
+typedef struct Bloom Bloom;
+
+/*
+ * Bloom for a width x height target; sigma is the blur radius in target
+ * pixels. When linear is set, the glow and the target are both taken as
+ * sRGB and summed as linear light; lut_init must have run.
+ */
+Bloom *bloom_create(int width, int height, float sigma, int linear);
+
+/* Start a frame: forget every source */
+void bloom_clear(Bloom *bloom);
+
+/* Splat a disc of ARGB color at (x, y) in target pixels; overlapping sources add */
+void bloom_emit(Bloom *bloom, int x, int y, int radius, uint32_t color);
+
+/*
+ * Blur and add onto the target (saturating). Returns the target pixels that
+ * changed; when counts is given, each one is also incremented there.
+ */
+uint64_t bloom_apply(Bloom *bloom, uint32_t *target, uint8_t *counts);
+
+void bloom_destroy(Bloom *bloom);
+
+#endif /* BLOOM_H */
@@ -0,0 +1,300 @@
+/**
+ * Control - change a running instance's parameters over a Unix socket
+ * See control.h. The listening socket and every client sit in one epoll
+ * set, which is the descriptor the owner polls. Replies are a few short
+ * lines written without blocking; a client that doesn't read them, or
+ * sends a line longer than CONTROL_LINE, is dropped.
+ */
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "control.h"
+
+#define CONTROL_LINE 128           /* Longest command, newline included */
+#define CONTROL_NAME 32
+
+typedef struct {
+    char name[CONTROL_NAME];
+    int min, max;
+    int value;
+    ControlSetter set;
+    void *ctx;
+} ControlParam;
+
+typedef struct {
+    int fd;                        /* -1 when the slot is free */
+    char line[CONTROL_LINE];
+    int length;
+} ControlClient;
+
+struct Control {
+    int listen_fd;
+    int epoll_fd;
+    char *socket_path;
+    ControlParam params[CONTROL_MAX_PARAMS];
+    int param_count;
+    ControlClient clients[CONTROL_MAX_CLIENTS];
+};
+
+/* Whether the socket at addr is left over: connecting is refused because nobody listens */
+static int socket_is_stale(const struct sockaddr_un *addr) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return 0;
+
+    int stale = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0 && errno == ECONNREFUSED;
+    close(fd);
+    return stale;
+}
+
+static int listen_unix(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "control: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("control: socket");
+        return -1;
+    }
+
+    /* A socket left behind by a crashed run would make bind fail; anything else stays */
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "control: %s exists and is not a socket\n", path);
+            close(fd);
+            return -1;
+        }
+        if (!socket_is_stale(&addr)) {
+            fprintf(stderr, "control: %s is already in use\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    /* Only this user may change settings; nobody can connect before listen */
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    if (chmod(path, 0600) < 0 || listen(fd, 8) < 0) {
+        perror(path);
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+Control *control_create(const char *socket_path) {
+    Control *control = calloc(1, sizeof(*control));
+    if (!control) return NULL;
+
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        control->clients[i].fd = -1;
+    }
+    control->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    control->socket_path = strdup(socket_path);
+    control->listen_fd = listen_unix(socket_path);
+    if (control->epoll_fd < 0 || !control->socket_path || control->listen_fd < 0) goto fail;
+
+    /* Events carry the client's slot, or UINT32_MAX for the listener */
+    struct epoll_event event = { .events = EPOLLIN, .data.u32 = UINT32_MAX };
+    if (epoll_ctl(control->epoll_fd, EPOLL_CTL_ADD, control->listen_fd, &event) < 0) {
+        perror("control: epoll_ctl");
+        goto fail;
+    }
+    return control;
+
+fail:
+    if (control->listen_fd >= 0) {
+        close(control->listen_fd);
+        unlink(socket_path);
+    }
+    if (control->epoll_fd >= 0) close(control->epoll_fd);
+    free(control->socket_path);
+    free(control);
+    return NULL;
+}
+
+int control_add(Control *control, const char *name, int min, int max, int value,
+                ControlSetter set, void *ctx) {
+    if (control->param_count == CONTROL_MAX_PARAMS || strlen(name) >= CONTROL_NAME) return -1;
+
+    ControlParam *param = &control->params[control->param_count++];
+    strcpy(param->name, name);
+    param->min = min;
+    param->max = max;
+    param->value = value;
+    param->set = set;
+    param->ctx = ctx;
+    return 0;
+}
+
+int control_fd(const Control *control) {
+    return control->epoll_fd;
+}
+
+static void drop_client(Control *control, ControlClient *client) {
+    epoll_ctl(control->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+}
+
+/* Send a reply line; 0, or -1 if the client has to go */
+static int reply(ControlClient *client, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static int reply(ControlClient *client, const char *format, ...) {
+    char text[CONTROL_LINE];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text) - 1, format, args);
+    va_end(args);
+    if (length < 0) return -1;
+    if (length > (int)sizeof(text) - 2) length = sizeof(text) - 2;
+    text[length++] = '\n';
+
+    return send(client->fd, text, length, MSG_NOSIGNAL | MSG_DONTWAIT) == length ? 0 : -1;
+}
+
+static ControlParam *find_param(Control *control, const char *name) {
+    for (int i = 0; i < control->param_count; i++) {
+        if (strcmp(control->params[i].name, name) == 0) return &control->params[i];
+    }
+    return NULL;
+}
+
+/* Run one command line; -1 if the client has to go */
+static int run_command(Control *control, ControlClient *client, char *line) {
+    char *save = NULL;
+    char *verb = strtok_r(line, " \t\r", &save);
+    char *name = verb ? strtok_r(NULL, " \t\r", &save) : NULL;
+    char *arg = name ? strtok_r(NULL, " \t\r", &save) : NULL;
+    ControlParam *param = name ? find_param(control, name) : NULL;
+
+    if (!verb) return 0;
+    if (name && !param) return reply(client, "error: no parameter %s", name);
+
+    if (strcmp(verb, "get") == 0) {
+        for (int i = 0; i < control->param_count; i++) {
+            const ControlParam *p = &control->params[i];
+            if (param && p != param) continue;
+            if (reply(client, "%s %d", p->name, p->value) < 0) return -1;
+        }
+        return reply(client, "ok");
+    }
+
+    if (strcmp(verb, "set") == 0) {
+        if (!param || !arg) return reply(client, "error: usage: set NAME VALUE");
+
+        char *end;
+        errno = 0;
+        long value = strtol(arg, &end, 10);
+        if (*end || errno || value < param->min || value > param->max) {
+            return reply(client, "error: %s takes %d to %d", param->name, param->min, param->max);
+        }
+        if (param->set((int)value, param->ctx) < 0) {
+            return reply(client, "error: %s could not be set to %ld", param->name, value);
+        }
+        param->value = (int)value;
+        return reply(client, "ok");
+    }
+
+    return reply(client, "error: unknown command %s", verb);
+}
+
+static void accept_clients(Control *control) {
+    for (;;) {
+        int fd = accept4(control->listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("control: accept");
+            return;
+        }
+
+        int slot = 0;
+        while (slot < CONTROL_MAX_CLIENTS && control->clients[slot].fd >= 0) slot++;
+        struct epoll_event event = { .events = EPOLLIN, .data.u32 = slot };
+        if (slot == CONTROL_MAX_CLIENTS ||
+            epoll_ctl(control->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            close(fd);
+            continue;
+        }
+        control->clients[slot].fd = fd;
+        control->clients[slot].length = 0;
+    }
+}
+
+/* Read what the client sent and run each complete line */
+static void serve_client(Control *control, ControlClient *client) {
+    for (;;) {
+        ssize_t n = recv(client->fd, client->line + client->length,
+                         CONTROL_LINE - client->length, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            drop_client(control, client);
+            return;
+        }
+        client->length += n;
+
+        char *newline;
+        while ((newline = memchr(client->line, '\n', client->length))) {
+            *newline = '\0';
+            int used = newline + 1 - client->line;
+            if (run_command(control, client, client->line) < 0) {
+                drop_client(control, client);
+                return;
+            }
+            memmove(client->line, newline + 1, client->length - used);
+            client->length -= used;
+        }
+        if (client->length == CONTROL_LINE) {
+            reply(client, "error: line too long");
+            drop_client(control, client);
+            return;
+        }
+    }
+}
+
+void control_dispatch(Control *control) {
+    struct epoll_event events[CONTROL_MAX_CLIENTS + 1];
+    int count = epoll_wait(control->epoll_fd, events, CONTROL_MAX_CLIENTS + 1, 0);
+
+    for (int i = 0; i < count; i++) {
+        uint32_t slot = events[i].data.u32;
+        if (slot == UINT32_MAX) {
+            accept_clients(control);
+        } else if (control->clients[slot].fd >= 0) {
+            serve_client(control, &control->clients[slot]);
+        }
+    }
+}
+
+void control_destroy(Control *control) {
+    if (!control) return;
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (control->clients[i].fd >= 0) close(control->clients[i].fd);
+    }
+    close(control->listen_fd);
+    close(control->epoll_fd);
+    unlink(control->socket_path);
+    free(control->socket_path);
+    free(control);
+}
@@ -0,0 +1,42 @@
+/**
+ * Control - change a running instance's parameters over a Unix socket
+ * The owner registers named integer parameters, each with a range and a
+ * setter, and polls one descriptor from its event loop. Clients running
+ * as the same user connect to the socket and send one command per line:
+ *
+ *   get               "name value" for every parameter, then "ok"
+ *   get NAME          "NAME value", then "ok"
+ *   set NAME VALUE    applies it and answers "ok", or "error: ..."
+ *
+ * Commands run on the thread that calls control_dispatch, in between
+ * whatever else its loop does, so setters need no locking against it.
+ * For example: echo "set lights 2000" | socat - UNIX-CONNECT:PATH
+ */
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#define CONTROL_MAX_PARAMS 16
+#define CONTROL_MAX_CLIENTS 8
+
+typedef struct Control Control;
+
+/* Apply value, already checked against the range; returns 0, or -1 to refuse it */
+typedef int (*ControlSetter)(int value, void *ctx);
+
+/* Listen for clients on socket_path; NULL on error */
+Control *control_create(const char *socket_path);
+
+/* Register a parameter whose value is value now; -1 when full */
+int control_add(Control *control, const char *name, int min, int max, int value,
+                ControlSetter set, void *ctx);
+
+/* One descriptor to poll for POLLIN; call control_dispatch() when ready */
+int control_fd(const Control *control);
+
+/* Accept clients and run every complete command they sent, without blocking */
+void control_dispatch(Control *control);
+
+void control_destroy(Control *control);
+
+#endif /* CONTROL_H */
@@ -0,0 +1,729 @@
+/**
+ * Fake Wayland Compositor - protocol and pacing test harness
+ * A minimal libwayland-server compositor so the Wayland path of the
+ * Christmas tree can be exercised on machines without a display. It
+ * advertises wl_compositor, wl_shm and xdg_wm_base, fires frame callbacks
+ * at a fixed rate and reports what the client sent back.
+ *
+ * Usage: fake_compositor [-r hz] [-n frames] [-H frame:ms] [-s name] [-- client args...]
+ *
+ * With a client command the client is spawned on a private socketpair
+ * (WAYLAND_SOCKET) and the exit status tells whether it mapped a window,
+ * honoured the configure handshake and exited cleanly.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <wayland-server.h>
+
+/* Include XDG shell protocol header */
+#include "xdg-shell-server-protocol.h"
+
+#define NSEC_PER_SEC 1000000000ull
+#define HANDSHAKE_TIMEOUT_MS 5000   /* Client must map a buffer by then */
+#define CLOSE_TIMEOUT_MS 2000       /* Client must disconnect after close */
+
+/* Options */
+static double frame_rate = 60.0;
+static uint32_t close_after = 300;     /* Frames before xdg_toplevel.close, 0 = never */
+static uint32_t hide_at = 0;           /* Frame that starts a hidden period, 0 = never */
+static uint32_t hide_ms = 0;
+
+/* Server state */
+static struct wl_display *display = NULL;
+static struct wl_event_source *watchdog = NULL;
+static struct wl_list frame_queue;      /* Committed wl_callbacks awaiting a tick */
+static struct wl_client *tracked_client = NULL; /* The client under test */
+static struct wl_resource *toplevel = NULL;
+static uint64_t hidden_until_ns = 0;
+static int close_sent = 0;
+static int client_gone = 0;
+
+/* Surface state; only what the counters need */
+typedef struct {
+    struct wl_resource *resource;
+    struct wl_resource *xdg_surface;
+    struct wl_resource *xdg_toplevel;
+    struct wl_resource *pending_buffer;
+    struct wl_listener buffer_destroy;
+    int pending_attach;
+    uint64_t pending_damage;           /* Pixels damaged since last commit */
+    struct wl_list pending_frames;     /* wl_callbacks requested since last commit */
+    uint32_t configure_serial;
+    int configure_sent;
+    int acked;
+} FakeSurface;
+
+/* What the client did */
+static struct {
+    uint32_t frames;                   /* Ticks that fired at least one callback */
+    uint32_t commits;
+    uint32_t attaches;
+    uint32_t releases;
+    uint32_t hidden_commits;
+    uint64_t damage_px;
+    uint64_t latency_sum_ns;
+    uint64_t latency_max_ns;
+    uint32_t latency_samples;
+    uint32_t late_commits;             /* Commit landed after the next tick */
+    uint32_t pings;
+    uint32_t pongs;
+    uint32_t protocol_errors;
+    int mapped;
+} stats;
+
+static uint64_t last_done_ns = 0;
+static int awaiting_commit = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Destructor for resources kept on a wl_list through their link */
+static void unlink_resource(struct wl_resource *resource) {
+    wl_list_remove(wl_resource_get_link(resource));
+}
+
+/* Generic destroy request */
+static void destroy_resource(struct wl_client *client, struct wl_resource *resource) {
+    wl_resource_destroy(resource);
+}
+
+/* wl_region: accepted and ignored */
+static void region_add(struct wl_client *client, struct wl_resource *resource,
+                       int32_t x, int32_t y, int32_t width, int32_t height) {
+}
+
+static const struct wl_region_interface region_impl = {
+    destroy_resource,
+    region_add,
+    region_add
+};
+
+/* Send the xdg configure sequence with the given toplevel state */
+static void send_configure(FakeSurface *fs, uint32_t state) {
+    struct wl_array states;
+    wl_array_init(&states);
+    uint32_t *s = wl_array_add(&states, sizeof(uint32_t));
+    if (s) *s = state;
+
+    xdg_toplevel_send_configure(fs->xdg_toplevel, 0, 0, &states);
+    wl_array_release(&states);
+
+    fs->configure_serial = wl_display_next_serial(display);
+    fs->configure_sent = 1;
+    xdg_surface_send_configure(fs->xdg_surface, fs->configure_serial);
+}
+
+/* wl_surface */
+static void surface_buffer_destroyed(struct wl_listener *listener, void *data) {
+    FakeSurface *fs = wl_container_of(listener, fs, buffer_destroy);
+    fs->pending_buffer = NULL;
+    wl_list_remove(&fs->buffer_destroy.link);
+    wl_list_init(&fs->buffer_destroy.link);
+}
+
+static void surface_attach(struct wl_client *client, struct wl_resource *resource,
+                           struct wl_resource *buffer, int32_t x, int32_t y) {
+    FakeSurface *fs = wl_resource_get_user_data(resource);
+
+    wl_list_remove(&fs->buffer_destroy.link);
+    wl_list_init(&fs->buffer_destroy.link);
+    fs->pending_buffer = buffer;
+    fs->pending_attach = 1;
+    if (buffer) {
+        wl_resource_add_destroy_listener(buffer, &fs->buffer_destroy);
+    }
+}
+
+static void surface_damage(struct wl_client *client, struct wl_resource *resource,
+                           int32_t x, int32_t y, int32_t width, int32_t height) {
+    FakeSurface *fs = wl_resource_get_user_data(resource);
+    if (width > 0 && height > 0) {
+        fs->pending_damage += (uint64_t)width * height;
+    }
+}
+
+static void surface_frame(struct wl_client *client, struct wl_resource *resource,
+                          uint32_t callback) {
+    FakeSurface *fs = wl_resource_get_user_data(resource);
+    struct wl_resource *cb = wl_resource_create(client, &wl_callback_interface, 1, callback);
+    if (!cb) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    wl_resource_set_implementation(cb, NULL, NULL, unlink_resource);
+    wl_list_insert(fs->pending_frames.prev, wl_resource_get_link(cb));
+}
+
+static void surface_set_region(struct wl_client *client, struct wl_resource *resource,
+                               struct wl_resource *region) {
+}
+
+static void surface_commit(struct wl_client *client, struct wl_resource *resource) {
+    FakeSurface *fs = wl_resource_get_user_data(resource);
+    uint64_t now = now_ns();
+
+    stats.commits++;
+    if (hidden_until_ns) stats.hidden_commits++;
+
+    if (awaiting_commit) {
+        uint64_t latency = now - last_done_ns;
+        stats.latency_sum_ns += latency;
+        stats.latency_samples++;
+        if (latency > stats.latency_max_ns) stats.latency_max_ns = latency;
+        if (latency > NSEC_PER_SEC / frame_rate) stats.late_commits++;
+        awaiting_commit = 0;
+    }
+
+    /* Initial commit of a toplevel starts the configure handshake */
+    if (fs->xdg_toplevel && !fs->configure_sent) {
+        if (fs->pending_attach && fs->pending_buffer) {
+            stats.protocol_errors++;
+            wl_resource_post_error(fs->xdg_surface, XDG_SURFACE_ERROR_UNCONFIGURED_BUFFER,
+                                   "buffer attached before the initial configure");
+            return;
+        }
+        send_configure(fs, XDG_TOPLEVEL_STATE_ACTIVATED);
+    }
+
+    if (fs->pending_attach && fs->pending_buffer) {
+        if (fs->xdg_surface && !fs->acked) {
+            stats.protocol_errors++;
+            wl_resource_post_error(fs->xdg_surface, XDG_SURFACE_ERROR_UNCONFIGURED_BUFFER,
+                                   "buffer committed before ack_configure");
+            return;
+        }
+
+        /* "Composite" by touching the buffer, then hand it straight back */
+        struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(fs->pending_buffer);
+        if (shm_buffer) {
+            int32_t width = wl_shm_buffer_get_width(shm_buffer);
+            int32_t height = wl_shm_buffer_get_height(shm_buffer);
+            uint64_t area = (uint64_t)width * height;
+
+            if (area) {
+                wl_shm_buffer_begin_access(shm_buffer);
+                volatile uint32_t *pixels = wl_shm_buffer_get_data(shm_buffer);
+                (void)pixels[area - 1];
+                wl_shm_buffer_end_access(shm_buffer);
+            }
+
+            stats.damage_px += fs->pending_damage < area ? fs->pending_damage : area;
+        }
+
+        /* First pixels: the handshake watchdog has done its job */
+        if (!stats.mapped && watchdog && !close_sent) {
+            wl_event_source_timer_update(watchdog, 0);
+        }
+
+        stats.attaches++;
+        stats.mapped = 1;
+        wl_buffer_send_release(fs->pending_buffer);
+        stats.releases++;
+
+        wl_list_remove(&fs->buffer_destroy.link);
+        wl_list_init(&fs->buffer_destroy.link);
+        fs->pending_buffer = NULL;
+    }
+
+    fs->pending_attach = 0;
+    fs->pending_damage = 0;
+    wl_list_insert_list(frame_queue.prev, &fs->pending_frames);
+    wl_list_init(&fs->pending_frames);
+}
+
+static void surface_set_int(struct wl_client *client, struct wl_resource *resource,
+                            int32_t value) {
+}
+
+static void surface_offset(struct wl_client *client, struct wl_resource *resource,
+                           int32_t x, int32_t y) {
+}
+
+static const struct wl_surface_interface surface_impl = {
+    destroy_resource,
+    surface_attach,
+    surface_damage,
+    surface_frame,
+    surface_set_region,
+    surface_set_region,
+    surface_commit,
+    surface_set_int,
+    surface_set_int,
+    surface_damage,
+    surface_offset
+};
+
+static void surface_destroyed(struct wl_resource *resource) {
+    FakeSurface *fs = wl_resource_get_user_data(resource);
+    struct wl_resource *cb, *tmp;
+
+    wl_resource_for_each_safe(cb, tmp, &fs->pending_frames) {
+        wl_resource_destroy(cb);
+    }
+    wl_list_remove(&fs->buffer_destroy.link);
+    free(fs);
+}
+
+/* wl_compositor */
+static void compositor_create_surface(struct wl_client *client, struct wl_resource *resource,
+                                      uint32_t id) {
+    FakeSurface *fs = calloc(1, sizeof(*fs));
+    struct wl_resource *res = wl_resource_create(client, &wl_surface_interface,
+                                                 wl_resource_get_version(resource), id);
+    if (!fs || !res) {
+        free(fs);
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    fs->resource = res;
+    wl_list_init(&fs->pending_frames);
+    wl_list_init(&fs->buffer_destroy.link);
+    fs->buffer_destroy.notify = surface_buffer_destroyed;
+    wl_resource_set_implementation(res, &surface_impl, fs, surface_destroyed);
+}
+
+static void compositor_create_region(struct wl_client *client, struct wl_resource *resource,
+                                     uint32_t id) {
+    struct wl_resource *res = wl_resource_create(client, &wl_region_interface, 1, id);
+    if (!res) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    wl_resource_set_implementation(res, &region_impl, NULL, NULL);
+}
+
+static const struct wl_compositor_interface compositor_impl = {
+    compositor_create_surface,
+    compositor_create_region
+};
+
+/* The run ends when the client under test goes away */
+static void client_destroyed(struct wl_listener *listener, void *data) {
+    client_gone = 1;
+    wl_display_terminate(display);
+}
+
+static struct wl_listener client_destroy_listener = {
+    .notify = client_destroyed
+};
+
+static void track_client(struct wl_client *client) {
+    if (tracked_client) return;
+    tracked_client = client;
+    wl_client_add_destroy_listener(client, &client_destroy_listener);
+}
+
+static void bind_compositor(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *res = wl_resource_create(client, &wl_compositor_interface, version, id);
+    if (!res) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(res, &compositor_impl, NULL, NULL);
+
+    /* Clients connecting by name are tracked from their first bind */
+    track_client(client);
+}
+
+/* xdg_toplevel: every request is accepted and ignored */
+static void toplevel_set_object(struct wl_client *client, struct wl_resource *resource,
+                                struct wl_resource *object) {
+}
+
+static void toplevel_set_string(struct wl_client *client, struct wl_resource *resource,
+                                const char *value) {
+}
+
+static void toplevel_show_window_menu(struct wl_client *client, struct wl_resource *resource,
+                                      struct wl_resource *seat, uint32_t serial,
+                                      int32_t x, int32_t y) {
+}
+
+static void toplevel_move(struct wl_client *client, struct wl_resource *resource,
+                          struct wl_resource *seat, uint32_t serial) {
+}
+
+static void toplevel_resize(struct wl_client *client, struct wl_resource *resource,
+                            struct wl_resource *seat, uint32_t serial, uint32_t edges) {
+}
+
+static void toplevel_set_size(struct wl_client *client, struct wl_resource *resource,
+                              int32_t width, int32_t height) {
+}
+
+static void toplevel_set_state(struct wl_client *client, struct wl_resource *resource) {
+}
+
+static const struct xdg_toplevel_interface toplevel_impl = {
+    destroy_resource,
+    toplevel_set_object,
+    toplevel_set_string,
+    toplevel_set_string,
+    toplevel_show_window_menu,
+    toplevel_move,
+    toplevel_resize,
+    toplevel_set_size,
+    toplevel_set_size,
+    toplevel_set_state,
+    toplevel_set_state,
+    toplevel_set_object,
+    toplevel_set_state,
+    toplevel_set_state
+};
+
+static void toplevel_destroyed(struct wl_resource *resource) {
+    FakeSurface *fs = wl_resource_get_user_data(resource);
+    if (fs) fs->xdg_toplevel = NULL;
+    if (toplevel == resource) toplevel = NULL;
+}
+
+/* xdg_surface */
+static void xdg_surface_get_toplevel(struct wl_client *client, struct wl_resource *resource,
+                                     uint32_t id) {
+    FakeSurface *fs = wl_resource_get_user_data(resource);
+    struct wl_resource *res = wl_resource_create(client, &xdg_toplevel_interface,
+                                                 wl_resource_get_version(resource), id);
+    if (!res) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    wl_resource_set_implementation(res, &toplevel_impl, fs, toplevel_destroyed);
+    fs->xdg_toplevel = res;
+    toplevel = res;
+}
+
+static void xdg_surface_get_popup(struct wl_client *client, struct wl_resource *resource,
+                                  uint32_t id, struct wl_resource *parent,
+                                  struct wl_resource *positioner) {
+    wl_client_post_implementation_error(client, "popups are not supported");
+}
+
+static void xdg_surface_set_window_geometry(struct wl_client *client,
+                                            struct wl_resource *resource,
+                                            int32_t x, int32_t y,
+                                            int32_t width, int32_t height) {
+}
+
+static void xdg_surface_ack_configure(struct wl_client *client, struct wl_resource *resource,
+                                      uint32_t serial) {
+    FakeSurface *fs = wl_resource_get_user_data(resource);
+    if (!fs->configure_sent || serial != fs->configure_serial) {
+        stats.protocol_errors++;
+        wl_resource_post_error(resource, XDG_SURFACE_ERROR_INVALID_SERIAL,
+                               "ack_configure with unknown serial %u", serial);
+        return;
+    }
+    fs->acked = 1;
+}
+
+static const struct xdg_surface_interface xdg_surface_impl = {
+    destroy_resource,
+    xdg_surface_get_toplevel,
+    xdg_surface_get_popup,
+    xdg_surface_set_window_geometry,
+    xdg_surface_ack_configure
+};
+
+static void xdg_surface_destroyed(struct wl_resource *resource) {
+    FakeSurface *fs = wl_resource_get_user_data(resource);
+    if (fs) fs->xdg_surface = NULL;
+}
+
+/* xdg_wm_base */
+static void wm_base_create_positioner(struct wl_client *client, struct wl_resource *resource,
+                                      uint32_t id) {
+    wl_client_post_implementation_error(client, "positioners are not supported");
+}
+
+static void wm_base_get_xdg_surface(struct wl_client *client, struct wl_resource *resource,
+                                    uint32_t id, struct wl_resource *surface) {
+    FakeSurface *fs = wl_resource_get_user_data(surface);
+    struct wl_resource *res = wl_resource_create(client, &xdg_surface_interface,
+                                                 wl_resource_get_version(resource), id);
+    if (!res) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    wl_resource_set_implementation(res, &xdg_surface_impl, fs, xdg_surface_destroyed);
+    fs->xdg_surface = res;
+}
+
+static void wm_base_pong(struct wl_client *client, struct wl_resource *resource,
+                         uint32_t serial) {
+    stats.pongs++;
+}
+
+static const struct xdg_wm_base_interface wm_base_impl = {
+    destroy_resource,
+    wm_base_create_positioner,
+    wm_base_get_xdg_surface,
+    wm_base_pong
+};
+
+static void bind_wm_base(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *res = wl_resource_create(client, &xdg_wm_base_interface, version, id);
+    if (!res) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(res, &wm_base_impl, NULL, NULL);
+
+    /* Every client must answer pings */
+    stats.pings++;
+    xdg_wm_base_send_ping(res, wl_display_next_serial(display));
+}
+
+/* Start or end the simulated hidden period */
+static void set_hidden(int hidden) {
+    FakeSurface *fs = toplevel ? wl_resource_get_user_data(toplevel) : NULL;
+
+    if (hidden) {
+        hidden_until_ns = now_ns() + (uint64_t)hide_ms * 1000000ull;
+    } else {
+        hidden_until_ns = 0;
+    }
+
+    /* Suspended needs xdg_wm_base v6; older clients only see callbacks stop */
+    if (!fs || !fs->xdg_surface) return;
+    if (hidden && wl_resource_get_version(toplevel) < XDG_TOPLEVEL_STATE_SUSPENDED_SINCE_VERSION) {
+        return;
+    }
+    send_configure(fs, hidden ? XDG_TOPLEVEL_STATE_SUSPENDED : XDG_TOPLEVEL_STATE_ACTIVATED);
+}
+
+/* Frame clock: fire every committed frame callback */
+static int frame_tick(int fd, uint32_t mask, void *data) {
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0) return 0;
+
+    uint64_t now = now_ns();
+    if (hidden_until_ns) {
+        if (now < hidden_until_ns) return 0;
+        set_hidden(0);
+    }
+
+    if (wl_list_empty(&frame_queue)) return 0;
+
+    struct wl_resource *cb, *tmp;
+    uint32_t time_ms = (uint32_t)(now / 1000000ull);
+    wl_resource_for_each_safe(cb, tmp, &frame_queue) {
+        wl_callback_send_done(cb, time_ms);
+        wl_resource_destroy(cb);
+    }
+
+    stats.frames++;
+    last_done_ns = now;
+    awaiting_commit = 1;
+
+    if (hide_at && stats.frames == hide_at) {
+        set_hidden(1);
+    }
+
+    if (close_after && stats.frames >= close_after && !close_sent && toplevel) {
+        xdg_toplevel_send_close(toplevel);
+        close_sent = 1;
+        wl_event_source_timer_update(watchdog, CLOSE_TIMEOUT_MS);
+    }
+
+    return 0;
+}
+
+/* Fires if the client never maps, or never leaves after close */
+static int watchdog_expired(void *data) {
+    fprintf(stderr, "fake_compositor: %s\n",
+            close_sent ? "client did not disconnect after close" : "client never mapped a buffer");
+    wl_display_terminate(display);
+    return 0;
+}
+
+/* Spawn the client on one end of a socketpair, passed as WAYLAND_SOCKET */
+static pid_t spawn_client(char **argv) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        perror("socketpair");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        char fd_str[16];
+        int fd = dup(sv[1]);  /* dup() clears close-on-exec */
+        snprintf(fd_str, sizeof(fd_str), "%d", fd);
+        setenv("WAYLAND_SOCKET", fd_str, 1);
+        unsetenv("WAYLAND_DISPLAY");
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+
+    close(sv[1]);
+    struct wl_client *client = wl_client_create(display, sv[0]);
+    if (!client) {
+        fprintf(stderr, "fake_compositor: wl_client_create failed\n");
+        close(sv[0]);
+        kill(pid, SIGTERM);
+        return -1;
+    }
+    track_client(client);
+
+    return pid;
+}
+
+static void print_report(void) {
+    printf("fake_compositor: %u frames at %.1f Hz\n", stats.frames, frame_rate);
+    printf("  commits: %u (%u with buffer, %u while hidden), releases: %u\n",
+           stats.commits, stats.attaches, stats.hidden_commits, stats.releases);
+    printf("  damage: %llu px total, %llu px/attach\n",
+           (unsigned long long)stats.damage_px,
+           (unsigned long long)(stats.attaches ? stats.damage_px / stats.attaches : 0));
+    printf("  commit latency: avg %.2f ms, max %.2f ms, %u late\n",
+           stats.latency_samples ? stats.latency_sum_ns / 1e6 / stats.latency_samples : 0.0,
+           stats.latency_max_ns / 1e6, stats.late_commits);
+    printf("  mapped: %s, pings answered: %u/%u, protocol errors: %u\n",
+           stats.mapped ? "yes" : "no", stats.pongs, stats.pings, stats.protocol_errors);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-r hz] [-n frames] [-H frame:ms] [-s name] [-- client args...]\n"
+            "  -r hz        frame callback rate (default 60)\n"
+            "  -n frames    send xdg_toplevel.close after this many frames, 0 = never (default 300)\n"
+            "  -H frame:ms  suspend and withhold callbacks for ms starting at frame\n"
+            "  -s name      listen on this socket name instead of an automatic one\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *socket_name = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:n:H:s:h")) != -1) {
+        switch (opt) {
+        case 'r':
+            frame_rate = atof(optarg);
+            break;
+        case 'n':
+            close_after = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'H':
+            if (sscanf(optarg, "%u:%u", &hide_at, &hide_ms) != 2) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 's':
+            socket_name = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    if (frame_rate <= 0) {
+        fprintf(stderr, "fake_compositor: frame rate must be positive\n");
+        return 2;
+    }
+
+    display = wl_display_create();
+    if (!display) {
+        fprintf(stderr, "fake_compositor: cannot create display\n");
+        return 1;
+    }
+
+    struct wl_event_loop *loop = wl_display_get_event_loop(display);
+    wl_list_init(&frame_queue);
+
+    /* Globals */
+    wl_global_create(display, &wl_compositor_interface, 4, NULL, bind_compositor);
+    wl_global_create(display, &xdg_wm_base_interface, 6, NULL, bind_wm_base);
+    wl_display_init_shm(display);
+
+    /* Frame clock */
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timer_fd < 0) {
+        perror("timerfd_create");
+        return 1;
+    }
+    uint64_t period = (uint64_t)(NSEC_PER_SEC / frame_rate);
+    struct itimerspec its = {
+        .it_interval = { period / NSEC_PER_SEC, period % NSEC_PER_SEC },
+        .it_value = { period / NSEC_PER_SEC, period % NSEC_PER_SEC },
+    };
+    timerfd_settime(timer_fd, 0, &its, NULL);
+    wl_event_loop_add_fd(loop, timer_fd, WL_EVENT_READABLE, frame_tick, NULL);
+
+    /* Client: spawned on a private socketpair, or connecting by name */
+    pid_t child = -1;
+    if (optind < argc) {
+        child = spawn_client(&argv[optind]);
+        if (child < 0) return 1;
+
+        watchdog = wl_event_loop_add_timer(loop, watchdog_expired, NULL);
+        wl_event_source_timer_update(watchdog, HANDSHAKE_TIMEOUT_MS);
+    } else {
+        if (socket_name) {
+            if (wl_display_add_socket(display, socket_name) < 0) {
+                fprintf(stderr, "fake_compositor: cannot listen on %s\n", socket_name);
+                return 1;
+            }
+        } else {
+            socket_name = wl_display_add_socket_auto(display);
+            if (!socket_name) {
+                fprintf(stderr, "fake_compositor: cannot create a socket\n");
+                return 1;
+            }
+        }
+        printf("fake_compositor: listening on WAYLAND_DISPLAY=%s\n", socket_name);
+        fflush(stdout);
+
+        watchdog = wl_event_loop_add_timer(loop, watchdog_expired, NULL);
+    }
+
+    wl_display_run(display);
+
+    /* The watchdog also fires on a mapped client that ignores close */
+    int client_status = 0;
+    if (child > 0) {
+        if (!client_gone) kill(child, SIGTERM);
+        waitpid(child, &client_status, 0);
+    }
+
+    print_report();
+
+    wl_display_destroy_clients(display);
+    close(timer_fd);
+    wl_display_destroy(display);
+
+    if (child > 0) {
+        int ok = stats.mapped && !stats.protocol_errors && stats.pongs == stats.pings &&
+                 client_gone && WIFEXITED(client_status) && WEXITSTATUS(client_status) == 0;
+        return ok ? 0 : 1;
+    }
+    return 0;
+}
@@ -0,0 +1,245 @@
+/**
+ * Frame Consumer - reference reader for the shared frame ring
+ * Connects to a running christmas_tree started with --publish, maps the
+ * ring read-only and follows the latest frame without copying it or
+ * taking any lock. Each new frame is read in place (a checksum stands in
+ * for real work) and then validated, so torn reads are counted rather
+ * than silently used.
+ *
+ * Usage: frame_consumer [-n frames] [-i us] [-o out.ppm] socket
+ *
+ * Reports render-to-consumer latency: from the moment the renderer
+ * started the frame until this process finished reading it.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "frame_ring.h"
+
+#define STALL_TIMEOUT_NS 5000000000ull  /* Give up when nothing new arrives for this long */
+
+/* Options */
+static uint32_t max_frames = 600;      /* Frames to read before exiting, 0 = forever */
+static uint32_t interval_us = 500;     /* Poll interval for a new frame */
+static const char *snapshot_path = NULL;
+
+static struct {
+    uint32_t frames;                   /* Frames read intact */
+    uint32_t skipped;                  /* Published frames never seen */
+    uint32_t torn;                     /* Frames overwritten while being read */
+    uint64_t latency_sum_ns;
+    uint64_t latency_max_ns;
+    uint64_t pickup_sum_ns;            /* Publish to start of read */
+    uint64_t checksum;
+} stats;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Connect to the publisher and receive the ring memfd */
+static int receive_ring_fd(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "frame_consumer: socket path too long\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(path);
+        if (sock >= 0) close(sock);
+        return -1;
+    }
+
+    char byte;
+    struct iovec iov = { &byte, 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+    };
+
+    int fd = -1;
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) > 0) {
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    close(sock);
+
+    if (fd < 0) fprintf(stderr, "frame_consumer: publisher sent no ring\n");
+    return fd;
+}
+
+/* Stand-in for an encoder: touch every pixel of the frame */
+static uint64_t read_frame(const uint32_t *pixels, uint32_t width, uint32_t height, uint32_t stride) {
+    uint64_t sum = 0;
+    for (uint32_t y = 0; y < height; y++) {
+        const uint32_t *row = (const uint32_t *)((const uint8_t *)pixels + (size_t)y * stride);
+        for (uint32_t x = 0; x < width; x++) {
+            sum += row[x];
+        }
+    }
+    return sum;
+}
+
+static void write_snapshot(const uint32_t *pixels, const FrameRingHeader *h) {
+    FILE *f = fopen(snapshot_path, "wb");
+    if (!f) {
+        perror(snapshot_path);
+        return;
+    }
+    fprintf(f, "P6\n%u %u\n255\n", h->width, h->height);
+    for (uint32_t y = 0; y < h->height; y++) {
+        const uint32_t *row = (const uint32_t *)((const uint8_t *)pixels + (size_t)y * h->stride);
+        for (uint32_t x = 0; x < h->width; x++) {
+            uint8_t rgb[3] = { row[x] >> 16, row[x] >> 8, row[x] };
+            fwrite(rgb, 1, 3, f);
+        }
+    }
+    fclose(f);
+}
+
+static void print_stats(void) {
+    printf("frame_consumer: %u frames read, %u skipped, %u torn\n",
+           stats.frames, stats.skipped, stats.torn);
+    printf("  render-to-consumer latency: avg %.2f ms, max %.2f ms\n",
+           stats.frames ? stats.latency_sum_ns / 1e6 / stats.frames : 0.0,
+           stats.latency_max_ns / 1e6);
+    printf("  publish-to-pickup: avg %.3f ms\n",
+           stats.frames ? stats.pickup_sum_ns / 1e6 / stats.frames : 0.0);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-n frames] [-i us] [-o out.ppm] socket\n"
+            "  -n frames    exit after reading this many frames, 0 = never (default 600)\n"
+            "  -i us        poll interval in microseconds (default 500)\n"
+            "  -o out.ppm   save the last frame read (with -n)\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:i:o:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            max_frames = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'i':
+            interval_us = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            snapshot_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    int fd = receive_ring_fd(argv[optind]);
+    if (fd < 0) return 1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(FrameRingHeader)) {
+        fprintf(stderr, "frame_consumer: ring is too small\n");
+        return 1;
+    }
+    const uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    const FrameRingHeader *h = (const FrameRingHeader *)map;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != FRAME_RING_MAGIC ||
+        h->version != FRAME_RING_VERSION || h->slot_count == 0 ||
+        h->slot_count > FRAME_RING_MAX_SLOTS ||
+        h->slot_offset + (uint64_t)h->slot_size * h->slot_count > (uint64_t)st.st_size) {
+        fprintf(stderr, "frame_consumer: not a frame ring this build understands\n");
+        return 1;
+    }
+    printf("frame_consumer: %ux%u, %u slots\n", h->width, h->height, h->slot_count);
+
+    uint64_t last_seq = 0;
+    uint64_t last_new_ns = monotonic_ns();
+    struct timespec interval = { interval_us / 1000000, (long)(interval_us % 1000000) * 1000 };
+
+    while (!max_frames || stats.frames < max_frames) {
+        uint64_t seq = __atomic_load_n(&h->latest, __ATOMIC_ACQUIRE);
+        if (seq == 0 || seq == last_seq) {
+            if (monotonic_ns() - last_new_ns > STALL_TIMEOUT_NS) {
+                fprintf(stderr, "frame_consumer: no new frames, publisher gone or hidden\n");
+                break;
+            }
+            nanosleep(&interval, NULL);
+            continue;
+        }
+        last_new_ns = monotonic_ns();
+
+        const FrameRingSlot *slot = &h->slots[seq % h->slot_count];
+        const uint32_t *pixels = (const uint32_t *)(map + h->slot_offset +
+                                                   (seq % h->slot_count) * h->slot_size);
+
+        uint64_t begin = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (begin != seq * 2) {
+            /* Already being rewritten; a newer frame is on its way */
+            stats.torn++;
+            last_seq = seq;
+            continue;
+        }
+
+        uint64_t pickup = monotonic_ns();
+        uint64_t publish_ns = slot->publish_ns;
+        uint64_t render_ns = slot->render_ns;
+        uint64_t sum = read_frame(pixels, h->width, h->height, h->stride);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != begin) {
+            stats.torn++;
+            last_seq = seq;
+            continue;
+        }
+
+        uint64_t done = monotonic_ns();
+        uint64_t latency = done - publish_ns + render_ns;
+        if (last_seq && seq > last_seq + 1) stats.skipped += seq - last_seq - 1;
+        stats.frames++;
+        stats.latency_sum_ns += latency;
+        if (latency > stats.latency_max_ns) stats.latency_max_ns = latency;
+        stats.pickup_sum_ns += pickup - publish_ns;
+        stats.checksum += sum;
+        last_seq = seq;
+
+        if (snapshot_path && stats.frames == max_frames) {
+            write_snapshot(pixels, h);
+        }
+    }
+
+    print_stats();
+    return 0;
+}
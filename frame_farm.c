@@ -0,0 +1,412 @@
+/**
+ * Frame Farm - render an export across worker processes
+ * See frame_farm.h. Each worker holds up to range + 2 buffers: enough to
+ * park a whole range that finished ahead of the writer and keep rendering
+ * the next one, which is what keeps every worker busy with in-order
+ * output. Large frames or many workers get fewer, down to two each; a
+ * worker then waits for the writer sooner, but never for a frame that
+ * only it could render, since it renders its range in order.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "frame_farm.h"
+
+#define FARM_SPARE_BUFFERS 2
+#define FARM_MIN_BUFFERS 2             /* Per worker, whatever the budget */
+
+enum {
+    FARM_MSG_RANGE,           /* coordinator -> worker: render [first, first + count) */
+    FARM_MSG_RELEASE,         /* coordinator -> worker: buffer is free again */
+    FARM_MSG_QUIT,            /* coordinator -> worker: no more work */
+    FARM_MSG_FRAME,           /* worker -> coordinator: frame is in buffer */
+    FARM_MSG_REPORT           /* worker -> coordinator: report_size bytes follow, then exit */
+};
+
+typedef struct {
+    uint32_t type;
+    int32_t index;            /* RANGE: first frame; FRAME: frame index */
+    int32_t count;            /* RANGE: frames in range */
+    int32_t buffer;           /* RELEASE, FRAME: buffer id */
+} FarmMsg;
+
+typedef struct {
+    pid_t pid;
+    int sock;
+    uint32_t **buffers;       /* Coordinator mappings, NULL until shared */
+    int *pending;             /* Frame held in each buffer, -1 if none */
+    int range_end;            /* End of the current range, exclusive */
+    int received;             /* Frames received from the current range */
+    int range_count;
+    int done;
+} FarmWorker;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int send_msg(int sock, const FarmMsg *msg, int fd) {
+    struct iovec iov = { (void *)msg, sizeof(*msg) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    if (fd >= 0) {
+        memset(&control, 0, sizeof(control));
+        mh.msg_control = control.buf;
+        mh.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t ret;
+    do {
+        ret = sendmsg(sock, &mh, MSG_NOSIGNAL);
+    } while (ret < 0 && errno == EINTR);
+    return ret == sizeof(*msg) ? 0 : -1;
+}
+
+/* Receive one message and any passed fd; 0 on EOF, -1 on error or would-block */
+static int recv_msg(int sock, FarmMsg *msg, int *fd, int flags) {
+    struct iovec iov = { msg, sizeof(*msg) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr mh = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+    };
+
+    ssize_t ret;
+    do {
+        ret = recvmsg(sock, &mh, flags | MSG_CMSG_CLOEXEC);
+    } while (ret < 0 && errno == EINTR);
+    if (ret <= 0) return (int)ret;
+    if (ret != sizeof(*msg)) return -1;
+
+    if (fd) *fd = -1;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int passed;
+            memcpy(&passed, CMSG_DATA(cmsg), sizeof(int));
+            if (fd) *fd = passed;
+            else close(passed);
+        }
+    }
+    return 1;
+}
+
+/* Send the worker's report in one packet after its header */
+static int send_report(const FarmConfig *config, int sock) {
+    void *report = calloc(1, config->report_size);
+    if (!report) return -1;
+    config->report(config->ctx, report);
+
+    FarmMsg msg = { FARM_MSG_REPORT, 0, 0, 0 };
+    struct iovec iov[2] = { { &msg, sizeof(msg) }, { report, config->report_size } };
+    struct msghdr mh = { .msg_iov = iov, .msg_iovlen = 2 };
+    ssize_t ret;
+    do {
+        ret = sendmsg(sock, &mh, MSG_NOSIGNAL);
+    } while (ret < 0 && errno == EINTR);
+    free(report);
+    return ret == (ssize_t)(sizeof(msg) + config->report_size) ? 0 : -1;
+}
+
+/* Wait for a worker's report and merge it; frames still in flight are skipped */
+static void merge_report(const FarmConfig *config, int sock) {
+    size_t size = sizeof(FarmMsg) + config->report_size;
+    char *packet = malloc(size);
+    if (!packet) return;
+
+    for (;;) {
+        ssize_t ret = recv(sock, packet, size, 0);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < (ssize_t)sizeof(FarmMsg)) break;
+
+        FarmMsg msg;
+        memcpy(&msg, packet, sizeof(msg));
+        if (msg.type == FARM_MSG_REPORT && ret == (ssize_t)size) {
+            config->merge(config->ctx, packet + sizeof(msg));
+            break;
+        }
+    }
+    free(packet);
+}
+
+/*
+ * Worker process: render ranges as they arrive, one buffer per frame.
+ * Releases are drained between frames so a buffer freed mid-range is
+ * reused right away; the worker only blocks when it has nothing to do.
+ */
+static int worker_main(const FarmConfig *config, int sock, int num_buffers) {
+    size_t size = (size_t)config->width * config->height * 4;
+    int *fds = calloc(num_buffers, sizeof(int));
+    uint32_t **buffers = calloc(num_buffers, sizeof(uint32_t *));
+    char *busy = calloc(num_buffers, 1);
+    char *shared = calloc(num_buffers, 1);
+    if (!fds || !buffers || !busy || !shared) return 1;
+
+    for (int i = 0; i < num_buffers; i++) {
+        fds[i] = memfd_create("christmas-tree-farm", MFD_CLOEXEC);
+        if (fds[i] < 0 || ftruncate(fds[i], size) < 0) {
+            perror("farm worker: memfd");
+            return 1;
+        }
+        buffers[i] = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[i], 0);
+        if (buffers[i] == MAP_FAILED) {
+            perror("farm worker: mmap");
+            return 1;
+        }
+    }
+
+    int next = 0, end = 0;
+    for (;;) {
+        int free_buffer = -1;
+        for (int i = 0; i < num_buffers && free_buffer < 0; i++) {
+            if (!busy[i]) free_buffer = i;
+        }
+
+        if (next < end && free_buffer >= 0) {
+            config->render(config->ctx, buffers[free_buffer], next);
+
+            FarmMsg frame = { FARM_MSG_FRAME, next, 0, free_buffer };
+            if (send_msg(sock, &frame, shared[free_buffer] ? -1 : fds[free_buffer]) < 0) {
+                return 1;
+            }
+            shared[free_buffer] = 1;
+            busy[free_buffer] = 1;
+            next++;
+        }
+
+        /* Block only when there is nothing to render */
+        int idle = next >= end || free_buffer < 0;
+        FarmMsg msg;
+        int ret;
+        while ((ret = recv_msg(sock, &msg, NULL, idle ? 0 : MSG_DONTWAIT)) > 0) {
+            if (msg.type == FARM_MSG_QUIT) {
+                return config->report && send_report(config, sock) < 0 ? 1 : 0;
+            }
+            if (msg.type == FARM_MSG_RANGE) {
+                next = msg.index;
+                end = msg.index + msg.count;
+            } else if (msg.type == FARM_MSG_RELEASE &&
+                       msg.buffer >= 0 && msg.buffer < num_buffers) {
+                busy[msg.buffer] = 0;
+            }
+            idle = 0;
+        }
+        if (ret == 0) return 0;   /* Coordinator went away */
+        if (idle) return 1;
+    }
+}
+
+static void stop_workers(FarmWorker *workers, int count, int sig) {
+    for (int i = 0; i < count; i++) {
+        if (workers[i].pid > 0) {
+            if (sig) kill(workers[i].pid, sig);
+            waitpid(workers[i].pid, NULL, 0);
+            workers[i].pid = 0;
+        }
+    }
+}
+
+/* Hand the next range to a worker that has received all of its current one */
+static int assign_range(const FarmConfig *config, FarmWorker *w, int *next_range, FarmStats *stats) {
+    if (*next_range >= config->frames) {
+        w->done = 1;
+        return 0;
+    }
+
+    int count = config->range;
+    if (count > config->frames - *next_range) count = config->frames - *next_range;
+
+    FarmMsg msg = { FARM_MSG_RANGE, *next_range, count, 0 };
+    if (send_msg(w->sock, &msg, -1) < 0) return -1;
+
+    w->range_end = *next_range + count;
+    w->received = 0;
+    w->range_count = count;
+    *next_range += count;
+    stats->ranges++;
+    return 0;
+}
+
+int frame_farm_run(const FarmConfig *config, FarmStats *stats) {
+    size_t size = (size_t)config->width * config->height * 4;
+    uint64_t fit = FARM_MEMORY_BUDGET / ((uint64_t)size * config->workers);
+    int num_buffers = config->range + FARM_SPARE_BUFFERS;
+    if (fit < (uint64_t)num_buffers) num_buffers = fit > FARM_MIN_BUFFERS ? (int)fit : FARM_MIN_BUFFERS;
+    FarmStats local = { 0 };
+    int status = -1;
+
+    FarmWorker *workers = calloc(config->workers, sizeof(FarmWorker));
+    struct pollfd *pfds = calloc(config->workers, sizeof(struct pollfd));
+    if (!workers || !pfds) goto out;
+
+    /* Workers must not flush stdio buffers they inherit */
+    fflush(NULL);
+
+    int started = 0;
+    for (; started < config->workers; started++) {
+        FarmWorker *w = &workers[started];
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+            perror("socketpair");
+            goto fail;
+        }
+
+        w->pid = fork();
+        if (w->pid < 0) {
+            perror("fork");
+            close(sv[0]);
+            close(sv[1]);
+            goto fail;
+        }
+        if (w->pid == 0) {
+            close(sv[0]);
+            for (int i = 0; i < started; i++) close(workers[i].sock);
+            _exit(worker_main(config, sv[1], num_buffers));
+        }
+        close(sv[1]);
+
+        w->sock = sv[0];
+        w->buffers = calloc(num_buffers, sizeof(uint32_t *));
+        w->pending = malloc(num_buffers * sizeof(int));
+        if (!w->buffers || !w->pending) {
+            started++;
+            goto fail;
+        }
+        for (int i = 0; i < num_buffers; i++) w->pending[i] = -1;
+    }
+
+    int next_range = 0;
+    for (int i = 0; i < config->workers; i++) {
+        if (assign_range(config, &workers[i], &next_range, &local) < 0) goto fail;
+    }
+
+    int next_out = 0;
+    while (next_out < config->frames) {
+        /* Emit every frame that is ready in order before waiting again */
+        int progressed = 1;
+        while (progressed && next_out < config->frames) {
+            progressed = 0;
+            for (int i = 0; i < config->workers && !progressed; i++) {
+                FarmWorker *w = &workers[i];
+                for (int b = 0; b < num_buffers; b++) {
+                    if (w->pending[b] != next_out) continue;
+
+                    if (config->emit(config->ctx, w->buffers[b], next_out) != 0) goto fail;
+                    w->pending[b] = -1;
+
+                    FarmMsg release = { FARM_MSG_RELEASE, 0, 0, b };
+                    if (!w->done && send_msg(w->sock, &release, -1) < 0) goto fail;
+                    next_out++;
+                    local.frames++;
+                    progressed = 1;
+                    break;
+                }
+            }
+        }
+        if (next_out >= config->frames) break;
+
+        for (int i = 0; i < config->workers; i++) {
+            pfds[i].fd = workers[i].sock;
+            pfds[i].events = POLLIN;
+        }
+        uint64_t wait_start = monotonic_ns();
+        if (poll(pfds, config->workers, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            goto fail;
+        }
+        local.wait_ns += monotonic_ns() - wait_start;
+
+        for (int i = 0; i < config->workers; i++) {
+            if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+            FarmWorker *w = &workers[i];
+            FarmMsg msg;
+            int fd = -1;
+            int ret = recv_msg(w->sock, &msg, &fd, MSG_DONTWAIT);
+            if (ret < 0 && errno == EAGAIN) continue;
+            if (ret <= 0 || msg.type != FARM_MSG_FRAME ||
+                msg.buffer < 0 || msg.buffer >= num_buffers) {
+                fprintf(stderr, "frame farm: worker %d failed\n", i);
+                if (fd >= 0) close(fd);
+                goto fail;
+            }
+
+            if (fd >= 0) {
+                void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+                close(fd);
+                if (map == MAP_FAILED) {
+                    perror("frame farm: mmap");
+                    goto fail;
+                }
+                w->buffers[msg.buffer] = map;
+            }
+            if (!w->buffers[msg.buffer]) {
+                fprintf(stderr, "frame farm: worker %d sent an unshared buffer\n", i);
+                goto fail;
+            }
+            w->pending[msg.buffer] = msg.index;
+
+            if (++w->received == w->range_count &&
+                assign_range(config, w, &next_range, &local) < 0) {
+                goto fail;
+            }
+        }
+    }
+
+    for (int i = 0; i < config->workers; i++) {
+        FarmMsg quit = { FARM_MSG_QUIT, 0, 0, 0 };
+        if (send_msg(workers[i].sock, &quit, -1) == 0 && config->merge) {
+            merge_report(config, workers[i].sock);
+        }
+    }
+    stop_workers(workers, started, 0);
+    status = 0;
+    goto cleanup;
+
+fail:
+    stop_workers(workers, started, SIGTERM);
+
+cleanup:
+    for (int i = 0; i < started; i++) {
+        FarmWorker *w = &workers[i];
+        if (w->buffers) {
+            for (int b = 0; b < num_buffers; b++) {
+                if (w->buffers[b]) munmap(w->buffers[b], size);
+            }
+        }
+        free(w->buffers);
+        free(w->pending);
+        close(w->sock);
+    }
+
+out:
+    free(workers);
+    free(pfds);
+    if (stats) *stats = local;
+    return status;
+}
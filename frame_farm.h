@@ -0,0 +1,46 @@
+/**
+ * Frame Farm - render an export across worker processes
+ * The coordinator forks workers connected by Unix seqpacket sockets and
+ * hands out contiguous frame ranges. Workers render into memfd buffers
+ * they own, share each buffer once with SCM_RIGHTS and from then on send
+ * only a buffer id per frame; the coordinator reads frames in place, emits
+ * them in index order and hands the buffer back. All workers' buffers
+ * together stay within FARM_MEMORY_BUDGET bytes where they can.
+ */
+
+#ifndef FRAME_FARM_H
+#define FRAME_FARM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FARM_MEMORY_BUDGET (1ull << 30)
+
+typedef struct {
+    int workers;              /* Worker processes to fork */
+    int frames;               /* Frames 0 .. frames-1 */
+    int range;                /* Frames per work unit */
+    int width, height;
+
+    /* Worker side, in the forked child: draw frame `index` into pixels */
+    void (*render)(void *ctx, uint32_t *pixels, int index);
+    /* Coordinator side, strictly in index order; non-zero aborts the run */
+    int (*emit)(void *ctx, const uint32_t *pixels, int index);
+
+    /* Optional: report_size bytes each worker fills once it is done, and the coordinator adds up */
+    size_t report_size;
+    void (*report)(void *ctx, void *out);
+    void (*merge)(void *ctx, const void *report);
+    void *ctx;
+} FarmConfig;
+
+typedef struct {
+    uint32_t frames;          /* Frames emitted */
+    uint32_t ranges;          /* Work units handed out */
+    uint64_t wait_ns;         /* Coordinator time blocked in poll */
+} FarmStats;
+
+/* Fork the workers and run the job to completion; 0 once every frame was emitted */
+int frame_farm_run(const FarmConfig *config, FarmStats *stats);
+
+#endif /* FRAME_FARM_H */
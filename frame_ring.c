@@ -0,0 +1,220 @@
+/**
+ * Frame Ring - publish finished frames to other local processes
+ * See frame_ring.h for the layout and the reader protocol.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "frame_ring.h"
+
+struct FrameRing {
+    int memfd;
+    int listen_fd;
+    char *socket_path;
+    uint8_t *map;
+    size_t map_size;
+    FrameRingHeader *header;
+    uint64_t next_seq;         /* Sequence of the frame being written */
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static size_t page_align(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (size + page - 1) & ~(page - 1);
+}
+
+static int listen_unix(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "frame ring: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("frame ring: socket");
+        return -1;
+    }
+
+    /* A socket left behind by a crashed run would make bind fail; anything else stays */
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "frame ring: %s exists and is not a socket\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    /* Frames are for this user only; nobody can connect before listen */
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    if (chmod(path, 0600) < 0 || listen(fd, 8) < 0) {
+        perror(path);
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+FrameRing *frame_ring_create(const char *socket_path, int width, int height, int slots) {
+    if (slots < 2) slots = 2;
+    if (slots > FRAME_RING_MAX_SLOTS) slots = FRAME_RING_MAX_SLOTS;
+
+    FrameRing *ring = calloc(1, sizeof(*ring));
+    if (!ring) return NULL;
+    ring->memfd = -1;
+    ring->listen_fd = -1;
+    ring->next_seq = 1;
+
+    size_t header_size = page_align(sizeof(FrameRingHeader));
+    size_t slot_size = page_align((size_t)width * height * 4);
+    ring->map_size = header_size + slot_size * slots;
+
+    ring->memfd = memfd_create("christmas-tree-frames", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ring->memfd < 0 || ftruncate(ring->memfd, ring->map_size) < 0) {
+        perror("frame ring: memfd");
+        goto fail;
+    }
+
+    /* Consumers map the whole ring; a fixed size means no SIGBUS surprises */
+    if (fcntl(ring->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0) {
+        perror("frame ring: seal");
+        goto fail;
+    }
+
+    ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        perror("frame ring: mmap");
+        goto fail;
+    }
+
+    /* Our mapping stays writable; every mapping made from the fd we hand out can only read */
+    if (fcntl(ring->memfd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0) {
+        perror("frame ring: seal");
+        goto fail;
+    }
+
+    FrameRingHeader *h = ring->header = (FrameRingHeader *)ring->map;
+    h->width = width;
+    h->height = height;
+    h->stride = width * 4;
+    h->format = FRAME_RING_FORMAT_XRGB8888;
+    h->slot_count = slots;
+    h->slot_offset = header_size;
+    h->slot_size = slot_size;
+    h->version = FRAME_RING_VERSION;
+    __atomic_store_n(&h->magic, FRAME_RING_MAGIC, __ATOMIC_RELEASE);
+
+    ring->socket_path = strdup(socket_path);
+    ring->listen_fd = listen_unix(socket_path);
+    if (!ring->socket_path || ring->listen_fd < 0) goto fail;
+
+    return ring;
+
+fail:
+    if (ring->map) munmap(ring->map, ring->map_size);
+    if (ring->memfd >= 0) close(ring->memfd);
+    free(ring->socket_path);
+    free(ring);
+    return NULL;
+}
+
+int frame_ring_listen_fd(const FrameRing *ring) {
+    return ring->listen_fd;
+}
+
+void frame_ring_accept(FrameRing *ring) {
+    for (;;) {
+        int fd = accept4(ring->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("frame ring: accept");
+            return;
+        }
+
+        /* One byte of payload carries the memfd; then the consumer is on its own */
+        char byte = 0;
+        struct iovec iov = { &byte, 1 };
+        union {
+            char buf[CMSG_SPACE(sizeof(int))];
+            struct cmsghdr align;
+        } control;
+        memset(&control, 0, sizeof(control));
+        struct msghdr msg = {
+            .msg_iov = &iov, .msg_iovlen = 1,
+            .msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+        };
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &ring->memfd, sizeof(int));
+
+        if (sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+            perror("frame ring: sendmsg");
+        }
+        close(fd);
+    }
+}
+
+static FrameRingSlot *current_slot(FrameRing *ring, uint32_t **pixels) {
+    FrameRingHeader *h = ring->header;
+    uint32_t index = ring->next_seq % h->slot_count;
+    if (pixels) *pixels = (uint32_t *)(ring->map + h->slot_offset + index * h->slot_size);
+    return &h->slots[index];
+}
+
+uint32_t *frame_ring_begin(FrameRing *ring) {
+    uint32_t *pixels;
+    FrameRingSlot *slot = current_slot(ring, &pixels);
+
+    /* Odd marks the slot torn for anyone still reading the frame it held */
+    __atomic_store_n(&slot->seq, ring->next_seq * 2 - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return pixels;
+}
+
+void frame_ring_publish(FrameRing *ring, uint64_t frame, uint64_t render_ns) {
+    FrameRingSlot *slot = current_slot(ring, NULL);
+
+    slot->frame = frame;
+    slot->render_ns = render_ns;
+    slot->publish_ns = monotonic_ns();
+    __atomic_store_n(&slot->seq, ring->next_seq * 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->header->latest, ring->next_seq, __ATOMIC_RELEASE);
+    ring->next_seq++;
+}
+
+void frame_ring_destroy(FrameRing *ring) {
+    if (!ring) return;
+    close(ring->listen_fd);
+    unlink(ring->socket_path);
+    munmap(ring->map, ring->map_size);
+    close(ring->memfd);
+    free(ring->socket_path);
+    free(ring);
+}
@@ -0,0 +1,68 @@
+/**
+ * Frame Ring - publish finished frames to other local processes
+ * The ring is a single memfd holding a header followed by a few frame
+ * slots. It is sealed against resizing and against any writable mapping
+ * but the publisher's own. Each slot is guarded by a sequence count (odd
+ * while being written), and the header names the newest complete frame,
+ * so readers never take a lock and never hold up the renderer. Consumers
+ * get the memfd by connecting to the publisher's Unix socket, which only
+ * its own user can reach.
+ *
+ * Reading the latest frame:
+ *   seq = header->latest;  slot = &header->slots[seq % slot_count];
+ *   check slot->seq == seq * 2, read pixels in place, then check slot->seq
+ *   again; if it changed the publisher lapped the reader and the frame is torn.
+ */
+
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <stdint.h>
+
+#define FRAME_RING_MAGIC 0x474e5246u   /* "FRNG" */
+#define FRAME_RING_VERSION 1
+#define FRAME_RING_MAX_SLOTS 8
+#define FRAME_RING_FORMAT_XRGB8888 0   /* Same byte order as WL_SHM_FORMAT_XRGB8888 */
+
+typedef struct {
+    uint64_t seq;              /* 2 * frame sequence when complete, odd while writing */
+    uint64_t frame;            /* Animation tick shown */
+    uint64_t publish_ns;       /* CLOCK_MONOTONIC when the slot became readable */
+    uint64_t render_ns;        /* Time spent rendering it */
+} FrameRingSlot;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t stride;           /* Bytes per row */
+    uint32_t format;
+    uint32_t slot_count;
+    uint32_t reserved;
+    uint64_t slot_offset;      /* Offset of slot 0 pixels from the start of the memfd */
+    uint64_t slot_size;        /* Bytes between consecutive slots, page aligned */
+    uint64_t latest;           /* Sequence of the newest complete frame, 0 if none yet */
+    FrameRingSlot slots[FRAME_RING_MAX_SLOTS];
+} FrameRingHeader;
+
+typedef struct FrameRing FrameRing;
+
+/* Create the ring and listen for consumers on socket_path; NULL on error */
+FrameRing *frame_ring_create(const char *socket_path, int width, int height, int slots);
+
+/* Listening socket to poll for POLLIN; call frame_ring_accept() when ready */
+int frame_ring_listen_fd(const FrameRing *ring);
+
+/* Send the memfd to every pending consumer connection */
+void frame_ring_accept(FrameRing *ring);
+
+/* Slot for the next frame; readers see it as in progress until publish */
+uint32_t *frame_ring_begin(FrameRing *ring);
+
+/* Make the slot from frame_ring_begin() the latest frame */
+void frame_ring_publish(FrameRing *ring, uint64_t frame, uint64_t render_ns);
+
+/* Stop listening, remove the socket and unmap; consumers keep their mapping */
+void frame_ring_destroy(FrameRing *ring);
+
+#endif /* FRAME_RING_H */
@@ -0,0 +1,332 @@
+/**
+ * Light Grid - tiled diffuse lighting from many small point lights
+ * See light_grid.h. A light's weight at squared distance d2 is
+ * (1 - d2 / r2)^2 in 0.8 fixed point, which with radii up to
+ * LIGHT_GRID_MAX_RADIUS keeps every step in unsigned 16-bit lanes: eight
+ * pixels per SSE2 register. Each tile sums light per channel in 8.8
+ * fixed point, saturating, in the order the lights were added, so the
+ * scalar path gives the same result bit for bit.
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "light_grid.h"
+#include "lut.h"
+#include "row_pool.h"
+
+#define TILE_SIZE 32               /* Pixels; a multiple of GROUP */
+#define GROUP 8                    /* Pixels per SSE2 register */
+
+typedef struct {
+    int x, y;
+    int x0, y0, x1, y1;            /* Pixels it reaches, clipped to the target; [x0, x1) */
+    uint16_t r2;                   /* Radius squared */
+    uint16_t shift, inv;           /* ((r2 - d2) << shift) * inv >> 16 is 0 .. 255 */
+    uint16_t rgb[3];
+} Light;
+
+struct LightGrid {
+    int width, height;
+    int linear;                    /* Multiply in linear light */
+    int tiles_x, tiles_y;
+    Light *lights;
+    int num_lights, capacity;
+    int *bin_start;                /* Per tile into bins, plus one past the last */
+    int *bin_fill;
+    int *bins;                     /* Light indices by tile, in the order added */
+    int bins_capacity;
+    uint32_t *target;
+    const LightSpan *rows;
+    uint8_t *counts;
+    uint64_t changed;
+};
+
+LightGrid *light_grid_create(int width, int height, int linear) {
+    LightGrid *grid = calloc(1, sizeof(LightGrid));
+    if (!grid) return NULL;
+
+    grid->width = width;
+    grid->height = height;
+    grid->linear = linear;
+    grid->tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    grid->tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    size_t tiles = (size_t)grid->tiles_x * grid->tiles_y;
+    grid->bin_start = calloc(tiles + 1, sizeof(int));
+    grid->bin_fill = malloc(tiles * sizeof(int));
+    if (!grid->bin_start || !grid->bin_fill) {
+        light_grid_destroy(grid);
+        return NULL;
+    }
+    return grid;
+}
+
+void light_grid_clear(LightGrid *grid) {
+    grid->num_lights = 0;
+}
+
+int light_grid_add(LightGrid *grid, int x, int y, int radius, uint32_t color) {
+    if (radius < 1) radius = 1;
+    if (radius > LIGHT_GRID_MAX_RADIUS) radius = LIGHT_GRID_MAX_RADIUS;
+    if (!(color & 0xFFFFFF)) return 1;
+
+    /* Only pixels closer than radius get any light */
+    int x0 = x - radius + 1 < 0 ? 0 : x - radius + 1;
+    int x1 = x + radius > grid->width ? grid->width : x + radius;
+    int y0 = y - radius + 1 < 0 ? 0 : y - radius + 1;
+    int y1 = y + radius > grid->height ? grid->height : y + radius;
+    if (x0 >= x1 || y0 >= y1) return 1;
+
+    if (grid->num_lights == grid->capacity) {
+        int capacity = grid->capacity ? grid->capacity * 2 : 64;
+        Light *grown = realloc(grid->lights, (size_t)capacity * sizeof(Light));
+        if (!grown) return 0;
+        grid->lights = grown;
+        grid->capacity = capacity;
+    }
+
+    Light *l = &grid->lights[grid->num_lights++];
+    l->x = x;
+    l->y = y;
+    l->x0 = x0;
+    l->y0 = y0;
+    l->x1 = x1;
+    l->y1 = y1;
+    l->r2 = (uint16_t)(radius * radius);
+
+    /* Scale r2 - d2 up to use all 16 bits before multiplying it into 0 .. 255 */
+    l->shift = 0;
+    while (((uint32_t)l->r2 << (l->shift + 1)) <= 0xFFFF) l->shift++;
+    l->inv = (uint16_t)((255u << 16) / ((uint32_t)l->r2 << l->shift));
+
+    l->rgb[0] = (color >> 16) & 0xFF;
+    l->rgb[1] = (color >> 8) & 0xFF;
+    l->rgb[2] = color & 0xFF;
+    return 1;
+}
+
+/* The light's 0.8 weight at squared distance d2, as the 16-bit lanes compute it */
+static inline uint32_t light_weight(const Light *l, uint32_t d2) {
+    if (d2 >= l->r2) return 0;
+    uint32_t f = (((uint32_t)l->r2 - d2) << l->shift) * l->inv >> 16;
+    return f * f >> 8;
+}
+
+static inline uint16_t add_saturate16(uint16_t a, uint32_t b) {
+    return a + b > 0xFFFF ? 0xFFFF : (uint16_t)(a + b);
+}
+
+/* Add light l into the tile's sums for columns [x0, x1) of row y */
+static void accumulate_row(const Light *l, int tx, int y, int x0, int x1, uint16_t *sum[3]) {
+    int dy = y - l->y;
+    uint32_t dy2 = (uint32_t)(dy * dy);
+
+#ifdef __SSE2__
+    /* Whole groups; the extra columns are outside the span and never shaded */
+    int g0 = (x0 - tx) & ~(GROUP - 1), g1 = (x1 - tx + GROUP - 1) & ~(GROUP - 1);
+    __m128i dx = _mm_add_epi16(_mm_set1_epi16((short)(tx + g0 - l->x)),
+                               _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m128i step = _mm_set1_epi16(GROUP);
+    const __m128i r2 = _mm_set1_epi16((short)l->r2);
+    const __m128i dy2v = _mm_set1_epi16((short)dy2);
+    const __m128i shift = _mm_cvtsi32_si128(l->shift);
+    const __m128i inv = _mm_set1_epi16((short)l->inv);
+    __m128i rgb[3];
+    for (int k = 0; k < 3; k++) {
+        rgb[k] = _mm_set1_epi16((short)l->rgb[k]);
+    }
+
+    for (int g = g0; g < g1; g += GROUP) {
+        /* |dx| stays below 256, so dx * dx fits unsigned */
+        __m128i d2 = _mm_adds_epu16(_mm_mullo_epi16(dx, dx), dy2v);
+        __m128i f = _mm_mulhi_epu16(_mm_sll_epi16(_mm_subs_epu16(r2, d2), shift), inv);
+        f = _mm_srli_epi16(_mm_mullo_epi16(f, f), 8);
+
+        for (int k = 0; k < 3; k++) {
+            __m128i *s = (__m128i *)(sum[k] + g);
+            __m128i v = _mm_srli_epi16(_mm_mullo_epi16(f, rgb[k]), 8);
+            _mm_store_si128(s, _mm_adds_epu16(_mm_load_si128(s), v));
+        }
+        dx = _mm_add_epi16(dx, step);
+    }
+#else
+    for (int x = x0; x < x1; x++) {
+        int dx = x - l->x;
+        uint32_t d2 = (uint32_t)(dx * dx) + dy2;
+        uint32_t f = light_weight(l, d2 > 0xFFFF ? 0xFFFF : d2);
+        if (!f) continue;
+
+        for (int k = 0; k < 3; k++) {
+            sum[k][x - tx] = add_saturate16(sum[k][x - tx], f * l->rgb[k] >> 8);
+        }
+    }
+#endif
+}
+
+/* Multiply the sums into row y's pixels [x0, x1); returns how many got any light */
+static uint64_t shade_row(LightGrid *grid, int tx, int y, int x0, int x1, uint16_t *sum[3]) {
+    uint32_t *row = grid->target + (size_t)y * grid->width;
+    uint64_t changed = 0;
+
+    for (int x = x0; x < x1; x++) {
+        uint32_t r = sum[0][x - tx], g = sum[1][x - tx], b = sum[2][x - tx];
+        if (!(r | g | b)) continue;
+
+        uint32_t p = row[x];
+        if (grid->linear) {
+            /* 12-bit light times 8.8 sums stays inside 32 bits; linear_to_srgb saturates */
+            uint32_t lr = srgb_to_linear(p >> 16), lg = srgb_to_linear(p >> 8), lb = srgb_to_linear(p);
+            row[x] = (p & 0xFF000000u) | linear_to_srgb(lr + (lr * r >> 8)) << 16 |
+                     linear_to_srgb(lg + (lg * g >> 8)) << 8 | linear_to_srgb(lb + (lb * b >> 8));
+        } else {
+            uint32_t pr = (p >> 16) & 0xFF, pg = (p >> 8) & 0xFF, pb = p & 0xFF;
+            pr += pr * r >> 8;
+            pg += pg * g >> 8;
+            pb += pb * b >> 8;
+            row[x] = (p & 0xFF000000u) | (pr > 0xFF ? 0xFF : pr) << 16 |
+                     (pg > 0xFF ? 0xFF : pg) << 8 | (pb > 0xFF ? 0xFF : pb);
+        }
+
+        size_t index = (size_t)y * grid->width + x;
+        if (grid->counts && grid->counts[index] < UINT8_MAX) grid->counts[index]++;
+        changed++;
+    }
+    return changed;
+}
+
+/* Largest dx with dx * dx < room; -1 if none */
+static inline int chord(int room) {
+    if (room <= 0) return -1;
+    int dx = (int)sqrtf((float)room);
+    while (dx * dx >= room) dx--;
+    while ((dx + 1) * (dx + 1) < room) dx++;
+    return dx;
+}
+
+/* The part of rows[y] inside [x0, x1); 0 if none */
+static inline int clip_span(const LightGrid *grid, int y, int x0, int x1, int *out0, int *out1) {
+    *out0 = grid->rows[y].x0 > x0 ? grid->rows[y].x0 : x0;
+    *out1 = grid->rows[y].x1 < x1 ? grid->rows[y].x1 : x1;
+    return *out0 < *out1;
+}
+
+/* Row pool task: light tile rows begin .. end-1 */
+static void shade_task(int begin, int end, void *ctx) {
+    LightGrid *grid = ctx;
+    uint16_t sums[3][TILE_SIZE * TILE_SIZE] __attribute__((aligned(16)));
+    uint64_t changed = 0;
+
+    for (int tile_y = begin; tile_y < end; tile_y++) {
+        int ty = tile_y * TILE_SIZE;
+        int ty_end = ty + TILE_SIZE > grid->height ? grid->height : ty + TILE_SIZE;
+
+        for (int tile_x = 0; tile_x < grid->tiles_x; tile_x++) {
+            int tile = tile_y * grid->tiles_x + tile_x;
+            int first = grid->bin_start[tile], last = grid->bin_start[tile + 1];
+            int tx = tile_x * TILE_SIZE;
+            int tx_end = tx + TILE_SIZE > grid->width ? grid->width : tx + TILE_SIZE;
+            int lit = 0;
+            if (first == last) continue;
+
+            /* Start from no light in the rows that take any */
+            for (int y = ty; y < ty_end; y++) {
+                int x0, x1;
+                if (!clip_span(grid, y, tx, tx_end, &x0, &x1)) continue;
+                for (int k = 0; k < 3; k++) {
+                    memset(sums[k] + (y - ty) * TILE_SIZE, 0, TILE_SIZE * sizeof(uint16_t));
+                }
+                lit = 1;
+            }
+            if (!lit) continue;
+
+            for (int i = first; i < last; i++) {
+                const Light *l = &grid->lights[grid->bins[i]];
+                int y0 = l->y0 > ty ? l->y0 : ty;
+                int y1 = l->y1 < ty_end ? l->y1 : ty_end;
+                int lx0 = l->x0 > tx ? l->x0 : tx;
+                int lx1 = l->x1 < tx_end ? l->x1 : tx_end;
+
+                for (int y = y0; y < y1; y++) {
+                    /* Only the chord of the circle through this row */
+                    int dy = y - l->y;
+                    int half = chord(l->r2 - dy * dy);
+                    int cx0 = l->x - half > lx0 ? l->x - half : lx0;
+                    int cx1 = l->x + half + 1 < lx1 ? l->x + half + 1 : lx1;
+                    int x0, x1;
+                    if (!clip_span(grid, y, cx0, cx1, &x0, &x1)) continue;
+                    uint16_t *sum[3] = { sums[0] + (y - ty) * TILE_SIZE, sums[1] + (y - ty) * TILE_SIZE,
+                                         sums[2] + (y - ty) * TILE_SIZE };
+                    accumulate_row(l, tx, y, x0, x1, sum);
+                }
+            }
+
+            for (int y = ty; y < ty_end; y++) {
+                int x0, x1;
+                if (!clip_span(grid, y, tx, tx_end, &x0, &x1)) continue;
+                uint16_t *sum[3] = { sums[0] + (y - ty) * TILE_SIZE, sums[1] + (y - ty) * TILE_SIZE,
+                                     sums[2] + (y - ty) * TILE_SIZE };
+                changed += shade_row(grid, tx, y, x0, x1, sum);
+            }
+        }
+    }
+
+    __atomic_add_fetch(&grid->changed, changed, __ATOMIC_RELAXED);
+}
+
+uint64_t light_grid_apply(LightGrid *grid, uint32_t *target, const LightSpan *rows, uint8_t *counts) {
+    if (grid->num_lights == 0) return 0;
+
+    /* Count each light into the tiles it reaches, then list them there in order */
+    int tiles = grid->tiles_x * grid->tiles_y;
+    memset(grid->bin_start, 0, (size_t)(tiles + 1) * sizeof(int));
+    for (int i = 0; i < grid->num_lights; i++) {
+        const Light *l = &grid->lights[i];
+        for (int ty = l->y0 / TILE_SIZE; ty <= (l->y1 - 1) / TILE_SIZE; ty++) {
+            for (int tx = l->x0 / TILE_SIZE; tx <= (l->x1 - 1) / TILE_SIZE; tx++) {
+                grid->bin_start[ty * grid->tiles_x + tx + 1]++;
+            }
+        }
+    }
+    for (int tile = 0; tile < tiles; tile++) {
+        grid->bin_start[tile + 1] += grid->bin_start[tile];
+        grid->bin_fill[tile] = grid->bin_start[tile];
+    }
+
+    int total = grid->bin_start[tiles];
+    if (total > grid->bins_capacity) {
+        int *grown = realloc(grid->bins, (size_t)total * sizeof(int));
+        if (!grown) return 0;
+        grid->bins = grown;
+        grid->bins_capacity = total;
+    }
+    for (int i = 0; i < grid->num_lights; i++) {
+        const Light *l = &grid->lights[i];
+        for (int ty = l->y0 / TILE_SIZE; ty <= (l->y1 - 1) / TILE_SIZE; ty++) {
+            for (int tx = l->x0 / TILE_SIZE; tx <= (l->x1 - 1) / TILE_SIZE; tx++) {
+                grid->bins[grid->bin_fill[ty * grid->tiles_x + tx]++] = i;
+            }
+        }
+    }
+
+    grid->target = target;
+    grid->rows = rows;
+    grid->counts = counts;
+    grid->changed = 0;
+    row_pool_run(grid->tiles_y, shade_task, grid);
+    return grid->changed;
+}
+
+void light_grid_destroy(LightGrid *grid) {
+    if (!grid) return;
+    free(grid->lights);
+    free(grid->bin_start);
+    free(grid->bin_fill);
+    free(grid->bins);
+    free(grid);
+}
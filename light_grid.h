@@ -0,0 +1,50 @@
+/**
+ * Light Grid - tiled diffuse lighting from many small point lights
+ * Lights are binned into the square tiles of the target their radius
+ * reaches. Each tile then sums, with fixed-point math, the light falling
+ * on each of its pixels from just the lights in its bin, and multiplies
+ * it into the pixels the caller marked as taking light. Rows of tiles are
+ * spread over the row pool, with SSE2 where available. The multiply is
+ * on sRGB values, or in linear light.
+ */
+
+#ifndef LIGHT_GRID_H
+#define LIGHT_GRID_H
+
+#include <stdint.h>
+
+#define LIGHT_GRID_MAX_RADIUS 170      /* Pixels; larger radii are clamped */
+
+typedef struct LightGrid LightGrid;
+
+/* Pixels [x0, x1) of a row take light; empty when x0 >= x1 */
+typedef struct {
+    int x0, x1;
+} LightSpan;
+
+/*
+ * Lighting for a width x height target. When linear is set, the target is
+ * taken as sRGB and lit in linear light; lut_init must have run.
+ */
+LightGrid *light_grid_create(int width, int height, int linear);
+
+/* Start a frame: forget every light */
+void light_grid_clear(LightGrid *grid);
+
+/*
+ * Add a light at (x, y) in target pixels that falls off smoothly to
+ * nothing at radius. Each channel of the RGB color is what it adds at the
+ * centre: 255 doubles a pixel there. Lights add up. 0 when out of memory.
+ */
+int light_grid_add(LightGrid *grid, int x, int y, int radius, uint32_t color);
+
+/*
+ * Light rows[y] of every target row y (saturating). Returns the target
+ * pixels that changed; when counts is given, each one is also incremented
+ * there.
+ */
+uint64_t light_grid_apply(LightGrid *grid, uint32_t *target, const LightSpan *rows, uint8_t *counts);
+
+void light_grid_destroy(LightGrid *grid);
+
+#endif /* LIGHT_GRID_H */
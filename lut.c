@@ -0,0 +1,43 @@
+/**
+ * LUT - fixed-point sine and power tables for animation and shading
+ * See lut.h. Table entries sit at the start of each phase bucket, so a
+ * lookup truncates the phase rather than rounding it. The colour tables
+ * round to nearest, which makes sRGB -> linear -> sRGB give back every
+ * channel value unchanged.
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+
+#include "lut.h"
+
+int16_t sine_lut[SINE_LUT_SIZE];
+uint16_t srgb_linear_lut[256];
+uint8_t linear_srgb_lut[LINEAR_MAX + 1];
+
+/* The sRGB transfer curve, both ways, on [0, 1] */
+static double srgb_decode(double c) {
+    return c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+}
+
+static double srgb_encode(double l) {
+    return l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1 / 2.4) - 0.055;
+}
+
+void lut_init(void) {
+    for (int i = 0; i < SINE_LUT_SIZE; i++) {
+        sine_lut[i] = (int16_t)lrint(sin(2 * M_PI * i / SINE_LUT_SIZE) * 32767);
+    }
+    for (int i = 0; i < 256; i++) {
+        srgb_linear_lut[i] = (uint16_t)lrint(srgb_decode(i / 255.0) * LINEAR_MAX);
+    }
+    for (int i = 0; i <= LINEAR_MAX; i++) {
+        linear_srgb_lut[i] = (uint8_t)lrint(srgb_encode((double)i / LINEAR_MAX) * 255);
+    }
+}
+
+void pow_lut_init(PowLut *lut, float exponent) {
+    for (int i = 0; i <= POW_LUT_SIZE; i++) {
+        lut->table[i] = powf((float)i / POW_LUT_SIZE, exponent);
+    }
+}
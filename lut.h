@@ -0,0 +1,76 @@
+/**
+ * LUT - fixed-point sine and power tables for animation and shading
+ * Phases are unsigned 32-bit fractions of a turn: they advance by integer
+ * steps, wrap for free and never lose precision however long the
+ * animation runs. Sine comes from a Q15 table indexed by the top bits of
+ * the phase. Power tables hold x^e on [0, 1] for exponents fixed at
+ * startup and interpolate between entries. Colour tables convert 8-bit
+ * sRGB channels to 12-bit linear light and back, for blending that
+ * doesn't darken where colours mix.
+ */
+
+#ifndef LUT_H
+#define LUT_H
+
+#include <stdint.h>
+
+#define SINE_LUT_BITS 12
+#define SINE_LUT_SIZE (1 << SINE_LUT_BITS)
+#define POW_LUT_SIZE 1024
+#define LINEAR_BITS 12
+#define LINEAR_MAX ((1 << LINEAR_BITS) - 1)
+
+/* 2^32 is one full turn */
+typedef uint32_t Phase;
+
+#define PHASE_PER_RADIAN 683565275.57643158   /* 2^32 / 2pi */
+#define RADIANS_TO_PHASE(r) ((Phase)(int64_t)((r) * PHASE_PER_RADIAN))
+
+extern int16_t sine_lut[SINE_LUT_SIZE];
+extern uint16_t srgb_linear_lut[256];
+extern uint8_t linear_srgb_lut[LINEAR_MAX + 1];
+
+typedef struct {
+    float table[POW_LUT_SIZE + 1];
+} PowLut;
+
+/* Fill the sine and colour tables; call once before any thread renders */
+void lut_init(void);
+
+/* Tabulate x^exponent for x in [0, 1] */
+void pow_lut_init(PowLut *lut, float exponent);
+
+static inline float lut_sin(Phase phase) {
+    return sine_lut[phase >> (32 - SINE_LUT_BITS)] * (1.0f / 32767);
+}
+
+static inline float lut_cos(Phase phase) {
+    return lut_sin(phase + 0x40000000u);
+}
+
+/* Sine of an angle in radians, for phases that aren't integer steps */
+static inline float lut_sinf(float radians) {
+    return lut_sin((Phase)(int64_t)(radians * (float)PHASE_PER_RADIAN));
+}
+
+/* x^exponent; x is clamped to [0, 1] */
+static inline float pow_lut(const PowLut *lut, float x) {
+    if (!(x > 0.0f)) return lut->table[0];
+    if (x >= 1.0f) return lut->table[POW_LUT_SIZE];
+
+    float f = x * POW_LUT_SIZE;
+    int i = (int)f;
+    return lut->table[i] + (lut->table[i + 1] - lut->table[i]) * (f - i);
+}
+
+/* 8-bit sRGB channel to linear light, 0 to LINEAR_MAX */
+static inline uint32_t srgb_to_linear(uint32_t c) {
+    return srgb_linear_lut[c & 0xFF];
+}
+
+/* Linear light back to an 8-bit sRGB channel; values past LINEAR_MAX saturate */
+static inline uint32_t linear_to_srgb(uint32_t l) {
+    return linear_srgb_lut[l < LINEAR_MAX ? l : LINEAR_MAX];
+}
+
+#endif /* LUT_H */
@@ -0,0 +1,634 @@
+/**
+ * Mesh - tile-binned software rasterizer for small lit meshes
+ * See mesh.h. Vertices snap to 1/16 pixel and edge functions are exact
+ * integers, with a tie rule that gives a pixel centre on an edge shared by
+ * two triangles to exactly one of them. Triangles reaching further than
+ * GUARD_BAND pixels past the target are dropped, which keeps an edge
+ * function that crosses a tile within 32 bits. Depth is q = 1/z, so the
+ * depth test and the perspective divide share one interpolated value.
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "mesh.h"
+#include "row_pool.h"
+
+#define TILE_SIZE 64               /* Pixels; a tile's colour and depth stay in L1 */
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL (1 << SUBPIXEL_BITS)
+#define GUARD_BAND 4096            /* Pixels */
+#define NEAR_Z 1.0f                /* Triangles with a vertex closer than this are dropped */
+
+/* Interpolated per vertex, all divided by z */
+enum { ATTR_Q, ATTR_R, ATTR_G, ATTR_B, NUM_ATTRS };
+
+struct Mesh {
+    int num_vertices;
+    int padded;                    /* Rounded up to a multiple of 4, zero filled */
+    float *x, *y, *z;
+    float *nx, *ny, *nz;
+    float *r, *g, *b;
+    int num_triangles;
+    int *triangles;
+};
+
+typedef struct {
+    int x0, y0, x1, y1;            /* Pixels it may cover, clipped to the target; [x0, x1) */
+    int32_t step_x[3], step_y[3];  /* Edge function change per pixel */
+    int64_t origin[3];             /* Edge functions at pixel (0, 0), tie rule included */
+    float ref_x, ref_y;            /* Pixel the planes are relative to */
+    float plane[NUM_ATTRS][3];     /* Value, d/dx, d/dy */
+} Triangle;
+
+struct MeshRaster {
+    int width, height;
+    int tiles_x, tiles_y;
+    int capacity;                  /* Vertices the buffers below hold */
+    float *sx, *sy;                /* Position on the target */
+    float *attr[NUM_ATTRS];
+    int triangle_capacity;
+    Triangle *triangles;           /* Set up this draw */
+    int *bin_start;                /* Per tile into bins, plus one past the last */
+    int *bin_fill;
+    int *bins;                     /* Triangle indices by tile, in mesh order */
+    int bins_capacity;
+    int num_busy;
+    int *busy;                     /* Tiles with triangles */
+    uint64_t *written;             /* Per busy tile */
+    int16_t (*extent)[TILE_SIZE][2];   /* Per tile and row, columns drawn: [x0, x1) in the tile */
+    uint32_t *target;
+    uint8_t *counts;
+};
+
+Mesh *mesh_create(const MeshVertex *vertices, int num_vertices, const int *triangles, int num_triangles) {
+    for (int i = 0; i < 3 * num_triangles; i++) {
+        if (triangles[i] < 0 || triangles[i] >= num_vertices) return NULL;
+    }
+
+    Mesh *mesh = calloc(1, sizeof(Mesh));
+    if (!mesh) return NULL;
+
+    mesh->num_vertices = num_vertices;
+    mesh->padded = (num_vertices + 3) & ~3;
+    mesh->num_triangles = num_triangles;
+    float *fields = calloc((size_t)mesh->padded * 9, sizeof(float));
+    mesh->triangles = malloc((size_t)num_triangles * 3 * sizeof(int));
+    if (!fields || !mesh->triangles) {
+        free(fields);
+        free(mesh->triangles);
+        free(mesh);
+        return NULL;
+    }
+
+    float **field[] = { &mesh->x, &mesh->y, &mesh->z, &mesh->nx, &mesh->ny, &mesh->nz,
+                        &mesh->r, &mesh->g, &mesh->b };
+    for (int k = 0; k < 9; k++) {
+        *field[k] = fields + (size_t)k * mesh->padded;
+    }
+
+    for (int i = 0; i < num_vertices; i++) {
+        const MeshVertex *v = &vertices[i];
+        mesh->x[i] = v->x;
+        mesh->y[i] = v->y;
+        mesh->z[i] = v->z;
+        mesh->nx[i] = v->nx;
+        mesh->ny[i] = v->ny;
+        mesh->nz[i] = v->nz;
+        mesh->r[i] = (v->color >> 16) & 0xFF;
+        mesh->g[i] = (v->color >> 8) & 0xFF;
+        mesh->b[i] = v->color & 0xFF;
+    }
+    memcpy(mesh->triangles, triangles, (size_t)num_triangles * 3 * sizeof(int));
+    return mesh;
+}
+
+void mesh_destroy(Mesh *mesh) {
+    if (!mesh) return;
+    free(mesh->x);
+    free(mesh->triangles);
+    free(mesh);
+}
+
+MeshRaster *mesh_raster_create(int width, int height) {
+    MeshRaster *raster = calloc(1, sizeof(MeshRaster));
+    if (!raster) return NULL;
+
+    raster->width = width;
+    raster->height = height;
+    raster->tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    raster->tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    size_t tiles = (size_t)raster->tiles_x * raster->tiles_y;
+    raster->bin_start = calloc(tiles + 1, sizeof(int));
+    raster->bin_fill = malloc(tiles * sizeof(int));
+    raster->busy = malloc(tiles * sizeof(int));
+    raster->written = malloc(tiles * sizeof(uint64_t));
+    raster->extent = malloc(tiles * sizeof(*raster->extent));
+    if (!raster->bin_start || !raster->bin_fill || !raster->busy || !raster->written || !raster->extent) {
+        mesh_raster_destroy(raster);
+        return NULL;
+    }
+    return raster;
+}
+
+void mesh_raster_destroy(MeshRaster *raster) {
+    if (!raster) return;
+    free(raster->sx);
+    free(raster->triangles);
+    free(raster->bin_start);
+    free(raster->bin_fill);
+    free(raster->bins);
+    free(raster->busy);
+    free(raster->written);
+    free(raster->extent);
+    free(raster);
+}
+
+/* Room for the mesh's vertices and triangles; 0 when out of memory */
+static int reserve(MeshRaster *raster, const Mesh *mesh) {
+    if (mesh->padded > raster->capacity) {
+        float *buffer = malloc((size_t)mesh->padded * (2 + NUM_ATTRS) * sizeof(float));
+        if (!buffer) return 0;
+        free(raster->sx);
+        raster->sx = buffer;
+        raster->sy = buffer + mesh->padded;
+        for (int k = 0; k < NUM_ATTRS; k++) {
+            raster->attr[k] = buffer + (size_t)(2 + k) * mesh->padded;
+        }
+        raster->capacity = mesh->padded;
+    }
+    if (mesh->num_triangles > raster->triangle_capacity) {
+        Triangle *grown = realloc(raster->triangles, (size_t)mesh->num_triangles * sizeof(Triangle));
+        if (!grown) return 0;
+        raster->triangles = grown;
+        raster->triangle_capacity = mesh->num_triangles;
+    }
+    return 1;
+}
+
+#ifdef __SSE2__
+static inline __m128 dot3(const __m128 m[3], __m128 x, __m128 y, __m128 z) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], x), _mm_mul_ps(m[1], y)), _mm_mul_ps(m[2], z));
+}
+#endif
+
+/*
+ * Project and light every vertex. The SSE2 and scalar paths do the same
+ * operations in the same order, so they give the same bits.
+ */
+static void transform_vertices(MeshRaster *raster, const Mesh *mesh, const MeshView *view) {
+    int i = 0;
+
+#ifdef __SSE2__
+    __m128 m[3][3], offset[3], light[3];
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            m[r][c] = _mm_set1_ps(view->rotation[r][c]);
+        }
+        offset[r] = _mm_set1_ps(view->offset[r]);
+        light[r] = _mm_set1_ps(view->light[r]);
+    }
+    const __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+    const __m128 focal = _mm_set1_ps(view->focal), ambient = _mm_set1_ps(view->ambient);
+    const __m128 center_x = _mm_set1_ps(view->center_x), center_y = _mm_set1_ps(view->center_y);
+
+    for (; i < mesh->padded; i += 4) {
+        __m128 x = _mm_loadu_ps(mesh->x + i), y = _mm_loadu_ps(mesh->y + i), z = _mm_loadu_ps(mesh->z + i);
+        __m128 vx = _mm_add_ps(dot3(m[0], x, y, z), offset[0]);
+        __m128 vy = _mm_add_ps(dot3(m[1], x, y, z), offset[1]);
+        __m128 vz = _mm_add_ps(dot3(m[2], x, y, z), offset[2]);
+        __m128 q = _mm_div_ps(one, vz);
+        _mm_storeu_ps(raster->sx + i, _mm_add_ps(center_x, _mm_mul_ps(_mm_mul_ps(focal, vx), q)));
+        _mm_storeu_ps(raster->sy + i, _mm_add_ps(center_y, _mm_mul_ps(_mm_mul_ps(focal, vy), q)));
+
+        __m128 nx = _mm_loadu_ps(mesh->nx + i), ny = _mm_loadu_ps(mesh->ny + i), nz = _mm_loadu_ps(mesh->nz + i);
+        __m128 lambert = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dot3(m[0], nx, ny, nz), light[0]),
+                                               _mm_mul_ps(dot3(m[1], nx, ny, nz), light[1])),
+                                    _mm_mul_ps(dot3(m[2], nx, ny, nz), light[2]));
+        __m128 lit = _mm_add_ps(ambient, _mm_max_ps(lambert, zero));
+        _mm_storeu_ps(raster->attr[ATTR_Q] + i, q);
+        _mm_storeu_ps(raster->attr[ATTR_R] + i, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(mesh->r + i), lit), q));
+        _mm_storeu_ps(raster->attr[ATTR_G] + i, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(mesh->g + i), lit), q));
+        _mm_storeu_ps(raster->attr[ATTR_B] + i, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(mesh->b + i), lit), q));
+    }
+#endif
+
+    const float (*rot)[3] = view->rotation;
+    for (; i < mesh->padded; i++) {
+        float x = mesh->x[i], y = mesh->y[i], z = mesh->z[i];
+        float vx = (rot[0][0] * x + rot[0][1] * y + rot[0][2] * z) + view->offset[0];
+        float vy = (rot[1][0] * x + rot[1][1] * y + rot[1][2] * z) + view->offset[1];
+        float vz = (rot[2][0] * x + rot[2][1] * y + rot[2][2] * z) + view->offset[2];
+        float q = 1.0f / vz;
+        raster->sx[i] = view->center_x + view->focal * vx * q;
+        raster->sy[i] = view->center_y + view->focal * vy * q;
+
+        float nx = mesh->nx[i], ny = mesh->ny[i], nz = mesh->nz[i];
+        float lambert = (rot[0][0] * nx + rot[0][1] * ny + rot[0][2] * nz) * view->light[0] +
+                        (rot[1][0] * nx + rot[1][1] * ny + rot[1][2] * nz) * view->light[1] +
+                        (rot[2][0] * nx + rot[2][1] * ny + rot[2][2] * nz) * view->light[2];
+        float lit = view->ambient + (lambert > 0.0f ? lambert : 0.0f);
+        raster->attr[ATTR_Q][i] = q;
+        raster->attr[ATTR_R][i] = mesh->r[i] * lit * q;
+        raster->attr[ATTR_G][i] = mesh->g[i] * lit * q;
+        raster->attr[ATTR_B][i] = mesh->b[i] * lit * q;
+    }
+}
+
+/* Snap, cull and set up one triangle; 0 if it draws nothing */
+static int setup_triangle(const MeshRaster *raster, const int *index, Triangle *t) {
+    int32_t X[3], Y[3];
+    float fx[3], fy[3];
+
+    for (int k = 0; k < 3; k++) {
+        int i = index[k];
+        float sx = raster->sx[i], sy = raster->sy[i], q = raster->attr[ATTR_Q][i];
+        if (!(q > 0.0f && q < 1.0f / NEAR_Z)) return 0;
+        if (!(sx > -GUARD_BAND && sx < raster->width + GUARD_BAND &&
+              sy > -GUARD_BAND && sy < raster->height + GUARD_BAND)) return 0;
+        X[k] = (int32_t)lrintf(sx * SUBPIXEL);
+        Y[k] = (int32_t)lrintf(sy * SUBPIXEL);
+        fx[k] = (float)X[k] / SUBPIXEL;
+        fy[k] = (float)Y[k] / SUBPIXEL;
+    }
+
+    /* Clockwise on the target (y down) is positive */
+    int64_t area = (int64_t)(X[1] - X[0]) * (Y[2] - Y[0]) - (int64_t)(Y[1] - Y[0]) * (X[2] - X[0]);
+    if (area <= 0) return 0;
+
+    /* Pixels whose centre can be inside */
+    int32_t min_x = X[0], max_x = X[0], min_y = Y[0], max_y = Y[0];
+    for (int k = 1; k < 3; k++) {
+        if (X[k] < min_x) min_x = X[k];
+        if (X[k] > max_x) max_x = X[k];
+        if (Y[k] < min_y) min_y = Y[k];
+        if (Y[k] > max_y) max_y = Y[k];
+    }
+    t->x0 = (min_x - SUBPIXEL / 2 + SUBPIXEL - 1) >> SUBPIXEL_BITS;
+    t->x1 = ((max_x - SUBPIXEL / 2) >> SUBPIXEL_BITS) + 1;
+    t->y0 = (min_y - SUBPIXEL / 2 + SUBPIXEL - 1) >> SUBPIXEL_BITS;
+    t->y1 = ((max_y - SUBPIXEL / 2) >> SUBPIXEL_BITS) + 1;
+    if (t->x0 < 0) t->x0 = 0;
+    if (t->y0 < 0) t->y0 = 0;
+    if (t->x1 > raster->width) t->x1 = raster->width;
+    if (t->y1 > raster->height) t->y1 = raster->height;
+    if (t->x0 >= t->x1 || t->y0 >= t->y1) return 0;
+
+    /* Edge e runs between the other two vertices and is >= 0 on the inside */
+    for (int e = 0; e < 3; e++) {
+        int a = (e + 1) % 3, b = (e + 2) % 3;
+        int32_t dx = X[b] - X[a], dy = Y[b] - Y[a];
+        int64_t c = (int64_t)dy * X[a] - (int64_t)dx * Y[a];
+
+        /* A shared edge runs opposite ways in its two triangles; only one keeps ties */
+        if (!(dy < 0 || (dy == 0 && dx > 0))) c -= 1;
+
+        t->step_x[e] = -dy * SUBPIXEL;
+        t->step_y[e] = dx * SUBPIXEL;
+        t->origin[e] = c - (int64_t)dy * (SUBPIXEL / 2) + (int64_t)dx * (SUBPIXEL / 2);
+    }
+
+    float dx1 = fx[1] - fx[0], dy1 = fy[1] - fy[0];
+    float dx2 = fx[2] - fx[0], dy2 = fy[2] - fy[0];
+    float d = dx1 * dy2 - dy1 * dx2;
+    if (!(d > 0.0f)) return 0;
+
+    t->ref_x = fx[0] - 0.5f;
+    t->ref_y = fy[0] - 0.5f;
+    for (int k = 0; k < NUM_ATTRS; k++) {
+        const float *attr = raster->attr[k];
+        float v0 = attr[index[0]], d1 = attr[index[1]] - v0, d2 = attr[index[2]] - v0;
+        t->plane[k][0] = v0;
+        t->plane[k][1] = (d1 * dy2 - d2 * dy1) / d;
+        t->plane[k][2] = (d2 * dx1 - d1 * dx2) / d;
+    }
+    return 1;
+}
+
+static inline uint32_t channel(const float plane[3], float fx, float fy, float w) {
+    float v = ((plane[0] + plane[1] * fx) + plane[2] * fy) * w;
+    v = v > 0.0f ? v : 0.0f;
+    v = v < 255.0f ? v : 255.0f;
+    return (uint32_t)lrintf(v);
+}
+
+#ifdef __SSE2__
+static inline __m128 plane4(const __m128 plane[3], __m128 fx, __m128 fy) {
+    return _mm_add_ps(_mm_add_ps(plane[0], _mm_mul_ps(plane[1], fx)), _mm_mul_ps(plane[2], fy));
+}
+
+static inline __m128i channel4(const __m128 plane[3], __m128 fx, __m128 fy, __m128 w) {
+    __m128 v = _mm_mul_ps(plane4(plane, fx, fy), w);
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+    return _mm_cvtps_epi32(v);
+}
+#endif
+
+/*
+ * Fill triangle t where it covers the tile at (tx, ty). Columns go in
+ * groups of four from a multiple of four into the tile, so groups never
+ * leave the tile buffers; any that hang past the target are never copied.
+ */
+static void draw_triangle(const Triangle *t, int tx, int ty, uint32_t *color, float *depth) {
+    int x0 = t->x0 > tx ? t->x0 : tx;
+    int y0 = t->y0 > ty ? t->y0 : ty;
+    int x1 = t->x1 < tx + TILE_SIZE ? t->x1 : tx + TILE_SIZE;
+    int y1 = t->y1 < ty + TILE_SIZE ? t->y1 : ty + TILE_SIZE;
+    if (x0 >= x1 || y0 >= y1) return;
+
+    x0 = tx + ((x0 - tx) & ~3);
+    int groups = (x1 - x0 + 3) >> 2;
+
+    /* Each edge either misses the box, holds all of it or crosses it; crossing ones fit in 32 bits */
+    int32_t start[3], step_x[3], step_y[3];
+    for (int e = 0; e < 3; e++) {
+        int64_t corner = t->origin[e] + (int64_t)t->step_x[e] * x0 + (int64_t)t->step_y[e] * y0;
+        int64_t across = (int64_t)t->step_x[e] * (groups * 4 - 1);
+        int64_t down = (int64_t)t->step_y[e] * (y1 - 1 - y0);
+        int64_t lo = corner + (across < 0 ? across : 0) + (down < 0 ? down : 0);
+        int64_t hi = corner + (across > 0 ? across : 0) + (down > 0 ? down : 0);
+
+        if (hi < 0) return;
+        if (lo >= 0) {
+            start[e] = step_x[e] = step_y[e] = 0;
+        } else {
+            start[e] = (int32_t)corner;
+            step_x[e] = t->step_x[e];
+            step_y[e] = t->step_y[e];
+        }
+    }
+
+    /* Reciprocal steps find each row's span to within a pixel; the lane tests are exact */
+    int width = groups * 4;
+    float inv_step[3];
+    for (int e = 0; e < 3; e++) {
+        inv_step[e] = step_x[e] ? 1.0f / step_x[e] : 0.0f;
+    }
+
+#ifdef __SSE2__
+    __m128i lane[3], step4[3];
+    __m128 plane[NUM_ATTRS][3];
+    for (int e = 0; e < 3; e++) {
+        int32_t s = step_x[e];
+        lane[e] = _mm_set_epi32(3 * s, 2 * s, s, 0);
+        step4[e] = _mm_set1_epi32(4 * s);
+    }
+    for (int k = 0; k < NUM_ATTRS; k++) {
+        for (int j = 0; j < 3; j++) {
+            plane[k][j] = _mm_set1_ps(t->plane[k][j]);
+        }
+    }
+    const __m128 ref_x = _mm_set1_ps(t->ref_x), one = _mm_set1_ps(1.0f);
+    const __m128i opaque = _mm_set1_epi32((int)0xFF000000u), four = _mm_set1_epi32(4);
+#endif
+
+    for (int y = y0; y < y1; y++) {
+        int32_t edge[3];
+        int first = 0, last = width - 1;
+        for (int e = 0; e < 3; e++) {
+            edge[e] = start[e] + step_y[e] * (y - y0);
+
+            /* Pixel i of the row is inside this edge when edge + step_x * i >= 0 */
+            float cross = -edge[e] * inv_step[e];
+            if (step_x[e] > 0) {
+                if (cross > first + 1) first = cross >= width ? width : (int)cross - 1;
+            } else if (step_x[e] < 0) {
+                if (cross < last - 1) last = cross < 0 ? -1 : (int)cross + 1;
+            } else if (edge[e] < 0) {
+                last = -1;
+            }
+        }
+        if (first > last) continue;
+
+        float fy = (float)y - t->ref_y;
+        size_t row = (size_t)(y - ty) * TILE_SIZE + (x0 - tx);
+        float *d = depth + row;
+        uint32_t *c = color + row;
+
+#ifdef __SSE2__
+        __m128i w[3];
+        first &= ~3;
+        for (int e = 0; e < 3; e++) {
+            w[e] = _mm_add_epi32(_mm_set1_epi32(edge[e] + step_x[e] * first), lane[e]);
+        }
+        const __m128 vfy = _mm_set1_ps(fy);
+        __m128i xs = _mm_add_epi32(_mm_set1_epi32(x0 + first), _mm_set_epi32(3, 2, 1, 0));
+
+        for (int g = first; g <= last; g += 4) {
+            __m128i outside = _mm_srai_epi32(_mm_or_si128(_mm_or_si128(w[0], w[1]), w[2]), 31);
+            if (_mm_movemask_epi8(outside) != 0xFFFF) {
+                __m128 fx = _mm_sub_ps(_mm_cvtepi32_ps(xs), ref_x);
+                __m128 q = plane4(plane[ATTR_Q], fx, vfy);
+                __m128 old = _mm_load_ps(d + g);
+                __m128 pass = _mm_andnot_ps(_mm_castsi128_ps(outside), _mm_cmpgt_ps(q, old));
+
+                if (_mm_movemask_ps(pass)) {
+                    __m128 inv = _mm_div_ps(one, q);
+                    __m128i r = channel4(plane[ATTR_R], fx, vfy, inv);
+                    __m128i gr = channel4(plane[ATTR_G], fx, vfy, inv);
+                    __m128i b = channel4(plane[ATTR_B], fx, vfy, inv);
+                    __m128i rgb = _mm_or_si128(_mm_or_si128(opaque, _mm_slli_epi32(r, 16)),
+                                               _mm_or_si128(_mm_slli_epi32(gr, 8), b));
+                    __m128i mask = _mm_castps_si128(pass);
+                    __m128i before = _mm_load_si128((const __m128i *)(c + g));
+
+                    _mm_store_ps(d + g, _mm_or_ps(_mm_and_ps(pass, q), _mm_andnot_ps(pass, old)));
+                    _mm_store_si128((__m128i *)(c + g),
+                                    _mm_or_si128(_mm_and_si128(mask, rgb), _mm_andnot_si128(mask, before)));
+                }
+            }
+            for (int e = 0; e < 3; e++) {
+                w[e] = _mm_add_epi32(w[e], step4[e]);
+            }
+            xs = _mm_add_epi32(xs, four);
+        }
+#else
+        for (int i = first; i <= last; i++) {
+            int32_t inside = (edge[0] + step_x[0] * i) | (edge[1] + step_x[1] * i) | (edge[2] + step_x[2] * i);
+            if (inside < 0) continue;
+
+            float fx = (float)(x0 + i) - t->ref_x;
+            float q = (t->plane[ATTR_Q][0] + t->plane[ATTR_Q][1] * fx) + t->plane[ATTR_Q][2] * fy;
+            if (!(q > d[i])) continue;
+
+            float inv = 1.0f / q;
+            d[i] = q;
+            c[i] = 0xFF000000u | channel(t->plane[ATTR_R], fx, fy, inv) << 16 |
+                   channel(t->plane[ATTR_G], fx, fy, inv) << 8 | channel(t->plane[ATTR_B], fx, fy, inv);
+        }
+#endif
+    }
+}
+
+/*
+ * Copy what was drawn in [x0, x1) x [y0, y1) of a tile to the target,
+ * noting the columns drawn in each row in extent; returns the pixel count
+ */
+static uint64_t copy_tile(const MeshRaster *raster, int tx, int ty, int x0, int y0, int x1, int y1,
+                          const uint32_t *color, const float *depth, int16_t extent[TILE_SIZE][2]) {
+    uint64_t written = 0;
+
+    for (int y = y0; y < y1; y++) {
+        uint32_t *dst = raster->target + (size_t)y * raster->width;
+        const uint32_t *c = color + (y - ty) * TILE_SIZE;
+        const float *d = depth + (y - ty) * TILE_SIZE;
+        int16_t *row = extent[y - ty];
+        int first = x1, last = x0;
+        int x = x0;
+
+#ifdef __SSE2__
+        /* Four at a time where nothing is counted per pixel; drawn pixels have depth > 0 */
+        for (; !raster->counts && x + 4 <= x1; x += 4) {
+            __m128i drawn = _mm_castps_si128(_mm_cmpgt_ps(_mm_loadu_ps(d + x - tx), _mm_setzero_ps()));
+            int mask = _mm_movemask_ps(_mm_castsi128_ps(drawn));
+            if (!mask) continue;
+
+            __m128i before = _mm_loadu_si128((const __m128i *)(dst + x));
+            __m128i after = _mm_loadu_si128((const __m128i *)(c + x - tx));
+            _mm_storeu_si128((__m128i *)(dst + x),
+                             _mm_or_si128(_mm_and_si128(drawn, after), _mm_andnot_si128(drawn, before)));
+            written += __builtin_popcount(mask);
+            if (first == x1) first = x + __builtin_ctz(mask);
+            last = x + 32 - __builtin_clz(mask);
+        }
+#endif
+        for (; x < x1; x++) {
+            if (!(d[x - tx] > 0.0f)) continue;
+
+            if (first == x1) first = x;
+            last = x + 1;
+            dst[x] = c[x - tx];
+            if (raster->counts && raster->counts[(size_t)y * raster->width + x] < UINT8_MAX) {
+                raster->counts[(size_t)y * raster->width + x]++;
+            }
+            written++;
+        }
+        if (first < last) {
+            row[0] = first - tx;
+            row[1] = last - tx;
+        }
+    }
+    return written;
+}
+
+/* Row pool task: rasterize busy tiles begin .. end-1 and copy them out */
+static void draw_tiles(int begin, int end, void *ctx) {
+    MeshRaster *raster = ctx;
+    uint32_t color[TILE_SIZE * TILE_SIZE] __attribute__((aligned(16)));
+    float depth[TILE_SIZE * TILE_SIZE] __attribute__((aligned(16)));
+
+    for (int i = begin; i < end; i++) {
+        int tile = raster->busy[i];
+        int tx = tile % raster->tiles_x * TILE_SIZE;
+        int ty = tile / raster->tiles_x * TILE_SIZE;
+        const int *bin = raster->bins + raster->bin_start[tile];
+        int count = raster->bin_start[tile + 1] - raster->bin_start[tile];
+
+        /* Only the box the triangles reach is cleared and copied out */
+        int x0 = tx + TILE_SIZE, y0 = ty + TILE_SIZE, x1 = tx, y1 = ty;
+        for (int k = 0; k < count; k++) {
+            const Triangle *t = &raster->triangles[bin[k]];
+            if (t->x0 < x0) x0 = t->x0;
+            if (t->y0 < y0) y0 = t->y0;
+            if (t->x1 > x1) x1 = t->x1;
+            if (t->y1 > y1) y1 = t->y1;
+        }
+        if (x0 < tx) x0 = tx;
+        if (y0 < ty) y0 = ty;
+        if (x1 > tx + TILE_SIZE) x1 = tx + TILE_SIZE;
+        if (y1 > ty + TILE_SIZE) y1 = ty + TILE_SIZE;
+
+        int clear_x0 = (x0 - tx) & ~3, clear_x1 = (x1 - tx + 3) & ~3;
+        for (int y = y0; y < y1; y++) {
+            memset(depth + (y - ty) * TILE_SIZE + clear_x0, 0, (size_t)(clear_x1 - clear_x0) * sizeof(float));
+        }
+
+        for (int k = 0; k < count; k++) {
+            draw_triangle(&raster->triangles[bin[k]], tx, ty, color, depth);
+        }
+
+        /* Rows left out stay empty */
+        for (int y = 0; y < TILE_SIZE; y++) {
+            raster->extent[tile][y][0] = raster->extent[tile][y][1] = 0;
+        }
+        raster->written[i] = copy_tile(raster, tx, ty, x0, y0, x1, y1, color, depth, raster->extent[tile]);
+    }
+}
+
+uint64_t mesh_draw(MeshRaster *raster, const Mesh *mesh, const MeshView *view,
+                   uint32_t *target, uint8_t *counts) {
+    if (!reserve(raster, mesh)) return 0;
+    transform_vertices(raster, mesh, view);
+
+    /* Set up what faces the camera and count it into the tiles it touches */
+    int tiles = raster->tiles_x * raster->tiles_y;
+    int count = 0;
+    memset(raster->bin_start, 0, (size_t)(tiles + 1) * sizeof(int));
+    for (int i = 0; i < mesh->num_triangles; i++) {
+        Triangle *t = &raster->triangles[count];
+        if (!setup_triangle(raster, mesh->triangles + 3 * i, t)) continue;
+        count++;
+
+        for (int ty = t->y0 / TILE_SIZE; ty <= (t->y1 - 1) / TILE_SIZE; ty++) {
+            for (int tx = t->x0 / TILE_SIZE; tx <= (t->x1 - 1) / TILE_SIZE; tx++) {
+                raster->bin_start[ty * raster->tiles_x + tx + 1]++;
+            }
+        }
+    }
+
+    raster->num_busy = 0;
+    for (int tile = 0; tile < tiles; tile++) {
+        if (raster->bin_start[tile + 1]) raster->busy[raster->num_busy++] = tile;
+        raster->bin_start[tile + 1] += raster->bin_start[tile];
+        raster->bin_fill[tile] = raster->bin_start[tile];
+    }
+
+    int total = raster->bin_start[tiles];
+    if (total > raster->bins_capacity) {
+        int *grown = realloc(raster->bins, (size_t)total * sizeof(int));
+        if (!grown) return 0;
+        raster->bins = grown;
+        raster->bins_capacity = total;
+    }
+    for (int i = 0; i < count; i++) {
+        const Triangle *t = &raster->triangles[i];
+        for (int ty = t->y0 / TILE_SIZE; ty <= (t->y1 - 1) / TILE_SIZE; ty++) {
+            for (int tx = t->x0 / TILE_SIZE; tx <= (t->x1 - 1) / TILE_SIZE; tx++) {
+                raster->bins[raster->bin_fill[ty * raster->tiles_x + tx]++] = i;
+            }
+        }
+    }
+
+    raster->target = target;
+    raster->counts = counts;
+    row_pool_run(raster->num_busy, draw_tiles, raster);
+
+    uint64_t written = 0;
+    for (int i = 0; i < raster->num_busy; i++) {
+        written += raster->written[i];
+    }
+    return written;
+}
+
+int mesh_row_extent(const MeshRaster *raster, int y, int *x0, int *x1) {
+    int ty = y / TILE_SIZE;
+    int first = raster->width, last = 0;
+
+    for (int tx = 0; tx < raster->tiles_x; tx++) {
+        int tile = ty * raster->tiles_x + tx;
+        const int16_t *row = raster->extent[tile][y % TILE_SIZE];
+        if (raster->bin_start[tile + 1] == raster->bin_start[tile] || row[0] >= row[1]) continue;
+
+        if (first == raster->width) first = tx * TILE_SIZE + row[0];
+        last = tx * TILE_SIZE + row[1];
+    }
+    *x0 = first;
+    *x1 = last;
+    return first < last;
+}
@@ -0,0 +1,62 @@
+/**
+ * Mesh - tile-binned software rasterizer for small lit meshes
+ * Vertices are transformed and lit four at a time, then every triangle
+ * facing the camera is binned into the square tiles of the target it
+ * touches. Each tile is filled on its own with half-space edge functions
+ * against a depth buffer of its own, so tiles are spread over the row
+ * pool and the result doesn't depend on how many threads took part.
+ * Colours are interpolated perspective-correct.
+ */
+
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdint.h>
+
+typedef struct {
+    float x, y, z;             /* Model space; y points down like the target */
+    float nx, ny, nz;          /* Unit normal */
+    uint32_t color;            /* RGB; alpha is ignored, the mesh is opaque */
+} MeshVertex;
+
+typedef struct Mesh Mesh;
+
+/*
+ * Copy a mesh: num_triangles triples of vertex indices. A triangle is
+ * front facing, and drawn, when its vertices go clockwise on the target.
+ */
+Mesh *mesh_create(const MeshVertex *vertices, int num_vertices, const int *triangles, int num_triangles);
+
+void mesh_destroy(Mesh *mesh);
+
+/* Camera and light; the camera sits at the view space origin looking down +z */
+typedef struct {
+    float rotation[3][3];      /* Model to view */
+    float offset[3];           /* Model origin in view space */
+    float focal;               /* Target pixels per unit at z = 1 */
+    float center_x, center_y;  /* Where the view axis meets the target */
+    float light[3];            /* Towards the light, view space; length is its strength */
+    float ambient;             /* Light on faces turned away from it */
+} MeshView;
+
+typedef struct MeshRaster MeshRaster;
+
+/* Rasterizer state for a width x height target */
+MeshRaster *mesh_raster_create(int width, int height);
+
+/*
+ * Draw mesh over the target. Returns the target pixels written; when
+ * counts is given, each one is also incremented there.
+ */
+uint64_t mesh_draw(MeshRaster *raster, const Mesh *mesh, const MeshView *view,
+                   uint32_t *target, uint8_t *counts);
+
+/*
+ * The pixels of target row y the last mesh_draw wrote all lie in [x0, x1);
+ * returns 0 when it wrote none there
+ */
+int mesh_row_extent(const MeshRaster *raster, int y, int *x0, int *x1);
+
+void mesh_raster_destroy(MeshRaster *raster);
+
+#endif /* MESH_H */
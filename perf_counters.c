@@ -0,0 +1,139 @@
+/**
+ * Perf Counters - per-thread hardware counters via perf_event_open
+ * See perf_counters.h. The group leader is the first counter that opens;
+ * PERF_FORMAT_GROUP returns every member's value in one read(), in the
+ * order they were added.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf_counters.h"
+
+struct PerfCounters {
+    int fds[PERF_NUM_COUNTERS];
+    int order[PERF_NUM_COUNTERS];   /* Counter at each position of a group read */
+    int count;
+    unsigned mask;
+};
+
+static const uint64_t perf_configs[PERF_NUM_COUNTERS] = {
+    [PERF_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+    [PERF_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+    [PERF_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+    [PERF_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+static int perf_event_open(struct perf_event_attr *attr, int group_fd) {
+    return (int)syscall(SYS_perf_event_open, attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+/* Turn the first open failure into something actionable */
+static void describe_failure(int err, char *reason, size_t reason_size) {
+    if (!reason || !reason_size) return;
+
+    if (err == EACCES || err == EPERM) {
+        int paranoid = -1;
+        FILE *f = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+        if (f) {
+            if (fscanf(f, "%d", &paranoid) != 1) paranoid = -1;
+            fclose(f);
+        }
+        snprintf(reason, reason_size, "not permitted (perf_event_paranoid=%d; containers may also need CAP_PERFMON)",
+                 paranoid);
+    } else if (err == ENOENT || err == EOPNOTSUPP || err == ENODEV) {
+        snprintf(reason, reason_size, "no hardware counters exposed (virtual machine or unsupported CPU)");
+    } else if (err == ENOSYS) {
+        snprintf(reason, reason_size, "perf_event_open is blocked (seccomp) or not built into the kernel");
+    } else {
+        snprintf(reason, reason_size, "%s", strerror(err));
+    }
+}
+
+PerfCounters *perf_counters_open(char *reason, size_t reason_size) {
+    PerfCounters *pc = calloc(1, sizeof(*pc));
+    if (!pc) return NULL;
+
+    int first_error = 0;
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = perf_configs[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        int fd = perf_event_open(&attr, pc->count ? pc->fds[0] : -1);
+        if (fd < 0) {
+            if (!first_error) first_error = errno;
+            continue;
+        }
+        pc->fds[pc->count] = fd;
+        pc->order[pc->count] = i;
+        pc->count++;
+        pc->mask |= 1u << i;
+    }
+
+    if (!pc->count) {
+        describe_failure(first_error, reason, reason_size);
+        free(pc);
+        return NULL;
+    }
+
+    ioctl(pc->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(pc->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return pc;
+}
+
+unsigned perf_counters_mask(const PerfCounters *pc) {
+    return pc->mask;
+}
+
+int perf_counters_read(PerfCounters *pc, PerfSample *sample) {
+    /* nr, time_enabled, time_running, then one value per member */
+    uint64_t buf[3 + PERF_NUM_COUNTERS];
+    ssize_t want = (ssize_t)((3 + pc->count) * sizeof(uint64_t));
+
+    if (read(pc->fds[0], buf, sizeof(buf)) < want || buf[0] != (uint64_t)pc->count) {
+        return -1;
+    }
+
+    memset(sample, 0, sizeof(*sample));
+    sample->time_enabled = buf[1];
+    sample->time_running = buf[2];
+    for (int i = 0; i < pc->count; i++) {
+        sample->value[pc->order[i]] = buf[3 + i];
+    }
+    return 0;
+}
+
+void perf_sample_delta(PerfSample *delta, const PerfSample *after, const PerfSample *before) {
+    delta->time_enabled = after->time_enabled - before->time_enabled;
+    delta->time_running = after->time_running - before->time_running;
+
+    double scale = 1.0;
+    if (delta->time_running && delta->time_running < delta->time_enabled) {
+        scale = (double)delta->time_enabled / delta->time_running;
+    }
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+        delta->value[i] = (uint64_t)((after->value[i] - before->value[i]) * scale);
+    }
+}
+
+void perf_counters_close(PerfCounters *pc) {
+    if (!pc) return;
+    for (int i = pc->count - 1; i >= 0; i--) {
+        close(pc->fds[i]);
+    }
+    free(pc);
+}
@@ -0,0 +1,48 @@
+/**
+ * Perf Counters - per-thread hardware counters via perf_event_open
+ * Cycles, instructions, cache misses and branch misses are opened as one
+ * group so they are always scheduled together and can be read with a
+ * single syscall. Counters the CPU, kernel or container does not provide
+ * are left out; if none can be opened, open returns NULL and the caller
+ * carries on without them.
+ */
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_NUM_COUNTERS
+} PerfCounter;
+
+typedef struct PerfCounters PerfCounters;
+
+typedef struct {
+    uint64_t value[PERF_NUM_COUNTERS];
+    uint64_t time_enabled;
+    uint64_t time_running;
+} PerfSample;
+
+/*
+ * Count user-space events of the calling thread from now on. Returns NULL
+ * when no counter is available; why is written to reason (may be NULL).
+ */
+PerfCounters *perf_counters_open(char *reason, size_t reason_size);
+
+/* Mask of (1 << PerfCounter) for the counters actually being counted */
+unsigned perf_counters_mask(const PerfCounters *pc);
+
+/* Snapshot the running totals; 0 on success */
+int perf_counters_read(PerfCounters *pc, PerfSample *sample);
+
+/* after - before, scaled up if the group was multiplexed off the PMU meanwhile */
+void perf_sample_delta(PerfSample *delta, const PerfSample *after, const PerfSample *before);
+
+void perf_counters_close(PerfCounters *pc);
+
+#endif /* PERF_COUNTERS_H */
@@ -0,0 +1,160 @@
+/**
+ * Row Pool - split a loop over rows across a few helper threads
+ * See row_pool.h. A run bumps the generation under the lock and wakes the
+ * helpers; everyone then claims chunks with an atomic counter. A helper
+ * joins a run under the lock and is counted as active until it leaves,
+ * and a new run waits for active to reach zero before replacing the job,
+ * so a late helper can never pick up rows of a job it didn't snapshot.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "row_pool.h"
+
+#define CHUNKS_PER_THREAD 4        /* Evens out rows that cost more than others */
+
+typedef struct {
+    RowTask task;
+    void *ctx;
+    int rows, chunk;
+} RowJob;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;           /* Helpers: a new generation or stop */
+    pthread_cond_t done;           /* Caller: rows finished or helpers left */
+    pthread_t threads[ROW_POOL_MAX_THREADS];
+    int count;
+    int stopping;
+    int busy;                      /* A run is in progress */
+    unsigned generation;
+    int active;                    /* Helpers inside the current job */
+    RowJob job;
+    int next;                      /* Next unclaimed row */
+    int finished;                  /* Rows done */
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+static __thread int slot;          /* Helper i is slot i + 1 */
+
+/* Claim and run chunks until the job is used up */
+static void run_chunks(const RowJob *job) {
+    for (;;) {
+        int begin = __atomic_fetch_add(&pool.next, job->chunk, __ATOMIC_RELAXED);
+        if (begin >= job->rows) return;
+
+        int end = begin + job->chunk < job->rows ? begin + job->chunk : job->rows;
+        job->task(begin, end, job->ctx);
+
+        int finished = __atomic_add_fetch(&pool.finished, end - begin, __ATOMIC_ACQ_REL);
+        if (finished == job->rows) {
+            pthread_mutex_lock(&pool.lock);
+            pthread_cond_broadcast(&pool.done);
+            pthread_mutex_unlock(&pool.lock);
+        }
+    }
+}
+
+static void *helper_main(void *arg) {
+    slot = (int)(intptr_t)arg;
+    pthread_mutex_lock(&pool.lock);
+    unsigned seen = pool.generation;   /* A restarted pool has run jobs before */
+    for (;;) {
+        while (pool.generation == seen && !pool.stopping) {
+            pthread_cond_wait(&pool.work, &pool.lock);
+        }
+        if (pool.stopping) break;
+
+        seen = pool.generation;
+        RowJob job = pool.job;
+        pool.active++;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_chunks(&job);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.active == 0) pthread_cond_broadcast(&pool.done);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+/* Helpers don't survive fork; a child runs everything inline */
+static void forget_in_child(void) {
+    pool.count = 0;
+}
+
+int row_pool_start(int threads) {
+    static int atfork_registered = 0;
+
+    if (threads > ROW_POOL_MAX_THREADS) threads = ROW_POOL_MAX_THREADS;
+    if (!atfork_registered) {
+        pthread_atfork(NULL, NULL, forget_in_child);
+        atfork_registered = 1;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.stopping = 0;
+    pthread_mutex_unlock(&pool.lock);
+
+    while (pool.count < threads &&
+           pthread_create(&pool.threads[pool.count], NULL, helper_main,
+                          (void *)(intptr_t)(pool.count + 1)) == 0) {
+        pool.count++;
+    }
+    return 0;
+}
+
+void row_pool_run(int rows, RowTask task, void *ctx) {
+    if (rows <= 0) return;
+    if (pool.count == 0 || __atomic_exchange_n(&pool.busy, 1, __ATOMIC_ACQUIRE)) {
+        task(0, rows, ctx);
+        return;
+    }
+
+    int chunk = rows / ((pool.count + 1) * CHUNKS_PER_THREAD);
+    RowJob job = { task, ctx, rows, chunk > 0 ? chunk : 1 };
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.active > 0) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pool.job = job;
+    pool.next = 0;
+    pool.finished = 0;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+
+    run_chunks(&job);
+
+    pthread_mutex_lock(&pool.lock);
+    while (__atomic_load_n(&pool.finished, __ATOMIC_ACQUIRE) < rows) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    __atomic_store_n(&pool.busy, 0, __ATOMIC_RELEASE);
+}
+
+void row_pool_stop(void) {
+    pthread_mutex_lock(&pool.lock);
+    pool.stopping = 1;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (int i = 0; i < pool.count; i++) {
+        pthread_join(pool.threads[i], NULL);
+    }
+    pool.count = 0;
+}
+
+int row_pool_slot(void) {
+    return slot;
+}
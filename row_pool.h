@@ -0,0 +1,35 @@
+/**
+ * Row Pool - split a loop over rows across a few helper threads
+ * The caller always takes part: it hands the rows out in small chunks,
+ * works on them itself and returns once every row is done. A pool that
+ * was never started, or is already running another loop, runs the rows
+ * inline on the caller, so passes can use it unconditionally. Tasks must
+ * only touch state reached through their context, not thread-locals.
+ */
+
+#ifndef ROW_POOL_H
+#define ROW_POOL_H
+
+#define ROW_POOL_MAX_THREADS 16
+#define ROW_POOL_SLOTS (ROW_POOL_MAX_THREADS + 1)
+
+/* Handle rows begin .. end-1 */
+typedef void (*RowTask)(int begin, int end, void *ctx);
+
+/* Start up to `threads` helpers; 0 on success, even if fewer could be started */
+int row_pool_start(int threads);
+
+/* Run task over rows 0 .. rows-1 and wait for it */
+void row_pool_run(int rows, RowTask task, void *ctx);
+
+/* Join the helpers; later runs are inline */
+void row_pool_stop(void);
+
+/*
+ * Which of a run's participants the calling thread is, below ROW_POOL_SLOTS:
+ * 0 for the thread that called row_pool_run, or any thread outside the pool.
+ * Lets a task pick its own scratch space without allocating per chunk.
+ */
+int row_pool_slot(void);
+
+#endif /* ROW_POOL_H */
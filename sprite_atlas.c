@@ -0,0 +1,590 @@
+/**
+ * Sprite Atlas - premultiplied ARGB sprites in one block, and one blitter
+ * See sprite_atlas.h. Channel products use the exact (x * y + 128) / 255
+ * rounding in both the SSE2 and the scalar path, so results don't depend
+ * on where a row's four-pixel groups fall. For linear-light blits each
+ * texel is also kept decoded, so a blit only decodes the target and
+ * encodes the result through the lut.h tables; the weighting between
+ * them stays in SSE2 lanes.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "lut.h"
+#include "sprite_atlas.h"
+
+#define ATLAS_ALIGN 64                         /* Sprites start on a cache line */
+#define ATLAS_ALIGN_PIXELS (ATLAS_ALIGN / 4)
+#define ROW_PAD_PIXELS 4                       /* Rows are whole SSE2 registers */
+#define ATLAS_INITIAL_PIXELS 4096
+
+typedef struct {
+    size_t offset;             /* Pixels from the start of the atlas */
+    int width, height, stride;
+    int origin_x, origin_y;
+    uint32_t coverage;         /* Non-empty texels */
+} Sprite;
+
+struct SpriteAtlas {
+    uint32_t *pixels;
+    size_t used, capacity;     /* In pixels */
+    uint64_t *linear_pixels;   /* The same texels as linear lanes, when linear */
+    Sprite *sprites;
+    int count, max;
+    int linear;                /* Blend in linear light */
+};
+
+/*
+ * Linear-light texels are four 16-bit lanes in the order SSE2 unpacks an
+ * ARGB pixel: blue, green and red as premultiplied light in
+ * 0 .. LINEAR_MAX, then alpha in 0 .. 255. Tints are fractions of
+ * TINT_ONE and the target's weight one of 256, so every product fits the
+ * lanes and the scalar and SSE2 paths agree bit for bit.
+ */
+#define TINT_BITS 12
+#define TINT_ONE (1 << TINT_BITS)
+
+static inline uint32_t lane(uint64_t p, int i) {
+    return (uint32_t)(p >> (16 * i)) & 0xFFFF;
+}
+
+/*
+ * Premultiplied sRGB channel c of alpha a as premultiplied linear light:
+ * the colour is decoded before the coverage is applied. Without coverage
+ * the channel is light to add and is decoded as it is.
+ */
+static inline uint32_t premultiplied_linear(uint32_t c, uint32_t a) {
+    if (a == 0 || a == 0xFF) return srgb_to_linear(c);
+    uint32_t straight = (c * 255 + a / 2) / a;
+    return (srgb_to_linear(straight > 0xFF ? 0xFF : straight) * a + 127) / 255;
+}
+
+static uint64_t linear_texel(uint32_t t) {
+    uint32_t a = t >> 24;
+    uint64_t out = (uint64_t)a << 48;
+    for (int i = 0; i < 3; i++) {
+        out |= (uint64_t)premultiplied_linear((t >> (8 * i)) & 0xFF, a) << (16 * i);
+    }
+    return out;
+}
+
+/* A blit's modulate as linear-light tint lanes */
+static uint64_t linear_tint(uint32_t m) {
+    uint64_t out = (uint64_t)(((m >> 24) * TINT_ONE + 127) / 255) << 48;
+    for (int i = 0; i < 3; i++) {
+        out |= (uint64_t)((srgb_to_linear(m >> (8 * i)) * TINT_ONE + LINEAR_MAX / 2) / LINEAR_MAX) << (16 * i);
+    }
+    return out;
+}
+
+/* An sRGB target pixel in linear lanes, and back; light past LINEAR_MAX and alpha past 255 saturate */
+static inline uint64_t decode_pixel(uint32_t p) {
+    return (uint64_t)srgb_to_linear(p) | (uint64_t)srgb_to_linear(p >> 8) << 16 |
+           (uint64_t)srgb_to_linear(p >> 16) << 32 | (uint64_t)(p >> 24) << 48;
+}
+
+static inline uint32_t encode_pixel(uint64_t l) {
+    uint32_t a = lane(l, 3);
+    return (a > 0xFF ? 0xFF : a) << 24 | linear_to_srgb(lane(l, 2)) << 16 |
+           linear_to_srgb(lane(l, 1)) << 8 | linear_to_srgb(lane(l, 0));
+}
+
+/* How much of the target shows through alpha a, out of 256 */
+static inline uint32_t target_weight(uint32_t a, BlitMode mode) {
+    uint32_t inv = 255 - a;
+    return mode == BLIT_ADD ? 256 : inv + (inv >> 7);
+}
+
+static inline uint64_t tint_texel(uint64_t s, uint64_t tint) {
+    uint64_t out = 0;
+    for (int i = 0; i < 4; i++) {
+        out |= (uint64_t)((lane(s, i) * lane(tint, i) + TINT_ONE / 2) >> TINT_BITS) << (16 * i);
+    }
+    return out;
+}
+
+/* Linear texel s over or onto sRGB pixel dst */
+static inline uint32_t blend_linear(uint32_t dst, uint64_t s, BlitMode mode) {
+    uint64_t d = decode_pixel(dst), out = 0;
+    uint32_t w = target_weight(lane(s, 3), mode);
+    for (int i = 0; i < 4; i++) {
+        out |= (uint64_t)(lane(s, i) + (lane(d, i) * w >> 8)) << (16 * i);
+    }
+    return encode_pixel(out);
+}
+
+SpriteAtlas *sprite_atlas_create(int linear) {
+    SpriteAtlas *atlas = calloc(1, sizeof(SpriteAtlas));
+    if (atlas) atlas->linear = linear;
+    return atlas;
+}
+
+int sprite_atlas_add(SpriteAtlas *atlas, int width, int height,
+                     int origin_x, int origin_y, SpriteTexel texel, void *ctx) {
+    if (width <= 0 || height <= 0) return -1;
+
+    int stride = (width + ROW_PAD_PIXELS - 1) & ~(ROW_PAD_PIXELS - 1);
+    size_t offset = (atlas->used + ATLAS_ALIGN_PIXELS - 1) & ~(size_t)(ATLAS_ALIGN_PIXELS - 1);
+    size_t end = offset + (size_t)stride * height;
+
+    if (end > atlas->capacity) {
+        size_t capacity = atlas->capacity ? atlas->capacity : ATLAS_INITIAL_PIXELS;
+        while (capacity < end) capacity *= 2;
+        uint32_t *grown = aligned_alloc(ATLAS_ALIGN, capacity * sizeof(uint32_t));
+        uint64_t *grown_linear = atlas->linear ? aligned_alloc(ATLAS_ALIGN, capacity * sizeof(uint64_t)) : NULL;
+        if (!grown || (atlas->linear && !grown_linear)) {
+            free(grown);
+            free(grown_linear);
+            return -1;
+        }
+        if (atlas->used) {
+            memcpy(grown, atlas->pixels, atlas->used * sizeof(uint32_t));
+            if (grown_linear) memcpy(grown_linear, atlas->linear_pixels, atlas->used * sizeof(uint64_t));
+        }
+        free(atlas->pixels);
+        free(atlas->linear_pixels);
+        atlas->pixels = grown;
+        atlas->linear_pixels = grown_linear;
+        atlas->capacity = capacity;
+    }
+    if (atlas->count == atlas->max) {
+        int max = atlas->max ? atlas->max * 2 : 32;
+        Sprite *grown = realloc(atlas->sprites, max * sizeof(Sprite));
+        if (!grown) return -1;
+        atlas->sprites = grown;
+        atlas->max = max;
+    }
+
+    Sprite *s = &atlas->sprites[atlas->count];
+    s->offset = offset;
+    s->width = width;
+    s->height = height;
+    s->stride = stride;
+    s->origin_x = origin_x;
+    s->origin_y = origin_y;
+    s->coverage = 0;
+
+    uint32_t *dst = atlas->pixels + offset;
+    memset(dst, 0, (size_t)stride * height * sizeof(uint32_t));
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint32_t t = texel(x - origin_x, y - origin_y, ctx);
+            dst[y * stride + x] = t;
+            if (t) s->coverage++;
+        }
+    }
+    if (atlas->linear) {
+        uint64_t *linear = atlas->linear_pixels + offset;
+        for (size_t i = 0; i < (size_t)stride * height; i++) {
+            linear[i] = linear_texel(dst[i]);
+        }
+    }
+
+    atlas->used = end;
+    return atlas->count++;
+}
+
+/*
+ * Keep the part of polygon in[n] where side * (p[axis] - edge) <= 0
+ * (Sutherland-Hodgman). A concave polygon may come out with zero-width
+ * slivers along the edge; they add nothing to its area.
+ */
+static int clip_polygon(const float *in, int n, float *out, int axis, float edge, float side) {
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        const float *a = in + 2 * i, *b = in + 2 * ((i + 1) % n);
+        float da = side * (a[axis] - edge), db = side * (b[axis] - edge);
+        if (da <= 0) {
+            out[2 * m] = a[0];
+            out[2 * m + 1] = a[1];
+            m++;
+        }
+        if ((da < 0 && db > 0) || (da > 0 && db < 0)) {
+            float t = da / (da - db);
+            out[2 * m] = a[0] + (b[0] - a[0]) * t;
+            out[2 * m + 1] = a[1] + (b[1] - a[1]) * t;
+            m++;
+        }
+    }
+    return m;
+}
+
+float sprite_polygon_coverage(const float *points, int count, float x, float y) {
+    /* Each clip adds at most one vertex per crossing edge, i.e. half as many again */
+    float buffer[2][2 * 6 * SPRITE_POLYGON_MAX];
+    static const struct { int axis; float edge, side; } edges[4] = {
+        { 0, 0, -1 }, { 0, 1, 1 }, { 1, 0, -1 }, { 1, 1, 1 }
+    };
+
+    /* Relative to the pixel, so the area adds up small numbers */
+    if (count > SPRITE_POLYGON_MAX) count = SPRITE_POLYGON_MAX;
+    for (int i = 0; i < count; i++) {
+        buffer[0][2 * i] = points[2 * i] - x;
+        buffer[0][2 * i + 1] = points[2 * i + 1] - y;
+    }
+    int n = count;
+    for (int k = 0; k < 4 && n; k++) {
+        n = clip_polygon(buffer[k & 1], n, buffer[(k + 1) & 1], edges[k].axis, edges[k].edge, edges[k].side);
+    }
+
+    /* Shoelace area of what is left */
+    float area = 0;
+    for (int i = 0; i < n; i++) {
+        const float *a = buffer[0] + 2 * i, *b = buffer[0] + 2 * ((i + 1) % n);
+        area += a[0] * b[1] - b[0] * a[1];
+    }
+    area = area < 0 ? -area / 2 : area / 2;
+    return area < 1 ? area : 1;
+}
+
+/* (a * b + 128) / 255, exact for 8-bit inputs */
+static inline uint32_t mul8(uint32_t a, uint32_t b) {
+    uint32_t t = a * b + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+static inline uint32_t modulate_pixel(uint32_t p, uint32_t m) {
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        out |= mul8((p >> shift) & 0xFF, (m >> shift) & 0xFF) << shift;
+    }
+    return out;
+}
+
+static inline uint32_t blend_pixel(uint32_t dst, uint32_t src, BlitMode mode) {
+    uint32_t out = 0;
+
+    if (mode == BLIT_OPAQUE) return src;
+    if (mode == BLIT_ADD) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            uint32_t c = ((dst >> shift) & 0xFF) + ((src >> shift) & 0xFF);
+            out |= (c > 0xFF ? 0xFF : c) << shift;
+        }
+        return out;
+    }
+
+    uint32_t inv = 255 - (src >> 24);
+    for (int shift = 0; shift < 32; shift += 8) {
+        /* Saturate like the SSE2 pack in case a tint brightened past alpha */
+        uint32_t c = ((src >> shift) & 0xFF) + mul8((dst >> shift) & 0xFF, inv);
+        out |= (c > 0xFF ? 0xFF : c) << shift;
+    }
+    return out;
+}
+
+#ifdef __SSE2__
+/* mul8 on eight 16-bit lanes */
+static inline __m128i mul8_epi16(__m128i a, __m128i b) {
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+/* Each pixel's alpha in all four of its lanes */
+static inline __m128i alpha_epi16(__m128i p) {
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(p, 0xFF), 0xFF);
+}
+
+/* tint_texel on two pixels */
+static inline __m128i tint_epi16(__m128i s, __m128i tint) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi32(TINT_ONE / 2);
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(s, zero), _mm_unpacklo_epi16(tint, zero));
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(s, zero), _mm_unpackhi_epi16(tint, zero));
+    lo = _mm_srli_epi32(_mm_add_epi32(lo, half), TINT_BITS);
+    hi = _mm_srli_epi32(_mm_add_epi32(hi, half), TINT_BITS);
+    return _mm_packs_epi32(lo, hi);
+}
+
+/* decode_pixel on two pixels */
+static inline __m128i decode_pair(uint32_t p0, uint32_t p1) {
+    return _mm_set_epi16((short)(p1 >> 24), (short)srgb_to_linear(p1 >> 16), (short)srgb_to_linear(p1 >> 8),
+                         (short)srgb_to_linear(p1), (short)(p0 >> 24), (short)srgb_to_linear(p0 >> 16),
+                         (short)srgb_to_linear(p0 >> 8), (short)srgb_to_linear(p0));
+}
+
+/* Clamp two pixels' lanes to what encode_pixel saturates them to */
+static inline __m128i saturate_epi16(__m128i l) {
+    return _mm_min_epi16(l, _mm_set_epi16(255, LINEAR_MAX, LINEAR_MAX, LINEAR_MAX,
+                                          255, LINEAR_MAX, LINEAR_MAX, LINEAR_MAX));
+}
+
+/* encode_pixel on pixel k of two, once saturated */
+#define encode_lane(l, k) \
+    ((uint32_t)_mm_extract_epi16(l, 4 * (k) + 3) << 24 | \
+     (uint32_t)linear_srgb_lut[_mm_extract_epi16(l, 4 * (k) + 2)] << 16 | \
+     (uint32_t)linear_srgb_lut[_mm_extract_epi16(l, 4 * (k) + 1)] << 8 | \
+     (uint32_t)linear_srgb_lut[_mm_extract_epi16(l, 4 * (k))])
+
+/* blend_linear's lanes for two pixels, the target already decoded */
+static inline __m128i blend_linear_epi16(__m128i s, __m128i d, BlitMode mode) {
+    __m128i w;
+    if (mode == BLIT_ADD) {
+        w = _mm_set1_epi16(256);
+    } else {
+        w = _mm_sub_epi16(_mm_set1_epi16(255), alpha_epi16(s));
+        w = _mm_add_epi16(w, _mm_srli_epi16(w, 7));
+    }
+    /* (d * w) >> 8 as the high half of (16 d) * (16 w): both fit 16 bits */
+    __m128i shown = _mm_mulhi_epu16(_mm_slli_epi16(d, 4), _mm_slli_epi16(w, 4));
+    return _mm_add_epi16(s, shown);
+}
+#endif
+
+/*
+ * blit_row for BLIT_OVER and BLIT_ADD in linear light; src and linear are
+ * the same texels. An untinted opaque texel over the target is the texel
+ * itself, since the tables round-trip, so those are copied.
+ */
+static void blit_row_linear(uint32_t *dst, const uint32_t *src, const uint64_t *linear, int n,
+                            BlitMode mode, uint32_t modulate, uint64_t tint) {
+    int modulated = modulate != 0xFFFFFFFFu;
+    int copy_opaque = mode == BLIT_OVER && !modulated;
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i opaque = _mm_set1_epi32((int)0xFF000000u);
+    const __m128i tints = _mm_set1_epi64x((long long)tint);
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i empty = _mm_cmpeq_epi32(s, zero);
+        if (_mm_movemask_epi8(empty) == 0xFFFF) continue;
+
+        /* Keep the target under empty texels and copy untinted opaque ones */
+        __m128i keep = empty;
+        if (copy_opaque) keep = _mm_or_si128(keep, _mm_cmpeq_epi32(_mm_and_si128(s, opaque), opaque));
+        int kept = _mm_movemask_epi8(keep);
+        uint32_t *out = dst + i;
+
+        /* With one pixel or none to blend, blend it on its own */
+        if (__builtin_popcount(kept) >= 12) {
+            if (copy_opaque) {
+                __m128i solid = _mm_andnot_si128(empty, keep);
+                __m128i d = _mm_loadu_si128((const __m128i *)out);
+                _mm_storeu_si128((__m128i *)out, _mm_or_si128(_mm_and_si128(solid, s), _mm_andnot_si128(solid, d)));
+            }
+            for (int k = 0; k < 4; k++) {
+                if (kept >> (4 * k) & 1) continue;
+                uint64_t t = modulated ? tint_texel(linear[i + k], tint) : linear[i + k];
+                out[k] = blend_linear(out[k], t, mode);
+            }
+            continue;
+        }
+
+        __m128i s_lo = _mm_loadu_si128((const __m128i *)(linear + i));
+        __m128i s_hi = _mm_loadu_si128((const __m128i *)(linear + i + 2));
+        if (modulated) {
+            s_lo = tint_epi16(s_lo, tints);
+            s_hi = tint_epi16(s_hi, tints);
+        }
+
+        __m128i o_lo = saturate_epi16(blend_linear_epi16(s_lo, decode_pair(out[0], out[1]), mode));
+        __m128i o_hi = saturate_epi16(blend_linear_epi16(s_hi, decode_pair(out[2], out[3]), mode));
+        out[0] = encode_lane(o_lo, 0);
+        out[1] = encode_lane(o_lo, 1);
+        out[2] = encode_lane(o_hi, 0);
+        out[3] = encode_lane(o_hi, 1);
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (!src[i]) continue;
+        if (copy_opaque && src[i] >> 24 == 0xFF) {
+            dst[i] = src[i];
+            continue;
+        }
+        uint64_t s = modulated ? tint_texel(linear[i], tint) : linear[i];
+        dst[i] = blend_linear(dst[i], s, mode);
+    }
+}
+
+static void blit_row(uint32_t *dst, const uint32_t *src, int n, BlitMode mode, uint32_t modulate) {
+    int modulated = modulate != 0xFFFFFFFFu;
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mod = _mm_unpacklo_epi8(_mm_set1_epi32((int)modulate), zero);
+    const __m128i full = _mm_set1_epi16(255);
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        if (mode != BLIT_OPAQUE && _mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xFFFF) continue;
+
+        __m128i s_lo = _mm_unpacklo_epi8(s, zero);
+        __m128i s_hi = _mm_unpackhi_epi8(s, zero);
+        if (modulated) {
+            s_lo = mul8_epi16(s_lo, mod);
+            s_hi = mul8_epi16(s_hi, mod);
+        }
+
+        __m128i *out = (__m128i *)(dst + i);
+        if (mode == BLIT_OPAQUE) {
+            _mm_storeu_si128(out, _mm_packus_epi16(s_lo, s_hi));
+            continue;
+        }
+
+        __m128i d = _mm_loadu_si128(out);
+        if (mode == BLIT_ADD) {
+            _mm_storeu_si128(out, _mm_adds_epu8(d, _mm_packus_epi16(s_lo, s_hi)));
+            continue;
+        }
+
+        __m128i d_lo = mul8_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, alpha_epi16(s_lo)));
+        __m128i d_hi = mul8_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, alpha_epi16(s_hi)));
+        _mm_storeu_si128(out, _mm_packus_epi16(_mm_add_epi16(s_lo, d_lo), _mm_add_epi16(s_hi, d_hi)));
+    }
+#endif
+
+    for (; i < n; i++) {
+        uint32_t s = src[i];
+        if (!s && mode != BLIT_OPAQUE) continue;
+        if (modulated) s = modulate_pixel(s, modulate);
+        dst[i] = blend_pixel(dst[i], s, mode);
+    }
+}
+
+#define SCALED_CHUNK 256           /* Sampled texels handed to blit_row at once */
+
+/* A blit's rectangle in the target, before and after clipping */
+typedef struct {
+    int x0, y0;                /* Top left of the drawn sprite */
+    int w, h;                  /* Drawn size */
+    int sx, sy;                /* First visible pixel, relative to (x0, y0) */
+    int vw, vh;                /* Visible size */
+    int scaled;
+} BlitRect;
+
+/* Place and clip a blit; 0 if nothing is left */
+static int clip_blit(const Sprite *s, const SpriteBlit *b, int width, int height, BlitRect *r) {
+    r->w = b->width > 0 ? b->width : s->width;
+    r->h = b->height > 0 ? b->height : s->height;
+    r->scaled = r->w != s->width || r->h != s->height;
+    r->x0 = b->x - (int)((int64_t)s->origin_x * r->w / s->width);
+    r->y0 = b->y - (int)((int64_t)s->origin_y * r->h / s->height);
+    r->sx = r->x0 < 0 ? -r->x0 : 0;
+    r->sy = r->y0 < 0 ? -r->y0 : 0;
+
+    int x1 = r->x0 + r->w < width ? r->x0 + r->w : width;
+    int y1 = r->y0 + r->h < height ? r->y0 + r->h : height;
+    r->vw = x1 - (r->x0 + r->sx);
+    r->vh = y1 - (r->y0 + r->sy);
+    return r->vw > 0 && r->vh > 0;
+}
+
+/* Source texel under drawn pixel i of n, sampling at pixel centres in 16.16 */
+static inline int sample(int i, int n, int size) {
+    return (int)((((int64_t)i << 16) + (1 << 15)) * size / n >> 16);
+}
+
+/* Source columns under `count` drawn columns starting at `col` */
+static void sample_columns(int *out, const Sprite *s, const BlitRect *r, int col, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = sample(col + i, r->w, s->width);
+    }
+}
+
+void sprite_blit(const SpriteAtlas *atlas, const SpriteBlit *blits, int count,
+                 uint32_t *target, int width, int height) {
+    int columns[SCALED_CHUNK];
+    uint32_t texels[SCALED_CHUNK];
+    uint64_t linear_texels[SCALED_CHUNK];
+
+    for (int i = 0; i < count; i++) {
+        const SpriteBlit *b = &blits[i];
+        if (b->sprite < 0 || b->sprite >= atlas->count) continue;
+
+        const Sprite *s = &atlas->sprites[b->sprite];
+        BlitRect r;
+        if (!clip_blit(s, b, width, height, &r)) continue;
+
+        int linear = atlas->linear && b->mode != BLIT_OPAQUE;
+        uint64_t tint = linear ? linear_tint(b->modulate) : 0;
+        const uint32_t *pixels = atlas->pixels + s->offset;
+        const uint64_t *linear_pixels = linear ? atlas->linear_pixels + s->offset : NULL;
+        uint32_t *dst = target + (size_t)(r.y0 + r.sy) * width + r.x0 + r.sx;
+        if (!r.scaled) {
+            for (int row = r.sy; row < r.sy + r.vh; row++, dst += width) {
+                size_t first = (size_t)row * s->stride + r.sx;
+                if (linear) {
+                    blit_row_linear(dst, pixels + first, linear_pixels + first, r.vw, b->mode, b->modulate, tint);
+                } else {
+                    blit_row(dst, pixels + first, r.vw, b->mode, b->modulate);
+                }
+            }
+            continue;
+        }
+
+        /* Resized: sample columns once per chunk, then gather each row into a span */
+        for (int done = 0; done < r.vw; done += SCALED_CHUNK) {
+            int n = r.vw - done < SCALED_CHUNK ? r.vw - done : SCALED_CHUNK;
+            sample_columns(columns, s, &r, r.sx + done, n);
+
+            uint32_t *out = dst + done;
+            for (int row = r.sy; row < r.sy + r.vh; row++, out += width) {
+                size_t first = (size_t)sample(row, r.h, s->height) * s->stride;
+                const uint32_t *src = pixels + first;
+                for (int k = 0; k < n; k++) {
+                    texels[k] = src[columns[k]];
+                }
+                if (!linear) {
+                    blit_row(out, texels, n, b->mode, b->modulate);
+                    continue;
+                }
+                for (int k = 0; k < n; k++) {
+                    linear_texels[k] = linear_pixels[first + columns[k]];
+                }
+                blit_row_linear(out, texels, linear_texels, n, b->mode, b->modulate, tint);
+            }
+        }
+    }
+}
+
+uint32_t sprite_coverage(const SpriteAtlas *atlas, const SpriteBlit *blit,
+                         int width, int height, uint8_t *counts) {
+    if (blit->sprite < 0 || blit->sprite >= atlas->count) return 0;
+
+    const Sprite *s = &atlas->sprites[blit->sprite];
+    BlitRect r;
+    if (!clip_blit(s, blit, width, height, &r)) return 0;
+    if (!counts && !r.scaled && r.vw == s->width && r.vh == s->height) return s->coverage;
+
+    int columns[SCALED_CHUNK];
+    uint32_t covered = 0;
+    for (int done = 0; done < r.vw; done += SCALED_CHUNK) {
+        int n = r.vw - done < SCALED_CHUNK ? r.vw - done : SCALED_CHUNK;
+        if (r.scaled) {
+            sample_columns(columns, s, &r, r.sx + done, n);
+        } else {
+            for (int k = 0; k < n; k++) columns[k] = r.sx + done + k;
+        }
+
+        for (int row = r.sy; row < r.sy + r.vh; row++) {
+            int src_row = r.scaled ? sample(row, r.h, s->height) : row;
+            const uint32_t *src = atlas->pixels + s->offset + (size_t)src_row * s->stride;
+            for (int k = 0; k < n; k++) {
+                if (!src[columns[k]]) continue;
+                covered++;
+                if (counts) {
+                    uint8_t *c = &counts[(size_t)(r.y0 + row) * width + r.x0 + r.sx + done + k];
+                    if (*c < UINT8_MAX) (*c)++;
+                }
+            }
+        }
+    }
+    return covered;
+}
+
+void sprite_atlas_destroy(SpriteAtlas *atlas) {
+    if (!atlas) return;
+    free(atlas->pixels);
+    free(atlas->linear_pixels);
+    free(atlas->sprites);
+    free(atlas);
+}
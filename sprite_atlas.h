@@ -0,0 +1,72 @@
+/**
+ * Sprite Atlas - premultiplied ARGB sprites in one block, and one blitter
+ * Sprites are drawn once, at the size they will be shown, into a single
+ * 64-byte aligned allocation: every sprite starts on a cache line and
+ * rows are padded to four pixels. One clipped blitter draws them all,
+ * four pixels at a time with SSE2 where available, so a new kind of
+ * sprite is only a new texel function. A blit can also resize its sprite
+ * with nearest sampling, for sprites kept at a few sizes like mipmaps.
+ * Blending is on sRGB values, or in linear light.
+ */
+
+#ifndef SPRITE_ATLAS_H
+#define SPRITE_ATLAS_H
+
+#include <stdint.h>
+
+typedef enum {
+    BLIT_OPAQUE,               /* Replace the target */
+    BLIT_OVER,                 /* Premultiplied alpha over the target */
+    BLIT_ADD                   /* Saturating add */
+} BlitMode;
+
+typedef struct SpriteAtlas SpriteAtlas;
+
+/* Premultiplied ARGB texel at (dx, dy) from the sprite's origin; 0 is empty */
+typedef uint32_t (*SpriteTexel)(int dx, int dy, void *ctx);
+
+#define SPRITE_POLYGON_MAX 16      /* Vertices sprite_polygon_coverage takes */
+
+typedef struct {
+    int sprite;
+    int x, y;                  /* Where the sprite's origin lands */
+    BlitMode mode;
+    uint32_t modulate;         /* Per-channel multiplier, 0xFFFFFFFF for none */
+    int width, height;         /* Drawn size; 0 draws the sprite's own size */
+} SpriteBlit;
+
+/*
+ * When linear is set, BLIT_OVER and BLIT_ADD take texels and target as
+ * sRGB and blend in linear light, and the atlas keeps every texel decoded
+ * as well; lut_init must have run.
+ */
+SpriteAtlas *sprite_atlas_create(int linear);
+
+/*
+ * Add a width x height sprite whose origin is (origin_x, origin_y) from its
+ * top-left corner, filled from texel. Returns the sprite id, or -1.
+ */
+int sprite_atlas_add(SpriteAtlas *atlas, int width, int height,
+                     int origin_x, int origin_y, SpriteTexel texel, void *ctx);
+
+/*
+ * Exact fraction of the pixel square [x, x + 1) x [y, y + 1) covered by a
+ * simple polygon of count (x, y) vertices in either winding: analytic
+ * anti-aliasing for texel functions that draw shapes with straight edges.
+ */
+float sprite_polygon_coverage(const float *points, int count, float x, float y);
+
+/* Draw blits in order into a width x height ARGB target */
+void sprite_blit(const SpriteAtlas *atlas, const SpriteBlit *blits, int count,
+                 uint32_t *target, int width, int height);
+
+/*
+ * Target pixels a blit touches (non-empty texels after clipping). When
+ * counts is given, each one is also incremented there (saturating).
+ */
+uint32_t sprite_coverage(const SpriteAtlas *atlas, const SpriteBlit *blit,
+                         int width, int height, uint8_t *counts);
+
+void sprite_atlas_destroy(SpriteAtlas *atlas);
+
+#endif /* SPRITE_ATLAS_H */
@@ -0,0 +1,460 @@
+/**
+ * Terminal Output - draw frames as character cells over a plain tty
+ * See term_output.h. What the terminal shows is tracked per cell (or per
+ * sixel pixel), and the encoder only writes cells whose colour moved.
+ * Cursor moves are coalesced: a short gap on the same row is bridged by
+ * reprinting the unchanged cells when that is cheaper than a CUF escape.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <termios.h>
+
+#include "term_output.h"
+
+#define HALFBLOCK_SUPERSAMPLE 2   /* Framebuffer pixels per half-cell, each axis */
+#define SIXEL_LEVELS 6            /* Per channel; 6x6x6 colour cube */
+#define SIXEL_COLORS (SIXEL_LEVELS * SIXEL_LEVELS * SIXEL_LEVELS)
+#define MAX_GAP_FILL 4            /* Longest run of unchanged cells worth reprinting */
+
+struct TermOutput {
+    TermMode mode;
+    int cols, rows;
+    int cell_w, cell_h;
+    int threshold;
+    int fb_width, fb_height;
+    int valid;                 /* Screen state below matches the terminal */
+
+    /* Half-block: colours on screen for the upper and lower half of each cell */
+    uint32_t *screen_top;
+    uint32_t *screen_bottom;
+
+    /* Sixel: palette index of every pixel, on screen and in this frame */
+    uint8_t *screen_index;
+    uint8_t *frame_index;
+
+    /* Encoder state within one frame */
+    int cursor_row, cursor_col;    /* -1 when unknown */
+    int64_t sgr_fg, sgr_bg;        /* -1 when unknown */
+
+    char *out;
+    size_t out_len, out_cap;
+
+    TermStats stats;
+};
+
+/* Output buffer */
+
+static void out_reserve(TermOutput *t, size_t extra) {
+    if (t->out_len + extra <= t->out_cap) return;
+    size_t cap = t->out_cap ? t->out_cap : 65536;
+    while (cap < t->out_len + extra) cap *= 2;
+    char *grown = realloc(t->out, cap);
+    if (!grown) abort();
+    t->out = grown;
+    t->out_cap = cap;
+}
+
+static void out_bytes(TermOutput *t, const char *s, size_t len) {
+    out_reserve(t, len);
+    memcpy(t->out + t->out_len, s, len);
+    t->out_len += len;
+}
+
+static void out_printf(TermOutput *t, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void out_printf(TermOutput *t, const char *fmt, ...) {
+    va_list ap;
+    out_reserve(t, 64);
+    va_start(ap, fmt);
+    int n = vsnprintf(t->out + t->out_len, t->out_cap - t->out_len, fmt, ap);
+    va_end(ap);
+    if ((size_t)n >= t->out_cap - t->out_len) {
+        out_reserve(t, n + 1);
+        va_start(ap, fmt);
+        vsnprintf(t->out + t->out_len, t->out_cap - t->out_len, fmt, ap);
+        va_end(ap);
+    }
+    t->out_len += n;
+}
+
+/* Decimal digits in n, for escape sequence cost estimates */
+static int digits(int n) {
+    int d = 1;
+    while (n >= 10) {
+        n /= 10;
+        d++;
+    }
+    return d;
+}
+
+/* Half-block encoder */
+
+/* Average a square block of framebuffer pixels */
+static uint32_t block_average(const uint32_t *pixels, int stride, int x0, int y0, int size) {
+    uint32_t r = 0, g = 0, b = 0;
+    for (int y = y0; y < y0 + size; y++) {
+        for (int x = x0; x < x0 + size; x++) {
+            uint32_t p = pixels[y * stride + x];
+            r += (p >> 16) & 0xFF;
+            g += (p >> 8) & 0xFF;
+            b += p & 0xFF;
+        }
+    }
+    int n = size * size;
+    return ((r / n) << 16) | ((g / n) << 8) | (b / n);
+}
+
+static int color_moved(uint32_t a, uint32_t b, int threshold) {
+    for (int shift = 0; shift <= 16; shift += 8) {
+        int d = (int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF);
+        if (d > threshold || d < -threshold) return 1;
+    }
+    return 0;
+}
+
+/* Bytes needed to print a cell whose colours are already on screen, -1 if SGR must change */
+static int reprint_cost(const TermOutput *t, uint32_t top, uint32_t bottom) {
+    if (top == bottom) return t->sgr_bg == top ? 1 : -1;
+    return t->sgr_fg == top && t->sgr_bg == bottom ? 3 : -1;
+}
+
+/* Print one cell at the cursor, changing only the SGR attributes that differ */
+static void put_halfblock_cell(TermOutput *t, uint32_t top, uint32_t bottom) {
+    if (top == bottom) {
+        /* A space needs only the background */
+        if (t->sgr_bg != top) {
+            out_printf(t, "\033[48;2;%u;%u;%um", top >> 16, (top >> 8) & 0xFF, top & 0xFF);
+            t->sgr_bg = top;
+        }
+        out_bytes(t, " ", 1);
+    } else {
+        int set_fg = t->sgr_fg != top, set_bg = t->sgr_bg != bottom;
+        if (set_fg && set_bg) {
+            out_printf(t, "\033[38;2;%u;%u;%u;48;2;%u;%u;%um",
+                       top >> 16, (top >> 8) & 0xFF, top & 0xFF,
+                       bottom >> 16, (bottom >> 8) & 0xFF, bottom & 0xFF);
+        } else if (set_fg) {
+            out_printf(t, "\033[38;2;%u;%u;%um", top >> 16, (top >> 8) & 0xFF, top & 0xFF);
+        } else if (set_bg) {
+            out_printf(t, "\033[48;2;%u;%u;%um", bottom >> 16, (bottom >> 8) & 0xFF, bottom & 0xFF);
+        }
+        t->sgr_fg = top;
+        t->sgr_bg = bottom;
+        out_bytes(t, "\xe2\x96\x80", 3);   /* U+2580 UPPER HALF BLOCK */
+    }
+    t->stats.cells_sent++;
+}
+
+/* Get the cursor to (row, col), bridging short same-row gaps by reprinting */
+static void move_to_cell(TermOutput *t, int row, int col) {
+    if (t->cursor_row == row && t->cursor_col == col) return;
+
+    if (t->cursor_row == row && t->cursor_col >= 0 && col > t->cursor_col) {
+        const uint32_t *top = t->screen_top + row * t->cols;
+        const uint32_t *bottom = t->screen_bottom + row * t->cols;
+        int gap = col - t->cursor_col;
+        int move_cost = 3 + digits(gap);
+        int fill_cost = gap <= MAX_GAP_FILL ? 0 : -1;
+
+        for (int c = t->cursor_col; c < col && fill_cost >= 0; c++) {
+            int cost = reprint_cost(t, top[c], bottom[c]);
+            fill_cost = cost < 0 ? -1 : fill_cost + cost;
+        }
+
+        if (fill_cost >= 0 && fill_cost < move_cost) {
+            for (int c = t->cursor_col; c < col; c++) {
+                if (top[c] == bottom[c]) {
+                    out_bytes(t, " ", 1);
+                } else {
+                    out_bytes(t, "\xe2\x96\x80", 3);
+                }
+            }
+        } else {
+            out_printf(t, "\033[%dC", gap);
+        }
+    } else {
+        out_printf(t, "\033[%d;%dH", row + 1, col + 1);
+    }
+    t->cursor_row = row;
+    t->cursor_col = col;
+}
+
+static void encode_halfblock(TermOutput *t, const uint32_t *pixels) {
+    const int ss = HALFBLOCK_SUPERSAMPLE;
+
+    for (int row = 0; row < t->rows; row++) {
+        for (int col = 0; col < t->cols; col++) {
+            uint32_t top = block_average(pixels, t->fb_width, col * ss, row * 2 * ss, ss);
+            uint32_t bottom = block_average(pixels, t->fb_width, col * ss, (row * 2 + 1) * ss, ss);
+            int i = row * t->cols + col;
+
+            if (t->valid && !color_moved(top, t->screen_top[i], t->threshold) &&
+                !color_moved(bottom, t->screen_bottom[i], t->threshold)) {
+                continue;
+            }
+
+            move_to_cell(t, row, col);
+            put_halfblock_cell(t, top, bottom);
+            t->screen_top[i] = top;
+            t->screen_bottom[i] = bottom;
+
+            /* Printing in the last column leaves a pending wrap; don't guess */
+            if (col + 1 < t->cols) {
+                t->cursor_col = col + 1;
+            } else {
+                t->cursor_row = t->cursor_col = -1;
+            }
+        }
+    }
+}
+
+/* Sixel encoder */
+
+static uint8_t sixel_quantize(uint32_t p) {
+    int r = (((p >> 16) & 0xFF) * (SIXEL_LEVELS - 1) + 127) / 255;
+    int g = (((p >> 8) & 0xFF) * (SIXEL_LEVELS - 1) + 127) / 255;
+    int b = ((p & 0xFF) * (SIXEL_LEVELS - 1) + 127) / 255;
+    return (uint8_t)((r * SIXEL_LEVELS + g) * SIXEL_LEVELS + b);
+}
+
+/* Emit a run of one sixel character, run-length encoded when it pays */
+static void sixel_run(TermOutput *t, char c, int count) {
+    if (count <= 0) return;
+    if (count > 3) {
+        out_printf(t, "!%d%c", count, c);
+    } else {
+        for (int i = 0; i < count; i++) out_bytes(t, &c, 1);
+    }
+}
+
+/* Encode framebuffer rows [y0, y0 + height) as one sixel image at the cursor */
+static void sixel_image(TermOutput *t, int y0, int height) {
+    const int w = t->fb_width;
+    const uint8_t *index = t->frame_index;
+    uint8_t used[SIXEL_COLORS];
+
+    memset(used, 0, sizeof(used));
+    for (int y = y0; y < y0 + height; y++) {
+        for (int x = 0; x < w; x++) used[index[y * w + x]] = 1;
+    }
+
+    out_printf(t, "\033P0;1;0q\"1;1;%d;%d", w, height);
+    for (int c = 0; c < SIXEL_COLORS; c++) {
+        if (!used[c]) continue;
+        int r = c / (SIXEL_LEVELS * SIXEL_LEVELS), g = (c / SIXEL_LEVELS) % SIXEL_LEVELS, b = c % SIXEL_LEVELS;
+        out_printf(t, "#%d;2;%d;%d;%d", c,
+                   r * 100 / (SIXEL_LEVELS - 1), g * 100 / (SIXEL_LEVELS - 1), b * 100 / (SIXEL_LEVELS - 1));
+    }
+
+    for (int band = y0; band < y0 + height; band += 6) {
+        int band_rows = y0 + height - band < 6 ? y0 + height - band : 6;
+        int first[SIXEL_COLORS], last[SIXEL_COLORS];
+
+        /* Each colour is only scanned across the columns it appears in */
+        for (int c = 0; c < SIXEL_COLORS; c++) first[c] = -1;
+        for (int k = 0; k < band_rows; k++) {
+            const uint8_t *row = index + (band + k) * w;
+            for (int x = 0; x < w; x++) {
+                int c = row[x];
+                if (first[c] < 0) {
+                    first[c] = last[c] = x;
+                } else {
+                    if (x < first[c]) first[c] = x;
+                    if (x > last[c]) last[c] = x;
+                }
+            }
+        }
+
+        int started = 0;
+        for (int c = 0; c < SIXEL_COLORS; c++) {
+            if (first[c] < 0) continue;
+            if (started) out_bytes(t, "$", 1);
+            started = 1;
+            out_printf(t, "#%d", c);
+            sixel_run(t, '?', first[c]);
+
+            char run_char = 0;
+            int run = 0;
+            for (int x = first[c]; x <= last[c]; x++) {
+                int bits = 0;
+                for (int k = 0; k < band_rows; k++) {
+                    if (index[(band + k) * w + x] == c) bits |= 1 << k;
+                }
+                char ch = (char)('?' + bits);
+                if (ch == run_char) {
+                    run++;
+                } else {
+                    sixel_run(t, run_char, run);
+                    run_char = ch;
+                    run = 1;
+                }
+            }
+            sixel_run(t, run_char, run);
+        }
+        out_bytes(t, "-", 1);
+    }
+    out_bytes(t, "\033\\", 2);
+}
+
+static void encode_sixel(TermOutput *t, const uint32_t *pixels) {
+    const int w = t->fb_width;
+    for (int i = 0; i < w * t->fb_height; i++) {
+        t->frame_index[i] = sixel_quantize(pixels[i]);
+    }
+
+    /* Redraw runs of changed text rows as single images */
+    int row = 0;
+    while (row < t->rows) {
+        size_t offset = (size_t)row * t->cell_h * w;
+        size_t size = (size_t)t->cell_h * w;
+        if (t->valid && memcmp(t->frame_index + offset, t->screen_index + offset, size) == 0) {
+            row++;
+            continue;
+        }
+
+        int end = row + 1;
+        while (end < t->rows) {
+            size_t next = (size_t)end * t->cell_h * w;
+            if (t->valid && memcmp(t->frame_index + next, t->screen_index + next, size) == 0) break;
+            end++;
+        }
+
+        /* Sixel bands are six pixels tall; the overhang repaints current pixels */
+        int y0 = row * t->cell_h;
+        int height = (end - row) * t->cell_h;
+        height = (height + 5) / 6 * 6;
+        if (y0 + height > t->fb_height) height = t->fb_height - y0;
+
+        out_printf(t, "\033[%d;1H", row + 1);
+        sixel_image(t, y0, height);
+        memcpy(t->screen_index + (size_t)y0 * w, t->frame_index + (size_t)y0 * w, (size_t)height * w);
+        t->stats.cells_sent += end - row;
+        row = end;
+    }
+}
+
+/* Public API */
+
+TermOutput *term_output_create(TermMode mode, int cols, int rows,
+                               int cell_w, int cell_h, int threshold) {
+    TermOutput *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+
+    t->mode = mode;
+    t->cols = cols;
+    t->rows = rows;
+    t->cell_w = cell_w;
+    t->cell_h = cell_h;
+    t->threshold = threshold;
+
+    if (mode == TERM_MODE_SIXEL) {
+        t->fb_width = cols * cell_w;
+        t->fb_height = rows * cell_h;
+        t->screen_index = malloc((size_t)t->fb_width * t->fb_height);
+        t->frame_index = malloc((size_t)t->fb_width * t->fb_height);
+        if (!t->screen_index || !t->frame_index) goto fail;
+    } else {
+        t->fb_width = cols * HALFBLOCK_SUPERSAMPLE;
+        t->fb_height = rows * 2 * HALFBLOCK_SUPERSAMPLE;
+        t->screen_top = malloc((size_t)cols * rows * sizeof(uint32_t));
+        t->screen_bottom = malloc((size_t)cols * rows * sizeof(uint32_t));
+        if (!t->screen_top || !t->screen_bottom) goto fail;
+    }
+    return t;
+
+fail:
+    term_output_destroy(t);
+    return NULL;
+}
+
+void term_output_fb_size(const TermOutput *t, int *width, int *height) {
+    *width = t->fb_width;
+    *height = t->fb_height;
+}
+
+size_t term_output_encode(TermOutput *t, const uint32_t *pixels, const char **data) {
+    t->out_len = 0;
+
+    /* Whatever ran between frames may have moved the cursor or changed colours */
+    t->cursor_row = t->cursor_col = -1;
+    t->sgr_fg = t->sgr_bg = -1;
+
+    if (t->mode == TERM_MODE_SIXEL) {
+        encode_sixel(t, pixels);
+    } else {
+        encode_halfblock(t, pixels);
+        if (t->out_len) out_bytes(t, "\033[0m", 4);
+    }
+
+    if (!t->valid) {
+        t->stats.first_frame_bytes = t->out_len;
+    } else if (t->out_len > t->stats.max_frame_bytes) {
+        t->stats.max_frame_bytes = t->out_len;
+    }
+    t->valid = 1;
+    t->stats.frames++;
+    t->stats.bytes += t->out_len;
+
+    *data = t->out;
+    return t->out_len;
+}
+
+void term_output_invalidate(TermOutput *t) {
+    t->valid = 0;
+}
+
+void term_output_stats(const TermOutput *t, TermStats *stats) {
+    *stats = t->stats;
+}
+
+void term_output_destroy(TermOutput *t) {
+    if (!t) return;
+    free(t->screen_top);
+    free(t->screen_bottom);
+    free(t->screen_index);
+    free(t->frame_index);
+    free(t->out);
+    free(t);
+}
+
+int term_detect_sixel(int in_fd, int out_fd, int timeout_ms) {
+    struct termios saved, raw;
+    if (tcgetattr(in_fd, &saved) < 0) return 0;
+
+    raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(in_fd, TCSANOW, &raw);
+
+    /* Reply looks like ESC [ ? 62 ; 4 ; 22 c, where 4 means sixel */
+    char reply[128];
+    size_t len = 0;
+    int sixel = 0;
+    if (write(out_fd, "\033[c", 3) == 3) {
+        struct pollfd pfd = { .fd = in_fd, .events = POLLIN };
+        while (len < sizeof(reply) - 1 && poll(&pfd, 1, timeout_ms) > 0) {
+            ssize_t n = read(in_fd, reply + len, sizeof(reply) - 1 - len);
+            if (n <= 0) break;
+            len += n;
+            if (memchr(reply, 'c', len)) break;
+        }
+        reply[len] = '\0';
+
+        char *params = strstr(reply, "\033[?");
+        if (params) {
+            for (char *p = strtok(params + 3, ";c"); p; p = strtok(NULL, ";c")) {
+                if (strcmp(p, "4") == 0) sixel = 1;
+            }
+        }
+    }
+
+    tcsetattr(in_fd, TCSANOW, &saved);
+    return sixel;
+}
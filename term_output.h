@@ -0,0 +1,53 @@
+/**
+ * Terminal Output - draw frames as character cells over a plain tty
+ * Half-block mode packs two pixels into each cell ("▀" with truecolor
+ * foreground and background); sixel mode sends real pixels to terminals
+ * that understand DEC sixel graphics. Either way only what changed since
+ * the previous frame is written, so a static scene costs almost nothing.
+ */
+
+#ifndef TERM_OUTPUT_H
+#define TERM_OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    TERM_MODE_HALFBLOCK,
+    TERM_MODE_SIXEL
+} TermMode;
+
+typedef struct TermOutput TermOutput;
+
+typedef struct {
+    uint32_t frames;
+    uint64_t bytes;           /* Everything encode() returned */
+    uint64_t first_frame_bytes;
+    uint64_t max_frame_bytes; /* Excluding the first, full frame */
+    uint64_t cells_sent;      /* Half-block cells or sixel cell rows redrawn */
+} TermStats;
+
+/*
+ * cols x rows text cells; cell_w x cell_h is the pixel size of a cell and
+ * only matters for sixel. Half-block cells are re-sent only when a channel
+ * moved by more than threshold, which keeps texture noise off the wire.
+ */
+TermOutput *term_output_create(TermMode mode, int cols, int rows,
+                               int cell_w, int cell_h, int threshold);
+
+/* Framebuffer size to render for this output */
+void term_output_fb_size(const TermOutput *term, int *width, int *height);
+
+/* Encode the changes from the previous frame; *data is valid until the next call */
+size_t term_output_encode(TermOutput *term, const uint32_t *pixels, const char **data);
+
+/* Forget what is on screen so the next frame is sent in full */
+void term_output_invalidate(TermOutput *term);
+
+void term_output_stats(const TermOutput *term, TermStats *stats);
+void term_output_destroy(TermOutput *term);
+
+/* Ask the terminal (primary device attributes) whether it speaks sixel */
+int term_detect_sixel(int in_fd, int out_fd, int timeout_ms);
+
+#endif /* TERM_OUTPUT_H */
@@ -0,0 +1,210 @@
+/**
+ * Trace - frame timeline in Chrome trace event format
+ * See trace.h. Rings are single-producer single-consumer: the owning
+ * thread advances head, the flusher advances tail. A full ring drops the
+ * event and counts it instead of waiting. Rings are registered on a
+ * lock-free list the first time a thread records and live until close.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+#define TRACE_RING_SIZE 16384              /* Events per thread, power of two */
+#define TRACE_FLUSH_INTERVAL_NS 50000000   /* Flusher wakes every 50 ms */
+#define TRACE_INSTANT UINT64_MAX
+
+typedef struct {
+    const char *name;
+    uint64_t ts_ns;
+    uint64_t dur_ns;           /* TRACE_INSTANT for instant events */
+    int64_t arg;
+} TraceEvent;
+
+typedef struct TraceRing {
+    TraceEvent events[TRACE_RING_SIZE];
+    uint32_t head;             /* Written by the owning thread */
+    uint32_t tail;             /* Written by the flusher */
+    uint32_t dropped;
+    pid_t tid;
+    char thread_name[32];
+    struct TraceRing *next;
+} TraceRing;
+
+int trace_enabled = 0;
+
+static FILE *trace_file = NULL;
+static TraceRing *rings = NULL;            /* Lock-free push-only list */
+static __thread TraceRing *local_ring = NULL;
+static pthread_t flusher;
+static int flusher_running = 0;
+static int flusher_stop = 0;
+static int first_event = 1;                /* No comma before the first event */
+static uint64_t base_ns = 0;               /* Timestamps are relative to trace_open */
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static TraceRing *get_ring(void) {
+    if (local_ring) return local_ring;
+
+    TraceRing *ring = calloc(1, sizeof(*ring));
+    if (!ring) return NULL;
+    ring->tid = (pid_t)syscall(SYS_gettid);
+
+    TraceRing *head = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    do {
+        ring->next = head;
+    } while (!__atomic_compare_exchange_n(&rings, &head, ring, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    local_ring = ring;
+    return ring;
+}
+
+static void record(const char *name, uint64_t ts, uint64_t dur, int64_t arg) {
+    TraceRing *ring = get_ring();
+    if (!ring) return;
+
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= TRACE_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+
+    TraceEvent *e = &ring->events[head & (TRACE_RING_SIZE - 1)];
+    e->name = name;
+    e->ts_ns = ts;
+    e->dur_ns = dur;
+    e->arg = arg;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_span(const char *name, uint64_t start_ns, int64_t arg) {
+    if (!trace_enabled) return;
+    record(name, start_ns, trace_now() - start_ns, arg);
+}
+
+void trace_instant(const char *name, int64_t arg) {
+    if (!trace_enabled) return;
+    record(name, trace_now(), TRACE_INSTANT, arg);
+}
+
+void trace_thread_name(const char *name) {
+    if (!trace_enabled) return;
+    TraceRing *ring = get_ring();
+    if (ring) snprintf(ring->thread_name, sizeof(ring->thread_name), "%s", name);
+}
+
+/* Write everything recorded so far; only the flusher (or close) calls this */
+static void drain_rings(void) {
+    pid_t pid = getpid();
+
+    for (TraceRing *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint32_t tail = ring->tail;
+
+        for (; tail != head; tail++) {
+            const TraceEvent *e = &ring->events[tail & (TRACE_RING_SIZE - 1)];
+            double ts = (e->ts_ns - base_ns) / 1e3;
+
+            fputs(first_event ? "\n" : ",\n", trace_file);
+            first_event = 0;
+            if (e->dur_ns == TRACE_INSTANT) {
+                fprintf(trace_file, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+                        e->name, ts, pid, ring->tid);
+            } else {
+                fprintf(trace_file, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+                        e->name, ts, e->dur_ns / 1e3, pid, ring->tid);
+            }
+            if (e->arg != TRACE_NO_ARG) {
+                fprintf(trace_file, ",\"args\":{\"n\":%lld}", (long long)e->arg);
+            }
+            fputc('}', trace_file);
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+static void *flusher_main(void *arg) {
+    trace_thread_name("trace-flush");
+    while (!__atomic_load_n(&flusher_stop, __ATOMIC_ACQUIRE)) {
+        struct timespec interval = { 0, TRACE_FLUSH_INTERVAL_NS };
+        nanosleep(&interval, NULL);
+        drain_rings();
+    }
+    return NULL;
+}
+
+/* Forked children (frame farm workers) have no flusher; don't fill rings nobody drains */
+static void disable_in_child(void) {
+    trace_enabled = 0;
+    trace_file = NULL;
+}
+
+int trace_open(const char *path) {
+    trace_file = fopen(path, "w");
+    if (!trace_file) {
+        perror(path);
+        return -1;
+    }
+    fputs("{\"traceEvents\":[", trace_file);
+
+    base_ns = trace_now();
+    trace_enabled = 1;
+    pthread_atfork(NULL, NULL, disable_in_child);
+
+    if (pthread_create(&flusher, NULL, flusher_main, NULL) == 0) {
+        flusher_running = 1;
+    }
+    return 0;
+}
+
+void trace_close(void) {
+    if (!trace_file) return;
+
+    trace_enabled = 0;
+    if (flusher_running) {
+        __atomic_store_n(&flusher_stop, 1, __ATOMIC_RELEASE);
+        pthread_join(flusher, NULL);
+        flusher_running = 0;
+    }
+    drain_rings();
+
+    /* Thread names, and how much was lost to full rings */
+    pid_t pid = getpid();
+    uint32_t dropped = 0;
+    for (TraceRing *ring = rings; ring; ring = ring->next) {
+        if (ring->thread_name[0]) {
+            fprintf(trace_file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"name\":\"%s\"}}", first_event ? "" : ",", pid, ring->tid, ring->thread_name);
+            first_event = 0;
+        }
+        dropped += ring->dropped;
+    }
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", trace_file);
+    fclose(trace_file);
+    trace_file = NULL;
+
+    if (dropped) {
+        fprintf(stderr, "trace: %u events dropped (ring full)\n", dropped);
+    }
+
+    TraceRing *ring = rings;
+    rings = NULL;
+    while (ring) {
+        TraceRing *next = ring->next;
+        free(ring);
+        ring = next;
+    }
+}
@@ -0,0 +1,37 @@
+/**
+ * Trace - frame timeline in Chrome trace event format
+ * Each thread records into its own fixed-size ring without locks or
+ * syscalls; a background thread drains the rings into a JSON file that
+ * chrome://tracing and ui.perfetto.dev open directly. Event names must
+ * be string literals: only the pointer is recorded.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_NO_ARG INT64_MIN
+
+/* Non-zero between trace_open() and trace_close() */
+extern int trace_enabled;
+
+/* Start tracing to path and the flusher thread; 0 on success */
+int trace_open(const char *path);
+
+/* Stop the flusher, write out what is left and close the file */
+void trace_close(void);
+
+/* Label the calling thread in the trace viewer */
+void trace_thread_name(const char *name);
+
+/* CLOCK_MONOTONIC in nanoseconds, the trace time base */
+uint64_t trace_now(void);
+
+/* Record a span from start_ns until now; arg shows up as "n" (TRACE_NO_ARG for none) */
+void trace_span(const char *name, uint64_t start_ns, int64_t arg);
+
+/* Record a point in time */
+void trace_instant(const char *name, int64_t arg);
+
+#endif /* TRACE_H */
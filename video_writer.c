@@ -0,0 +1,298 @@
+/**
+ * Video Writer - asynchronous Y4M / raw BGRA frame sink
+ * See video_writer.h. One mutex guards slot state; conversion and I/O run
+ * on the writer thread with the lock released.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "video_writer.h"
+#include "trace.h"
+
+#define SLOT_ALIGN 64
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_RENDERING,
+    SLOT_QUEUED
+} SlotState;
+
+typedef struct {
+    uint32_t *pixels;
+    SlotState state;
+    uint32_t index;
+} Slot;
+
+struct VideoWriter {
+    FILE *out;
+    int owns_out;
+    VideoFormat format;
+    int width, height;
+
+    Slot *slots;
+    int depth;
+    uint32_t next_index;       /* Next frame the writer emits */
+
+    pthread_mutex_t lock;
+    pthread_cond_t slot_free;
+    pthread_cond_t frame_ready;
+    pthread_t thread;
+    int closing;
+    int failed;
+
+    uint8_t *i420;             /* Conversion scratch, writer thread only */
+    VideoWriterStats stats;
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static size_t frame_bytes(const VideoWriter *w) {
+    return (size_t)w->width * w->height * 4;
+}
+
+static size_t i420_bytes(const VideoWriter *w) {
+    size_t cw = (w->width + 1) / 2, ch = (w->height + 1) / 2;
+    return (size_t)w->width * w->height + 2 * cw * ch;
+}
+
+/*
+ * ARGB to I420, BT.601 limited range. Two source rows per pass; chroma is
+ * the average of each 2x2 block, clamped at odd edges.
+ */
+static void argb_to_i420(const uint32_t *src, int width, int height, uint8_t *dst) {
+    int cw = (width + 1) / 2;
+    uint8_t *y_plane = dst;
+    uint8_t *u_plane = dst + (size_t)width * height;
+    uint8_t *v_plane = u_plane + (size_t)cw * ((height + 1) / 2);
+
+    for (int y = 0; y < height; y += 2) {
+        const uint32_t *row0 = src + (size_t)y * width;
+        const uint32_t *row1 = y + 1 < height ? row0 + width : row0;
+        uint8_t *y0 = y_plane + (size_t)y * width;
+        uint8_t *y1 = y + 1 < height ? y0 + width : NULL;
+        uint8_t *u = u_plane + (size_t)(y / 2) * cw;
+        uint8_t *v = v_plane + (size_t)(y / 2) * cw;
+
+        for (int x = 0; x < width; x += 2) {
+            int x1 = x + 1 < width ? x + 1 : x;
+            uint32_t p[4] = { row0[x], row0[x1], row1[x], row1[x1] };
+            int rs = 0, gs = 0, bs = 0;
+
+            for (int i = 0; i < 4; i++) {
+                int r = (p[i] >> 16) & 0xFF;
+                int g = (p[i] >> 8) & 0xFF;
+                int b = p[i] & 0xFF;
+                rs += r; gs += g; bs += b;
+
+                uint8_t luma = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                if (i == 0) y0[x] = luma;
+                else if (i == 1 && x1 != x) y0[x1] = luma;
+                else if (i == 2 && y1) y1[x] = luma;
+                else if (i == 3 && y1 && x1 != x) y1[x1] = luma;
+            }
+
+            int r = (rs + 2) >> 2, g = (gs + 2) >> 2, b = (bs + 2) >> 2;
+            u[x / 2] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            v[x / 2] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+}
+
+/* Convert and write one frame; runs without the lock held */
+static int write_frame(VideoWriter *w, const uint32_t *pixels) {
+    if (w->format == VIDEO_FORMAT_RAW) {
+        if (fwrite(pixels, frame_bytes(w), 1, w->out) != 1) return -1;
+        w->stats.bytes += frame_bytes(w);
+        return 0;
+    }
+
+    argb_to_i420(pixels, w->width, w->height, w->i420);
+    if (fputs("FRAME\n", w->out) == EOF) return -1;
+    if (fwrite(w->i420, i420_bytes(w), 1, w->out) != 1) return -1;
+    w->stats.bytes += 6 + i420_bytes(w);
+    return 0;
+}
+
+static Slot *find_queued(VideoWriter *w, uint32_t index) {
+    for (int i = 0; i < w->depth; i++) {
+        if (w->slots[i].state == SLOT_QUEUED && w->slots[i].index == index) {
+            return &w->slots[i];
+        }
+    }
+    return NULL;
+}
+
+static int any_rendering(VideoWriter *w) {
+    for (int i = 0; i < w->depth; i++) {
+        if (w->slots[i].state == SLOT_RENDERING) return 1;
+    }
+    return 0;
+}
+
+/* Writer thread: emit frames strictly in index order */
+static void *writer_main(void *arg) {
+    VideoWriter *w = arg;
+
+    trace_thread_name("video-writer");
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        Slot *slot = find_queued(w, w->next_index);
+        if (!slot) {
+            /* Done once closing and nothing that could fill the gap is in flight */
+            if (w->closing && !any_rendering(w)) break;
+            pthread_cond_wait(&w->frame_ready, &w->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&w->lock);
+
+        uint64_t start = trace_now();
+        int ret = write_frame(w, slot->pixels);
+        trace_span("write_frame", start, w->next_index);
+
+        pthread_mutex_lock(&w->lock);
+        slot->state = SLOT_FREE;
+        trace_instant("buffer_release", w->next_index);
+        pthread_cond_broadcast(&w->slot_free);
+        if (ret < 0) {
+            perror("video writer");
+            w->failed = 1;
+            break;
+        }
+        w->next_index++;
+        w->stats.frames++;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+VideoWriter *video_writer_open(const char *path, VideoFormat format,
+                               int width, int height, int fps, int depth) {
+    VideoWriter *w = calloc(1, sizeof(*w));
+    if (!w) return NULL;
+
+    w->format = format;
+    w->width = width;
+    w->height = height;
+    w->depth = depth;
+
+    if (strcmp(path, "-") == 0) {
+        w->out = stdout;
+    } else {
+        w->out = fopen(path, "wb");
+        w->owns_out = 1;
+    }
+    if (!w->out) {
+        perror(path);
+        free(w);
+        return NULL;
+    }
+    setvbuf(w->out, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
+    w->slots = calloc(depth, sizeof(Slot));
+    if (format == VIDEO_FORMAT_Y4M) w->i420 = malloc(i420_bytes(w));
+    if (!w->slots || (format == VIDEO_FORMAT_Y4M && !w->i420)) goto fail;
+
+    size_t slot_size = (frame_bytes(w) + SLOT_ALIGN - 1) & ~(size_t)(SLOT_ALIGN - 1);
+    for (int i = 0; i < depth; i++) {
+        w->slots[i].pixels = aligned_alloc(SLOT_ALIGN, slot_size);
+        if (!w->slots[i].pixels) goto fail;
+    }
+
+    if (format == VIDEO_FORMAT_Y4M) {
+        int len = fprintf(w->out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n",
+                          width, height, fps);
+        if (len < 0) goto fail;
+        w->stats.bytes += len;
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->slot_free, NULL);
+    pthread_cond_init(&w->frame_ready, NULL);
+    if (pthread_create(&w->thread, NULL, writer_main, w) != 0) {
+        fprintf(stderr, "video writer: cannot start thread\n");
+        goto fail;
+    }
+
+    return w;
+
+fail:
+    if (w->slots) {
+        for (int i = 0; i < depth; i++) free(w->slots[i].pixels);
+    }
+    free(w->slots);
+    free(w->i420);
+    if (w->owns_out) fclose(w->out);
+    free(w);
+    return NULL;
+}
+
+uint32_t *video_writer_acquire(VideoWriter *w) {
+    uint64_t start = 0;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        if (w->failed) {
+            pthread_mutex_unlock(&w->lock);
+            return NULL;
+        }
+        for (int i = 0; i < w->depth; i++) {
+            if (w->slots[i].state == SLOT_FREE) {
+                w->slots[i].state = SLOT_RENDERING;
+                if (start) w->stats.producer_wait_ns += monotonic_ns() - start;
+                pthread_mutex_unlock(&w->lock);
+                return w->slots[i].pixels;
+            }
+        }
+        if (!start) start = monotonic_ns();
+        pthread_cond_wait(&w->slot_free, &w->lock);
+    }
+}
+
+void video_writer_submit(VideoWriter *w, uint32_t *frame, uint32_t index) {
+    pthread_mutex_lock(&w->lock);
+    for (int i = 0; i < w->depth; i++) {
+        if (w->slots[i].pixels == frame) {
+            w->slots[i].index = index;
+            w->slots[i].state = SLOT_QUEUED;
+            break;
+        }
+    }
+    pthread_cond_signal(&w->frame_ready);
+    pthread_mutex_unlock(&w->lock);
+}
+
+int video_writer_close(VideoWriter *w, VideoWriterStats *stats) {
+    pthread_mutex_lock(&w->lock);
+    w->closing = 1;
+    pthread_cond_signal(&w->frame_ready);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    int failed = w->failed;
+    if (fflush(w->out) == EOF) failed = 1;
+    if (w->owns_out && fclose(w->out) == EOF) failed = 1;
+
+    if (stats) *stats = w->stats;
+
+    pthread_cond_destroy(&w->frame_ready);
+    pthread_cond_destroy(&w->slot_free);
+    pthread_mutex_destroy(&w->lock);
+    for (int i = 0; i < w->depth; i++) free(w->slots[i].pixels);
+    free(w->slots);
+    free(w->i420);
+    free(w);
+
+    return failed ? -1 : 0;
+}
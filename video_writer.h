@@ -0,0 +1,40 @@
+/**
+ * Video Writer - asynchronous Y4M / raw BGRA frame sink
+ * Frames are rendered straight into slots owned by the writer and handed
+ * back through a bounded queue; a writer thread converts and streams them
+ * to a file or pipe in frame-index order, so the renderer never waits on
+ * I/O unless every slot is still queued.
+ */
+
+#ifndef VIDEO_WRITER_H
+#define VIDEO_WRITER_H
+
+#include <stdint.h>
+
+typedef enum {
+    VIDEO_FORMAT_Y4M,     /* YUV4MPEG2, 8-bit 4:2:0, BT.601 limited range */
+    VIDEO_FORMAT_RAW      /* Packed BGRA, exactly as rendered */
+} VideoFormat;
+
+typedef struct VideoWriter VideoWriter;
+
+typedef struct {
+    uint32_t frames;          /* Frames written */
+    uint64_t bytes;           /* Bytes written, headers included */
+    uint64_t producer_wait_ns; /* Time acquire() spent blocked on a full queue */
+} VideoWriterStats;
+
+/* Open path ("-" for stdout) and start the writer thread; NULL on error */
+VideoWriter *video_writer_open(const char *path, VideoFormat format,
+                               int width, int height, int fps, int depth);
+
+/* Borrow a free slot to render into; blocks while the queue is full, NULL after a write error */
+uint32_t *video_writer_acquire(VideoWriter *writer);
+
+/* Queue a rendered slot; frames are written in index order starting at 0 */
+void video_writer_submit(VideoWriter *writer, uint32_t *frame, uint32_t index);
+
+/* Drain the queue, stop the thread and close the output; 0 if everything was written */
+int video_writer_close(VideoWriter *writer, VideoWriterStats *stats);
+
+#endif /* VIDEO_WRITER_H */
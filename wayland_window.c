@@ -18,12 +18,34 @@
 #include <time.h>
 #include <math.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 
-/* Include XDG shell protocol header */
+/* Include XDG shell and presentation-time protocol headers */
 #include "xdg-shell-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#include "video_writer.h"
+#include "frame_farm.h"
+#include "frame_ring.h"
+#include "term_output.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "lut.h"
+#include "sprite_atlas.h"
+#include "bloom.h"
+#include "row_pool.h"
+#include "mesh.h"
+#include "light_grid.h"
+#include "wind.h"
+#include "control.h"
 
-/* Window dimensions */
+/* Window dimensions; also the size the scene is laid out in */
 #define WIDTH 800
 #define HEIGHT 600
 #define STRIDE (WIDTH * 4)
@@ -40,12 +62,166 @@ static struct xdg_surface *xdg_surface = NULL;
 static struct xdg_toplevel *xdg_toplevel = NULL;
 static struct wl_buffer *buffer = NULL;
 static uint32_t *shm_data = NULL;
-static int running = 1;
+static int shm_fd = -1;
+static volatile sig_atomic_t running = 1;
 static int configured = 0;
 
-/* Animation state */
-static uint32_t frame_count = 0;
-static double random_seed = 12345.6789;
+/*
+ * Render target; the shm buffer in a window, a queue slot when exporting.
+ * Per thread, like the simulation state, so export workers can render
+ * different frames at the same time.
+ */
+static __thread uint32_t *pixels = NULL;
+static __thread int fb_width = WIDTH;
+static __thread int fb_height = HEIGHT;
+
+/*
+ * Pixel accounting: every primitive counts what it writes and blends. With
+ * --overdraw each thread also keeps a per-pixel write count for the target,
+ * which replaces the scene as a heatmap at the end of the frame.
+ */
+static __thread struct {
+    uint64_t written;
+    uint64_t blended;
+} pixel_count;
+static __thread uint8_t *overdraw = NULL;
+static __thread size_t overdraw_size = 0;
+
+/* Scene space is the WIDTH x HEIGHT layout scaled to the target height */
+static __thread float scene_scale = 1.0f;
+static __thread float scene_left = 0.0f;     /* Scene x at the target's left edge */
+static __thread float scene_right = WIDTH;   /* Scene x at the target's right edge */
+
+/* Presentation feedback (wp_presentation is optional) */
+static struct wp_presentation *presentation = NULL;
+static clockid_t presentation_clock = CLOCK_MONOTONIC;
+
+/* Late-latching frame scheduler */
+#define NSEC_PER_SEC 1000000000ull
+#define LATCH_MARGIN_MIN_NS 1000000ull    /* Never aim closer than 1ms to vblank */
+#define LATCH_MARGIN_INIT_NS 3000000ull   /* Compositor latch guess before feedback */
+#define LATCH_MARGIN_STEP_NS 1000000ull   /* Back off this much after a miss */
+
+static int timer_fd = -1;
+static int timer_armed = 0;
+static uint64_t scheduled_target_ns = 0; /* Vblank the armed timer renders for, if known */
+static uint64_t frame_period_ns = 0;     /* Frame rate cap from --control; 0 for none */
+static uint64_t last_render_ns = 0;
+static uint64_t last_present_ns = 0;
+static uint64_t refresh_ns = 0;
+static uint64_t render_ewma_ns = 0;
+static uint64_t latch_margin_ns = LATCH_MARGIN_INIT_NS;
+
+/* Per-commit feedback record, owned by its wp_presentation_feedback */
+typedef struct {
+    uint64_t start_ns;   /* When update/render began */
+    uint64_t target_ns;  /* Predicted vblank, 0 if unknown */
+    uint32_t epoch;      /* present_epoch at commit */
+    int first;           /* First frame after startup */
+} FrameFeedback;
+
+/* Visibility tracking: hidden windows neither simulate nor render */
+#define IDLE_TIMEOUT_NS 250000000ull  /* Callback starved this long means occluded */
+
+static struct wl_callback *frame_callback = NULL; /* Outstanding frame request */
+static uint64_t last_commit_ns = 0;
+static int suspended = 0;      /* xdg_toplevel "suspended" state */
+static int activated = 0;      /* xdg_toplevel "activated" state */
+static int idle = 0;           /* Rendering parked until visible again */
+static int wake_on_configure = 0; /* Unsuspended or refocused since last configure */
+static uint32_t present_epoch = 0; /* Bumped on resume; older feedback is stale */
+
+/* Per-frame instrumentation (--stats) */
+static int stats_mode = 0;
+
+/* Hardware counters around each render pass (--perf) */
+static int perf_mode = 0;
+
+/* Show how often each pixel was drawn instead of the scene (--overdraw) */
+static int overdraw_mode = 0;
+
+/* Frame timeline for chrome://tracing or Perfetto (--trace) */
+static const char *trace_path = NULL;
+
+/* Offline export (--export); animation advances SIM_RATE ticks per second of video */
+#define SIM_RATE 60
+#define EXPORT_QUEUE_DEPTH 4
+
+static const char *export_path = NULL;
+static VideoFormat export_format = VIDEO_FORMAT_Y4M;
+static int export_format_set = 0;
+static int export_frames = 300;
+static int export_width = WIDTH;
+static int export_height = HEIGHT;
+static int export_fps = 60;
+static int export_start = 0;       /* First frame, in export frames from the origin */
+static int export_jobs = 0;        /* Render threads; 0 means one per CPU */
+static int export_farm = 0;        /* Worker processes; 0 renders in-process */
+
+#define FARM_RANGE_FRAMES 8
+
+/* Helper threads for the bloom pass outside exports */
+#define ROW_POOL_HELPERS 3
+#define ROW_POOL_MAX_JOBS 16           /* Live --control limit, the caller included */
+
+/* Terminal output (--terminal); --frames and --fps apply when given */
+#define TERM_DEFAULT_FPS 30
+#define TERM_CHANGE_THRESHOLD 6        /* Per-channel change that gets a cell re-sent */
+#define TERM_DETECT_TIMEOUT_MS 200
+static int terminal_output = 0;
+static int terminal_sixel = -1;        /* -1 asks the terminal */
+static int terminal_threshold = TERM_CHANGE_THRESHOLD;
+static int frames_set = 0;
+static int fps_set = 0;
+static volatile sig_atomic_t terminal_resized = 0;
+
+/* Shared-memory frame publishing (--publish) */
+#define FRAME_RING_SLOTS 3
+static const char *publish_path = NULL;
+static FrameRing *frame_ring = NULL;
+
+/* Live load parameters (--control) */
+#define CONTROL_MAX_FPS 1000
+static const char *control_path = NULL;
+static Control *control = NULL;
+
+/*
+ * Counters for the commit-to-commit interval; reset after each report.
+ * Apart from the --perf counter reads, which are left out, rendering makes
+ * no syscalls, so counting at the event loop's call sites is exact: poll,
+ * sendmsg per non-empty flush, recvmsg per read_events and read/settime on
+ * the frame timer. clock_gettime goes through the vDSO.
+ */
+static struct {
+    uint32_t polls;
+    uint32_t flushes;
+    uint32_t sends;                /* Flushes that reached sendmsg */
+    uint32_t reads;                /* wl_display_read_events calls */
+    uint32_t timer_ops;            /* timerfd read/settime calls */
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+} frame_io;
+
+static struct {
+    uint32_t frames;
+    uint64_t syscalls;
+    uint64_t flushes;
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+} io_totals;
+
+static struct {
+    uint32_t presented;
+    uint32_t missed;
+    uint32_t discarded;
+    uint32_t latency_samples;
+    uint64_t latency_sum_ns;
+    uint64_t latency_max_ns;
+} present_stats;
+
+/* Startup timing on CLOCK_MONOTONIC, measured from entering main() */
+static uint64_t startup_ns = 0;
+static uint64_t first_commit_ns = 0;
 
 /* Snowflake structure */
 typedef struct {
@@ -55,8 +231,29 @@ typedef struct {
     int size;
 } Snowflake;
 
-#define MAX_SNOWFLAKES 80
-static Snowflake snowflakes[MAX_SNOWFLAKES];
+#define MAX_SNOWFLAKES 4096            /* With --control; the rest of the time DEFAULT_SNOWFLAKES */
+#define DEFAULT_SNOWFLAKES 80
+#define SNOW_BATCH 256                 /* Flakes stepped or drawn per batch */
+
+/*
+ * Snow that lands stays. Each scene column of the snow's span keeps how
+ * deep the snow lying in it is, on whatever a flake falling down that
+ * column meets first: the flat tree's outline, or the ground. A landing
+ * changes at most SNOW_SPREAD columns either side and is logged, so a
+ * thread's cached drifts only redraw the columns landings touched.
+ */
+#define MAX_SNOW_COLUMNS 8192          /* Scene pixels of width */
+#define SNOW_UNITS 4                   /* Depth units per scene pixel */
+#define SNOW_GROUND_DEPTH (10 * SNOW_UNITS)
+#define SNOW_BRANCH_DEPTH (3 * SNOW_UNITS)
+#define SNOW_STEP (SNOW_UNITS / 2)     /* Steepest a drift stays between columns */
+#define SNOW_SPREAD 2
+#define SNOW_LOG 64                    /* Landings remembered */
+
+/* Per column, where snow comes to rest and how deep it can get; set by sim_init */
+static int snow_columns = 0;
+static float snow_floor[MAX_SNOW_COLUMNS];
+static uint8_t snow_capacity[MAX_SNOW_COLUMNS];
 
 /* Light structure */
 typedef struct {
@@ -66,7 +263,11 @@ typedef struct {
     int phase;
 } TreeLight;
 
-#define MAX_LIGHTS 50
+#define MAX_LIGHTS 5000
+#define DEFAULT_LIGHTS 50
+#define LIGHT_DRAWS 4                  /* Random numbers init_lights takes per light */
+#define LIGHT_BATCH 256                /* Lights drawn per batch */
+static int num_lights = DEFAULT_LIGHTS;
 static TreeLight lights[MAX_LIGHTS];
 
 /* Ornament structure */
@@ -80,6 +281,153 @@ typedef struct {
 #define MAX_ORNAMENTS 15
 static Ornament ornaments[MAX_ORNAMENTS];
 
+/* Background star field */
+#define NUM_SKY_STARS 100
+static struct {
+    int x, y;
+    Phase phase;               /* Twinkle offset */
+} sky_stars[NUM_SKY_STARS];
+
+/* Animation rates, in phase per simulation tick */
+#define TWINKLE_STEP RADIANS_TO_PHASE(0.1)
+#define STAR_PULSE_STEP RADIANS_TO_PHASE(0.15)
+#define LIGHT_BLINK_STEP RADIANS_TO_PHASE(0.2)
+#define LIGHT_PHASE_STEP RADIANS_TO_PHASE(0.1)   /* Per unit of TreeLight.phase */
+#define TREE_SPIN_STEP RADIANS_TO_PHASE(0.005)
+
+/* Shading curves, tabulated by init_scene() */
+static PowLut pow_half;        /* x^0.5 */
+static PowLut pow_rim;         /* x^0.3, sphere edge darkening */
+static PowLut pow_specular;    /* x^20 */
+
+/* Tree silhouette in scene coordinates: overlapping triangles over a trunk */
+#define TREE_CENTER_X 400
+#define TRUNK_TOP 480
+#define TRUNK_BOTTOM 530
+#define TRUNK_HALF_WIDTH 25
+#define GROUND_TOP 520
+
+static const struct {
+    int top_y, bottom_y, width;
+} TREE_LAYERS[] = {
+    {120, 250, 70},
+    {180, 330, 110},
+    {260, 410, 150},
+    {340, 500, 190}
+};
+#define NUM_TREE_LAYERS (sizeof(TREE_LAYERS) / sizeof(TREE_LAYERS[0]))
+#define TREE_TOP 120                   /* TREE_LAYERS[0].top_y */
+#define TREE_HALF_WIDTH 190            /* Widest layer */
+
+/* Needles from shadow to sunlit, and the snow on the ground */
+#define TREE_DARK_COLOR 0xFF0d5016
+#define TREE_LIGHT_COLOR 0xFF1a8a2e
+#define TREE_HIGHLIGHT_COLOR 0xFF2ecc40
+#define SNOW_WHITE_COLOR 0xFFF0F8FF
+#define SNOW_SHADOW_COLOR 0xFFD0E0F0   /* Slight blue shadow */
+
+/*
+ * Background forest (--forest N): undecorated instances of the same tree,
+ * all behind the decorated one and sorted far to near once at startup.
+ * x is a fraction of the scene width, so the forest spreads over however
+ * wide the target is; base_y is the scene y of the trunk's foot.
+ */
+#define MAX_FOREST_TREES 1000
+#define FOREST_SEED 24680
+#define FOREST_MAX_SCALE 0.58f
+
+typedef struct {
+    float x;
+    float base_y;
+    float scale;               /* Size relative to the decorated tree */
+    float depth;               /* Distance; the decorated tree is at 1 */
+} TreeInstance;
+
+static int forest_size = 0;
+static TreeInstance forest[MAX_FOREST_TREES];
+
+/*
+ * The tree as a mesh (--rotate): each of TREE_LAYERS becomes a cone whose
+ * rim zigzags out into branch tips, closed underneath, over a cylinder
+ * for the trunk. Model space is scene units around the tree's axis with y
+ * down as in the scene. The camera is placed so that the plane through
+ * the axis facing it lines up with the flat tree; the tree spins.
+ */
+#define TREE_MESH_SEGMENTS 48          /* Around each layer; even, tips and notches alternate */
+#define TREE_MESH_RINGS 10             /* Apex to rim */
+#define TRUNK_MESH_SEGMENTS 16
+#define BRANCH_NOTCH 0.82f             /* Rim radius between tips */
+#define BRANCH_DROOP 6.0f              /* How much lower tips hang at the rim */
+#define MESH_SEED 13579
+#define MESH_CAMERA_DISTANCE 1600.0f   /* From the axis */
+#define MESH_CAMERA_Y 330.0f           /* Eye height */
+#define MESH_AMBIENT 0.45f
+#define DECORATION_HIDE 0.2f           /* Facing less than this (a cosine), it's round the back */
+
+/* Per layer: apex, rings, the rim again facing down and the point closing it */
+#define TREE_MESH_VERTICES (NUM_TREE_LAYERS * (TREE_MESH_RINGS + 1) * TREE_MESH_SEGMENTS + \
+                            NUM_TREE_LAYERS * 2 + 2 * TRUNK_MESH_SEGMENTS)
+#define TREE_MESH_TRIANGLES (NUM_TREE_LAYERS * 2 * TREE_MESH_RINGS * TREE_MESH_SEGMENTS + \
+                             2 * TRUNK_MESH_SEGMENTS)
+
+/* Towards the light in view space: upper right, in front; length is its strength */
+static const float MESH_LIGHT[3] = { 0.42f, -0.42f, -0.5f };
+
+static int rotate_mode = 0;
+static Mesh *tree_mesh = NULL;
+
+/* Lights, ornaments and sky stars are laid out once from this seed */
+#define SCENE_SEED 12345
+#define SIM_SEED 67890
+
+/*
+ * Everything the animation evolves from tick to tick. Plain data with no
+ * pointers: a snapshot is a struct copy and can be written to a file or
+ * sent to another process as-is. Rendering reads only this, the fixed
+ * scene layout and the render target, so any frame can be drawn on any
+ * thread once its state is known.
+ */
+typedef struct {
+    uint32_t frame;            /* Ticks since the initial state */
+    uint64_t rng;              /* Drives snowflake respawns */
+    float left, right;         /* Scene span the snow wraps within */
+    Snowflake snowflakes[DEFAULT_SNOWFLAKES];
+    uint32_t num_snowflakes;   /* In use; past DEFAULT_SNOWFLAKES they are window_snowflakes */
+    uint32_t landings;         /* Flakes that came to rest */
+    uint16_t landed[SNOW_LOG]; /* Column of landing i at i % SNOW_LOG */
+    uint8_t snow_depth[MAX_SNOW_COLUMNS];   /* In SNOW_UNITS, from column sim.left + i */
+} SimState;
+
+static __thread SimState sim;
+
+/*
+ * Flakes the window added over --control, past the ones SimState holds.
+ * Only the main thread steps and draws the window, and it never snapshots
+ * or seeks once running, so they need not travel with the state; keeping
+ * them out keeps every checkpoint, snapshot and thread's copy small.
+ */
+static Snowflake window_snowflakes[MAX_SNOWFLAKES - DEFAULT_SNOWFLAKES];
+
+/* Up to SNOW_BATCH flakes from index first, contiguous in memory; their number in *count */
+static Snowflake *snowflake_run(uint32_t first, int *count) {
+    uint32_t end = first < DEFAULT_SNOWFLAKES ? DEFAULT_SNOWFLAKES : sim.num_snowflakes;
+    if (end > sim.num_snowflakes) end = sim.num_snowflakes;
+    *count = end - first < SNOW_BATCH ? end - first : SNOW_BATCH;
+    return first < DEFAULT_SNOWFLAKES ? &sim.snowflakes[first] : &window_snowflakes[first - DEFAULT_SNOWFLAKES];
+}
+
+/* Wind over the snow's span; a function of the tick, rebuilt by each thread as it steps */
+#define WIND_LIFT 0.5f                 /* How much of the wind's vertical push flakes feel */
+#define MIN_FALL 0.3f                  /* Of a flake's own speed, however hard the wind lifts */
+static __thread Wind wind;
+
+/* Seek checkpoints, shared by all threads; checkpoints[i].frame == i * interval */
+#define SIM_CHECKPOINT_INTERVAL 600
+static SimState *checkpoints = NULL;
+static uint32_t num_checkpoints = 0;
+static uint32_t max_checkpoints = 0;
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* Color palette */
 static const uint32_t ORNAMENT_COLORS[] = {
     0xFFFF1744,  /* Vibrant Red */
@@ -95,19 +443,62 @@ static const uint32_t ORNAMENT_COLORS[] = {
 };
 #define NUM_ORNAMENT_COLORS (sizeof(ORNAMENT_COLORS) / sizeof(ORNAMENT_COLORS[0]))
 
-/* Fast pseudo-random number generator */
-static double fast_random(void) {
-    random_seed = random_seed * 1103515245.0 + 12345.0;
-    random_seed = fmod(random_seed, 2147483648.0);
-    return random_seed / 2147483648.0;
+/* Fast pseudo-random number generator (64-bit LCG, top 53 bits) */
+static double fast_random(uint64_t *rng) {
+    *rng = *rng * 6364136223846793005ull + 1442695040888963407ull;
+    return (*rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int random_int(uint64_t *rng, int min, int max) {
+    return min + (int)(fast_random(rng) * (max - min + 1));
+}
+
+/*
+ * Per-pixel texture noise in [0, 1). A hash of position and tick instead
+ * of a running generator, so a frame looks the same whatever was rendered
+ * before it and in whatever order its pixels are filled.
+ */
+static inline float hash_noise(int x, int y, uint32_t tick) {
+    uint32_t h = (uint32_t)x * 0x8da6b343u ^ (uint32_t)y * 0xd8163841u ^ tick * 0xcb1ab31fu;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    h *= 0x297a2d39u;
+    h ^= h >> 15;
+    return (h >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline float pixel_noise(int x, int y) {
+    return hash_noise(x, y, sim.frame);
+}
+
+/* Noise that doesn't change between frames, for anything cached */
+static inline float still_noise(int x, int y) {
+    return hash_noise(x, y, 0);
 }
 
-static int random_int(int min, int max) {
-    return min + (int)(fast_random() * (max - min + 1));
+/* Blend colours, sprites, lighting and glow in linear light instead of on sRGB values (--linear) */
+static int linear_light = 0;
+
+/* Linear-light blends weigh in 4.12 fixed point, to stay with table lookups and integer math */
+#define BLEND_ONE 4096
+
+static inline uint32_t blend_weight(float ratio) {
+    return ratio <= 0 ? 0 : ratio >= 1 ? BLEND_ONE : (uint32_t)(ratio * BLEND_ONE + 0.5f);
 }
 
 /* Color manipulation functions */
 static uint32_t blend_colors(uint32_t c1, uint32_t c2, float ratio) {
+    if (linear_light) {
+        uint32_t w = blend_weight(ratio);
+        uint32_t out = 0xFF000000;
+        for (int shift = 0; shift < 24; shift += 8) {
+            uint32_t l = srgb_to_linear(c1 >> shift) * (BLEND_ONE - w) + srgb_to_linear(c2 >> shift) * w;
+            out |= linear_to_srgb((l + BLEND_ONE / 2) >> 12) << shift;
+        }
+        return out;
+    }
+    
     uint8_t r1 = (c1 >> 16) & 0xFF;
     uint8_t g1 = (c1 >> 8) & 0xFF;
     uint8_t b1 = c1 & 0xFF;
@@ -147,38 +538,103 @@ static uint32_t darken_color(uint32_t color, float factor) {
     return 0xFF000000 | (r << 16) | (g << 8) | b;
 }
 
-/* Initialize snowflakes */
-static void init_snowflakes(void) {
-    for (int i = 0; i < MAX_SNOWFLAKES; i++) {
-        snowflakes[i].x = fast_random() * WIDTH;
-        snowflakes[i].y = fast_random() * HEIGHT;
-        snowflakes[i].speed = 1.0f + fast_random() * 2.0f;
-        snowflakes[i].drift = (fast_random() - 0.5f) * 0.5f;
-        snowflakes[i].size = 1 + (int)(fast_random() * 3);
+/*
+ * blend_colors between one pair of colours at every linear-light weight,
+ * for gradients blended pixel by pixel: one lookup instead of nine
+ */
+typedef struct {
+    uint32_t color[BLEND_ONE + 1];
+} BlendRamp;
+
+static BlendRamp ground_ramp;
+static BlendRamp tree_ramp[2];         /* Dark to light, light to highlight */
+
+static void init_blend_ramp(BlendRamp *ramp, uint32_t c1, uint32_t c2) {
+    for (int w = 0; w <= BLEND_ONE; w++) {
+        ramp->color[w] = blend_colors(c1, c2, (float)w / BLEND_ONE);
+    }
+}
+
+/* blend_colors(c1, c2, ratio), from the ramp for c1 and c2 when blending in linear light */
+static inline uint32_t blend_ramp(const BlendRamp *ramp, uint32_t c1, uint32_t c2, float ratio) {
+    return linear_light ? ramp->color[blend_weight(ratio)] : blend_colors(c1, c2, ratio);
+}
+
+/* Snowflakes up to count, new ones anywhere in the sky; fewer just stops stepping the rest */
+static void set_snowflake_count(uint32_t count) {
+    for (uint32_t i = sim.num_snowflakes; i < count; i++) {
+        Snowflake *s = i < DEFAULT_SNOWFLAKES ? &sim.snowflakes[i] : &window_snowflakes[i - DEFAULT_SNOWFLAKES];
+        s->x = sim.left + fast_random(&sim.rng) * (sim.right - sim.left);
+        s->y = fast_random(&sim.rng) * HEIGHT;
+        s->speed = 1.0f + fast_random(&sim.rng) * 2.0f;
+        s->drift = (fast_random(&sim.rng) - 0.5f) * 0.5f;
+        s->size = 1 + (int)(fast_random(&sim.rng) * 3);
+    }
+    sim.num_snowflakes = count;
+}
+
+/* Initial simulation state; snow falls across scene x in [left, right) */
+static void init_snowflakes(float left, float right) {
+    memset(&sim, 0, sizeof(sim));
+    sim.rng = SIM_SEED;
+    sim.left = left;
+    sim.right = right;
+    set_snowflake_count(DEFAULT_SNOWFLAKES);
+}
+
+/* Where snow falling down scene x comes to rest, and how deep it can lie there */
+static float snow_surface(float x, int *capacity) {
+    float y = GROUND_TOP;
+    *capacity = SNOW_GROUND_DEPTH;
+    
+    /* The mesh turns under it, so snow only settles on the flat tree */
+    if (tree_mesh) return y;
+    
+    float dx = fabsf(x - TREE_CENTER_X);
+    for (size_t l = 0; l < NUM_TREE_LAYERS; l++) {
+        if (dx >= TREE_LAYERS[l].width) continue;
+        float top = TREE_LAYERS[l].top_y + dx * (TREE_LAYERS[l].bottom_y - TREE_LAYERS[l].top_y) / TREE_LAYERS[l].width;
+        if (top < y) {
+            y = top;
+            *capacity = SNOW_BRANCH_DEPTH;
+        }
+    }
+    return y;
+}
+
+/* Precompute what each column of [left, right) catches; shared read-only by all threads */
+static void init_snow_floor(float left, float right) {
+    snow_columns = (int)ceilf(right - left);
+    if (snow_columns > MAX_SNOW_COLUMNS) snow_columns = MAX_SNOW_COLUMNS;
+    
+    for (int c = 0; c < snow_columns; c++) {
+        int capacity;
+        snow_floor[c] = snow_surface(left + c + 0.5f, &capacity);
+        snow_capacity[c] = capacity;
     }
 }
 
 /* Initialize tree lights */
-static void init_lights(void) {
-    for (int i = 0; i < MAX_LIGHTS; i++) {
+static void init_lights(uint64_t *rng) {
+    for (int i = 0; i < num_lights; i++) {
         /* Position lights within tree shape */
-        float t = fast_random();  /* 0 to 1 from top to bottom */
+        float t = fast_random(rng);  /* 0 to 1 from top to bottom */
         int y_pos = 130 + (int)(t * 350);
         
         /* Width increases with y */
         int max_width = (int)(t * 180);
-        int x_offset = random_int(-max_width, max_width);
+        int x_offset = random_int(rng, -max_width, max_width);
         
         lights[i].x = 400 + x_offset;
         lights[i].y = y_pos;
-        lights[i].radius = 3 + (int)(fast_random() * 4);
+        lights[i].radius = 3 + (int)(fast_random(rng) * 4);
         lights[i].color = ORNAMENT_COLORS[i % NUM_ORNAMENT_COLORS];
-        lights[i].phase = random_int(0, 100);
+        lights[i].phase = random_int(rng, 0, 100);
     }
 }
 
 /* Initialize ornaments */
-static void init_ornaments(void) {
+static void init_ornaments(uint64_t *rng) {
     /* Predefined ornament positions for balanced look */
     int positions[][2] = {
         {400, 180}, {360, 230}, {440, 230},
@@ -190,546 +646,3087 @@ static void init_ornaments(void) {
     for (int i = 0; i < MAX_ORNAMENTS; i++) {
         ornaments[i].x = positions[i][0];
         ornaments[i].y = positions[i][1];
-        ornaments[i].radius = 8 + random_int(0, 4);
+        ornaments[i].radius = 8 + random_int(rng, 0, 4);
         ornaments[i].color = ORNAMENT_COLORS[i % NUM_ORNAMENT_COLORS];
-        ornaments[i].shine_angle = fast_random() * M_PI * 2;
+        ornaments[i].shine_angle = fast_random(rng) * M_PI * 2;
     }
 }
 
-/* Draw a single pixel with bounds checking */
-static inline void put_pixel(int x, int y, uint32_t color) {
-    if (x >= 0 && x < WIDTH && y >= 0 && y < HEIGHT) {
-        shm_data[y * WIDTH + x] = color;
+/* Place the background stars; y stays in the upper half of the sky */
+static void init_sky(uint64_t *rng) {
+    for (int i = 0; i < NUM_SKY_STARS; i++) {
+        sky_stars[i].x = random_int(rng, 0, WIDTH - 1);
+        sky_stars[i].y = random_int(rng, 0, HEIGHT / 2 - 1);
+        sky_stars[i].phase = RADIANS_TO_PHASE(i * 0.5);
     }
 }
 
-/* Draw a horizontal gradient line */
-static void draw_hline_gradient(int y, int x1, int x2, uint32_t c1, uint32_t c2) {
-    if (y < 0 || y >= HEIGHT) return;
-    if (x1 > x2) { int t = x1; x1 = x2; x2 = t; }
-    if (x1 < 0) x1 = 0;
-    if (x2 >= WIDTH) x2 = WIDTH - 1;
-    
-    int width = x2 - x1;
-    if (width <= 0) return;
+/* Far trees first */
+static int compare_tree_depth(const void *a, const void *b) {
+    float da = ((const TreeInstance *)a)->depth, db = ((const TreeInstance *)b)->depth;
+    return (da < db) - (da > db);
+}
+
+/* Scatter the forest along the horizon; smaller trees are further away */
+static void init_forest(void) {
+    uint64_t rng = FOREST_SEED;
     
-    for (int x = x1; x <= x2; x++) {
-        float ratio = (float)(x - x1) / width;
-        shm_data[y * WIDTH + x] = blend_colors(c1, c2, ratio);
+    for (int i = 0; i < forest_size; i++) {
+        float r = fast_random(&rng);
+        forest[i].scale = 0.08f + (FOREST_MAX_SCALE - 0.08f) * r * r;
+        forest[i].depth = 1.0f / forest[i].scale;
+        forest[i].x = fast_random(&rng);
+        /* Nearer trees stand lower, but never in front of the decorated trunk */
+        forest[i].base_y = GROUND_TOP + 2 + forest[i].scale * 14;
     }
+    qsort(forest, forest_size, sizeof(TreeInstance), compare_tree_depth);
 }
 
-/* Draw filled circle with 3D shading */
-static void draw_3d_sphere(int cx, int cy, int radius, uint32_t base_color) {
-    for (int dy = -radius; dy <= radius; dy++) {
-        for (int dx = -radius; dx <= radius; dx++) {
-            float dist = sqrtf(dx * dx + dy * dy);
-            if (dist <= radius) {
-                /* 3D shading - light from top-left */
-                float nx = dx / (float)radius;
-                float ny = dy / (float)radius;
-                float nz = sqrtf(fmax(0, 1 - nx*nx - ny*ny));
-                
-                /* Light direction */
-                float lx = -0.5f, ly = -0.5f, lz = 0.7f;
-                float len = sqrtf(lx*lx + ly*ly + lz*lz);
-                lx /= len; ly /= len; lz /= len;
-                
-                float diffuse = fmax(0, nx*lx + ny*ly + nz*lz);
-                float specular = powf(fmax(0, nz), 20) * 0.5f;
-                
-                /* Edge darkening */
-                float edge = 1.0f - dist / radius;
-                edge = powf(edge, 0.3f);
-                
-                float brightness = 0.3f + diffuse * 0.5f + specular;
-                brightness *= edge;
+/* Outward normal of a cone widening by slope units per unit down, at angle (sin_a, cos_a) */
+static void cone_normal(MeshVertex *v, float sin_a, float cos_a, float slope) {
+    float length = sqrtf(1 + slope * slope);
+    v->nx = sin_a / length;
+    v->ny = -slope / length;
+    v->nz = -cos_a / length;
+}
+
+/* Fill in the tree mesh; returns the number of triangles */
+static int build_tree_mesh(MeshVertex *vertices, int *triangles) {
+    enum { SEGMENTS = TREE_MESH_SEGMENTS, RINGS = TREE_MESH_RINGS };
+    uint32_t trunk_light = 0xFF5d4027;
+    uint64_t rng = MESH_SEED;
+    int nv = 0, nt = 0;
+    
+#define TRIANGLE(a, b, c) (triangles[nt++] = (a), triangles[nt++] = (b), triangles[nt++] = (c))
+    
+    for (size_t l = 0; l < NUM_TREE_LAYERS; l++) {
+        float top_y = TREE_LAYERS[l].top_y;
+        float height = TREE_LAYERS[l].bottom_y - top_y;
+        float width = TREE_LAYERS[l].width;
+        float slope = width / height;
+        
+        /* Apex, under its snow */
+        int apex = nv;
+        vertices[nv++] = (MeshVertex){ 0, top_y, 0, 0, -1, 0, 0xFFFFFFFF };
+        
+        /* Rings down the cone; ring k's vertex j is ring_start + (k - 1) * SEGMENTS + j */
+        int ring_start = nv;
+        for (int k = 1; k <= RINGS; k++) {
+            float t = (float)k / RINGS;
+            for (int j = 0; j < SEGMENTS; j++) {
+                Phase angle = (Phase)((uint64_t)j * 0x100000000ull / SEGMENTS);
+                float sin_a = lut_sin(angle), cos_a = lut_cos(angle);
+                int tip = j % 2 == 0;
+                float radius = t * width * (tip ? 1.0f : 1.0f - (1.0f - BRANCH_NOTCH) * t);
                 
-                uint32_t color;
-                if (specular > 0.3f) {
-                    /* Specular highlight */
-                    color = blend_colors(base_color, 0xFFFFFFFF, specular);
-                } else {
-                    color = brighten_color(base_color, brightness + 0.5f);
-                }
+                MeshVertex *v = &vertices[nv++];
+                v->x = radius * sin_a;
+                v->y = top_y + t * height + (tip ? BRANCH_DROOP * t * t : 0);
+                v->z = -radius * cos_a;
+                cone_normal(v, sin_a, cos_a, slope);
                 
-                put_pixel(cx + dx, cy + dy, color);
+                uint32_t color = blend_colors(TREE_DARK_COLOR, TREE_LIGHT_COLOR, 0.35f + 0.5f * fast_random(&rng));
+                if (tip) color = blend_colors(color, TREE_HIGHLIGHT_COLOR, 0.5f * t);
+                color = brighten_color(color, 1.0f - t * 0.3f);
+                if (k == 1) color = blend_colors(color, 0xFFFFFFFF, 0.5f);
+                v->color = color;
             }
         }
-    }
-}
-
-/* Draw glowing light */
-static void draw_glow(int cx, int cy, int radius, uint32_t color, float intensity) {
-    int glow_radius = radius * 3;
-    for (int dy = -glow_radius; dy <= glow_radius; dy++) {
-        for (int dx = -glow_radius; dx <= glow_radius; dx++) {
-            float dist = sqrtf(dx * dx + dy * dy);
-            if (dist <= glow_radius) {
-                int x = cx + dx;
-                int y = cy + dy;
-                if (x >= 0 && x < WIDTH && y >= 0 && y < HEIGHT) {
-                    float glow = 1.0f - dist / glow_radius;
-                    glow = powf(glow, 2) * intensity;
-                    
-                    if (glow > 0.05f) {
-                        uint32_t existing = shm_data[y * WIDTH + x];
-                        shm_data[y * WIDTH + x] = blend_colors(existing, color, glow);
-                    }
-                }
+        
+        /* Underside: the rim again, facing down, closed by a point up inside the cone */
+        int rim = nv;
+        for (int j = 0; j < SEGMENTS; j++) {
+            MeshVertex *v = &vertices[nv++];
+            *v = vertices[ring_start + (RINGS - 1) * SEGMENTS + j];
+            v->nx = 0;
+            v->ny = 1;
+            v->nz = 0;
+            v->color = darken_color(TREE_DARK_COLOR, 0.6f);
+        }
+        int hollow = nv;
+        vertices[nv++] = (MeshVertex){ 0, top_y + height * 0.7f, 0, 0, 1, 0, darken_color(TREE_DARK_COLOR, 0.4f) };
+        
+        for (int j = 0; j < SEGMENTS; j++) {
+            int next = (j + 1) % SEGMENTS;
+            TRIANGLE(apex, ring_start + next, ring_start + j);
+            for (int k = 0; k < RINGS - 1; k++) {
+                int upper = ring_start + k * SEGMENTS, lower = upper + SEGMENTS;
+                TRIANGLE(upper + j, upper + next, lower + j);
+                TRIANGLE(upper + next, lower + next, lower + j);
             }
+            TRIANGLE(hollow, rim + j, rim + next);
         }
     }
-}
-
-/* Render gradient night sky with stars */
-static void render_sky(void) {
-    uint32_t sky_top = 0xFF0a0a2e;      /* Dark blue */
-    uint32_t sky_bottom = 0xFF1a1a4e;   /* Lighter blue */
     
-    for (int y = 0; y < HEIGHT; y++) {
-        float ratio = (float)y / HEIGHT;
-        uint32_t color = blend_colors(sky_top, sky_bottom, ratio);
-        for (int x = 0; x < WIDTH; x++) {
-            shm_data[y * WIDTH + x] = color;
+    /* Trunk: an open cylinder */
+    int trunk = nv;
+    for (int end = 0; end < 2; end++) {
+        for (int j = 0; j < TRUNK_MESH_SEGMENTS; j++) {
+            Phase angle = (Phase)((uint64_t)j * 0x100000000ull / TRUNK_MESH_SEGMENTS);
+            float sin_a = lut_sin(angle), cos_a = lut_cos(angle);
+            MeshVertex *v = &vertices[nv++];
+            v->x = TRUNK_HALF_WIDTH * sin_a;
+            v->y = end ? TRUNK_BOTTOM : TRUNK_TOP;
+            v->z = -TRUNK_HALF_WIDTH * cos_a;
+            cone_normal(v, sin_a, cos_a, 0);
+            v->color = darken_color(trunk_light, 0.8f + 0.2f * fast_random(&rng));
         }
     }
-    
-    /* Add twinkling stars */
-    srand(42);  /* Fixed seed for consistent star positions */
-    for (int i = 0; i < 100; i++) {
-        int x = rand() % WIDTH;
-        int y = rand() % (HEIGHT / 2);
-        
-        /* Twinkle based on frame */
-        float twinkle = sinf(frame_count * 0.1f + i * 0.5f) * 0.5f + 0.5f;
-        uint32_t brightness = (uint32_t)(200 + 55 * twinkle);
-        uint32_t color = 0xFF000000 | (brightness << 16) | (brightness << 8) | brightness;
-        
-        put_pixel(x, y, color);
-        if (twinkle > 0.7f) {
-            /* Larger star */
-            put_pixel(x - 1, y, darken_color(color, 0.5f));
-            put_pixel(x + 1, y, darken_color(color, 0.5f));
-            put_pixel(x, y - 1, darken_color(color, 0.5f));
-            put_pixel(x, y + 1, darken_color(color, 0.5f));
-        }
+    for (int j = 0; j < TRUNK_MESH_SEGMENTS; j++) {
+        int next = (j + 1) % TRUNK_MESH_SEGMENTS;
+        int top = trunk, bottom = trunk + TRUNK_MESH_SEGMENTS;
+        TRIANGLE(top + j, top + next, bottom + j);
+        TRIANGLE(top + next, bottom + next, bottom + j);
     }
+#undef TRIANGLE
+    
+    return nt / 3;
 }
 
-/* Render snow-covered ground */
-static void render_ground(void) {
-    uint32_t snow_white = 0xFFF0F8FF;   /* Snow white */
-    uint32_t snow_shadow = 0xFFD0E0F0;  /* Slight blue shadow */
+/* Build tree_mesh; the flat tree is drawn if this fails */
+static void init_tree_mesh(void) {
+    MeshVertex *vertices = malloc(TREE_MESH_VERTICES * sizeof(MeshVertex));
+    int *triangles = malloc(TREE_MESH_TRIANGLES * 3 * sizeof(int));
     
-    for (int y = 520; y < HEIGHT; y++) {
-        for (int x = 0; x < WIDTH; x++) {
-            /* Add texture variation */
-            float noise = fast_random() * 0.1f;
-            float height_factor = (float)(y - 520) / (HEIGHT - 520);
-            uint32_t color = blend_colors(snow_white, snow_shadow, height_factor * 0.3f + noise);
-            shm_data[y * WIDTH + x] = color;
-        }
+    if (vertices && triangles) {
+        int count = build_tree_mesh(vertices, triangles);
+        tree_mesh = mesh_create(vertices, TREE_MESH_VERTICES, triangles, count);
     }
+    if (!tree_mesh) fprintf(stderr, "🌲 Could not build the tree mesh, drawing it flat\n");
+    free(vertices);
+    free(triangles);
 }
 
-/* Render the 3D Christmas tree */
-static void render_tree(void) {
-    int center_x = 400;
-    int base_y = 520;
-    
-    /* Tree colors with 3D shading */
-    uint32_t tree_dark = 0xFF0d5016;
-    uint32_t tree_light = 0xFF1a8a2e;
-    uint32_t tree_highlight = 0xFF2ecc40;
-    
-    /* Draw multiple overlapping triangle layers */
-    struct {
-        int top_y, bottom_y, width;
-    } layers[] = {
-        {120, 250, 70},
-        {180, 330, 110},
-        {260, 410, 150},
-        {340, 500, 190}
-    };
+/* Lay out everything that never moves; shared read-only by all threads */
+static void init_scene(void) {
+    lut_init();
+    pow_lut_init(&pow_half, 0.5f);
+    pow_lut_init(&pow_rim, 0.3f);
+    pow_lut_init(&pow_specular, 20.0f);
     
-    for (int l = 0; l < 4; l++) {
-        int top_y = layers[l].top_y;
-        int bottom_y = layers[l].bottom_y;
-        int half_width = layers[l].width;
-        int height = bottom_y - top_y;
-        
-        for (int y = top_y; y < bottom_y; y++) {
-            if (y < 0 || y >= HEIGHT) continue;
-            
-            float t = (float)(y - top_y) / height;
-            int width_at_y = (int)(t * half_width);
-            
-            for (int dx = -width_at_y; dx <= width_at_y; dx++) {
-                int x = center_x + dx;
-                if (x < 0 || x >= WIDTH) continue;
-                
-                /* 3D shading - left side darker, right side lighter */
-                float shade = (float)dx / width_at_y;  /* -1 to 1 */
-                shade = (shade + 1) / 2;  /* 0 to 1 */
-                
-                /* Add vertical gradient */
-                float v_shade = 1.0f - t * 0.3f;
-                
-                uint32_t color;
-                if (shade < 0.3f) {
-                    color = darken_color(tree_dark, 0.7f + shade);
-                } else if (shade > 0.7f) {
-                    color = blend_colors(tree_light, tree_highlight, (shade - 0.7f) * 2);
-                } else {
-                    color = blend_colors(tree_dark, tree_light, shade);
-                }
-                
-                color = brighten_color(color, v_shade);
-                
-                /* Add some texture/noise */
-                if (fast_random() > 0.95f) {
-                    color = darken_color(color, 0.8f);
-                }
-                
-                shm_data[y * WIDTH + x] = color;
-            }
-        }
-        
-        /* Add "snow" on layer edges */
-        int snow_y = top_y + 10;
-        int snow_width = (int)(0.08f * half_width);
-        for (int dx = -snow_width; dx <= snow_width; dx++) {
-            for (int dy = 0; dy < 8; dy++) {
-                int x = center_x + dx;
-                int y = snow_y + dy;
-                float dist = sqrtf(dx * dx + dy * dy);
-                if (dist < 10) {
-                    uint32_t snow = blend_colors(shm_data[y * WIDTH + x], 0xFFFFFFFF, 0.6f - dist * 0.05f);
-                    put_pixel(x, y, snow);
-                }
-            }
-        }
+    /*
+     * Lights take their own stream, so --lights only adds lights. The rest
+     * of the scene skips the draws the default lights used to take from
+     * the same seed, and keeps the look it always had.
+     */
+    uint64_t light_rng = SCENE_SEED;
+    init_lights(&light_rng);
+    uint64_t rng = SCENE_SEED;
+    for (int i = 0; i < DEFAULT_LIGHTS * LIGHT_DRAWS; i++) {
+        fast_random(&rng);
+    }
+    init_ornaments(&rng);
+    init_sky(&rng);
+    init_forest();
+    if (rotate_mode) init_tree_mesh();
+    if (linear_light) {
+        init_blend_ramp(&ground_ramp, SNOW_WHITE_COLOR, SNOW_SHADOW_COLOR);
+        init_blend_ramp(&tree_ramp[0], TREE_DARK_COLOR, TREE_LIGHT_COLOR);
+        init_blend_ramp(&tree_ramp[1], TREE_LIGHT_COLOR, TREE_HIGHLIGHT_COLOR);
     }
+}
+
+static void update_occlusion(void);
+
+/* Point the renderer at a framebuffer and fit the scene to it */
+static void set_render_target(uint32_t *target, int width, int height) {
+    pixels = target;
+    fb_width = width;
+    fb_height = height;
     
-    /* Draw trunk */
-    uint32_t trunk_dark = 0xFF3d2817;
-    uint32_t trunk_light = 0xFF5d4027;
+    /* Scale to the target height; extra width extends sky, ground and snow */
+    scene_scale = (float)height / HEIGHT;
+    float scene_width = width / scene_scale;
+    scene_left = (WIDTH - scene_width) / 2;
+    scene_right = scene_left + scene_width;
     
-    for (int y = 480; y < 530; y++) {
-        for (int dx = -25; dx <= 25; dx++) {
-            int x = center_x + dx;
-            /* 3D cylindrical shading */
-            float shade = 1.0f - fabsf((float)dx / 25);
-            shade = powf(shade, 0.5f);
-            
-            uint32_t color = blend_colors(trunk_dark, trunk_light, shade);
-            
-            /* Add wood grain texture */
-            if ((y + (int)(fast_random() * 3)) % 5 == 0) {
-                color = darken_color(color, 0.9f);
-            }
-            
-            put_pixel(x, y, color);
-        }
-    }
+    update_occlusion();
 }
 
-/* Render golden star on top */
-static void render_star(void) {
-    int cx = 400, cy = 95;
+/* Scene coordinates to framebuffer pixels */
+static inline int scene_x(float x) {
+    return (int)floorf((x - scene_left) * scene_scale);
+}
+
+static inline int scene_y(float y) {
+    return (int)floorf(y * scene_scale);
+}
+
+static inline int scene_len(float d) {
+    return (int)(d * scene_scale);
+}
+
+/*
+ * Occlusion: the opaque shapes never move, so for each shape and row we
+ * keep only the pieces nothing painted later will cover. Opaque passes
+ * fill those instead of their whole span, skipping the sky under the
+ * ground and tree and tree layers under the ones in front. Rows of these
+ * shapes are single spans and the tree is centred, so what covers a row
+ * is one span too. Built per thread whenever the target size changes.
+ */
+typedef enum {
+    SHAPE_SKY,
+    SHAPE_GROUND,
+    SHAPE_TREE_LAYER,                               /* One per tree layer */
+    SHAPE_TRUNK = SHAPE_TREE_LAYER + NUM_TREE_LAYERS,
+    NUM_SHAPES
+} OpaqueShape;
+
+typedef struct {
+    int x0, x1;                /* [x0, x1); empty when x0 >= x1 */
+} Span;
+
+static __thread struct {
+    int width, height;
+    Span (*visible)[NUM_SHAPES][2];   /* Per row and shape, up to two pieces */
+} occlusion;
+
+/* Half width in pixels of a tree layer at framebuffer row y */
+static int tree_layer_half_width(int layer, int y) {
+    int top_y = TREE_LAYERS[layer].top_y;
+    int height = TREE_LAYERS[layer].bottom_y - top_y;
+    float t = (y / scene_scale - top_y) / height;
+    return (int)(t * TREE_LAYERS[layer].width * scene_scale);
+}
+
+/* Pixels shape paints in row y, clipped to the target; 0 if none */
+static int shape_span(OpaqueShape shape, int y, Span *span) {
+    int center_x = scene_x(TREE_CENTER_X);
+    int x0 = 0, x1 = fb_width;
     
-    /* Animated glow */
-    float pulse = sinf(frame_count * 0.15f) * 0.3f + 0.7f;
+    /* The mesh's outline changes as it turns, so it hides nothing */
+    if (tree_mesh && shape >= SHAPE_TREE_LAYER) return 0;
     
-    /* Draw outer glow first */
-    draw_glow(cx, cy, 20, 0xFFFFD700, pulse * 0.8f);
+    if (shape == SHAPE_GROUND) {
+        if (y < scene_y(GROUND_TOP)) return 0;
+    } else if (shape == SHAPE_TRUNK) {
+        if (y < scene_y(TRUNK_TOP) || y >= scene_y(TRUNK_BOTTOM)) return 0;
+        int half = scene_len(TRUNK_HALF_WIDTH);
+        x0 = center_x - half;
+        x1 = center_x + half + 1;
+    } else if (shape != SHAPE_SKY) {
+        int layer = shape - SHAPE_TREE_LAYER;
+        if (y < scene_y(TREE_LAYERS[layer].top_y) || y >= scene_y(TREE_LAYERS[layer].bottom_y)) return 0;
+        int half = tree_layer_half_width(layer, y);
+        x0 = center_x - half;
+        x1 = center_x + half + 1;
+    }
     
-    /* Draw 5-pointed star */
-    uint32_t star_color = 0xFFFFD700;
-    uint32_t star_bright = 0xFFFFFF00;
+    if (x0 < 0) x0 = 0;
+    if (x1 > fb_width) x1 = fb_width;
+    span->x0 = x0;
+    span->x1 = x1;
+    return x0 < x1;
+}
+
+/* Walk the shapes front to back, keeping what is not yet covered */
+static void update_occlusion(void) {
+    if (occlusion.visible && occlusion.width == fb_width && occlusion.height == fb_height) return;
     
-    for (int angle = 0; angle < 5; angle++) {
-        float a = (angle * 72 - 90) * M_PI / 180.0f;
-        float a2 = ((angle * 72 + 36) - 90) * M_PI / 180.0f;
-        
-        /* Outer point */
-        int ox = cx + (int)(cosf(a) * 25);
-        int oy = cy + (int)(sinf(a) * 25);
-        
-        /* Inner point */
-        int ix = cx + (int)(cosf(a2) * 10);
-        int iy = cy + (int)(sinf(a2) * 10);
+    free(occlusion.visible);
+    occlusion.visible = malloc((size_t)fb_height * sizeof(*occlusion.visible));
+    if (!occlusion.visible) return;   /* Passes then paint whole spans */
+    occlusion.width = fb_width;
+    occlusion.height = fb_height;
+    
+    for (int y = 0; y < fb_height; y++) {
+        Span cover = { 0, 0 };
         
-        /* Draw lines forming the star (simplified) */
-        for (float t = 0; t <= 1; t += 0.02f) {
-            int x = cx + (int)((ox - cx) * t);
-            int y = cy + (int)((oy - cy) * t);
+        for (int shape = NUM_SHAPES - 1; shape >= 0; shape--) {
+            Span *out = occlusion.visible[y][shape];
+            Span span;
             
-            float brightness = 1.0f - t * 0.3f;
-            uint32_t color = blend_colors(star_color, star_bright, brightness * pulse);
+            out[0] = out[1] = (Span){ 0, 0 };
+            if (!shape_span(shape, y, &span)) continue;
+            
+            if (cover.x0 >= cover.x1) {
+                out[0] = span;
+                cover = span;
+                continue;
+            }
+            out[0] = (Span){ span.x0, span.x1 < cover.x0 ? span.x1 : cover.x0 };
+            out[1] = (Span){ span.x0 > cover.x1 ? span.x0 : cover.x1, span.x1 };
             
-            put_pixel(x, y, color);
-            put_pixel(x - 1, y, color);
-            put_pixel(x + 1, y, color);
-            put_pixel(x, y - 1, color);
-            put_pixel(x, y + 1, color);
-        }
-    }
-    
-    /* Star center */
-    for (int dy = -8; dy <= 8; dy++) {
-        for (int dx = -8; dx <= 8; dx++) {
-            float dist = sqrtf(dx * dx + dy * dy);
-            if (dist <= 8) {
-                float brightness = 1.0f - dist / 8;
-                brightness = powf(brightness, 0.5f) * pulse;
-                uint32_t color = blend_colors(star_color, 0xFFFFFFFF, brightness);
-                put_pixel(cx + dx, cy + dy, color);
+            /* Merge into the cover; if they don't touch, the wider one is enough */
+            if (span.x0 <= cover.x1 && cover.x0 <= span.x1) {
+                if (span.x0 < cover.x0) cover.x0 = span.x0;
+                if (span.x1 > cover.x1) cover.x1 = span.x1;
+            } else if (span.x1 - span.x0 > cover.x1 - cover.x0) {
+                cover = span;
             }
         }
     }
 }
 
-/* Render ornaments */
-static void render_ornaments(void) {
-    for (int i = 0; i < MAX_ORNAMENTS; i++) {
-        draw_3d_sphere(ornaments[i].x, ornaments[i].y, 
-                       ornaments[i].radius, ornaments[i].color);
-        
-        /* Add hanging string */
-        uint32_t string_color = 0xFF444444;
-        for (int dy = -15; dy < 0; dy++) {
-            float wave = sinf(dy * 0.3f + ornaments[i].x * 0.1f) * 2;
-            put_pixel(ornaments[i].x + (int)wave, 
-                     ornaments[i].y + dy - ornaments[i].radius, 
-                     string_color);
-        }
+/* The pieces of row y that shape still has to paint */
+static void visible_spans(OpaqueShape shape, int y, Span out[2]) {
+    if (occlusion.visible) {
+        out[0] = occlusion.visible[y][shape][0];
+        out[1] = occlusion.visible[y][shape][1];
+        return;
     }
+    out[1] = (Span){ 0, 0 };
+    if (!shape_span(shape, y, &out[0])) out[0] = out[1];
 }
 
-/* Render twinkling lights */
-static void render_lights(void) {
-    for (int i = 0; i < MAX_LIGHTS; i++) {
-        /* Calculate if light is "on" or "off" based on time and phase */
-        float phase = sinf(frame_count * 0.2f + lights[i].phase * 0.1f);
-        
-        if (phase > -0.3f) {  /* Light is on */
-            float intensity = (phase + 0.3f) / 1.3f;
-            intensity = powf(intensity, 0.5f);
-            
-            /* Draw glow */
-            draw_glow(lights[i].x, lights[i].y, 
-                     lights[i].radius, lights[i].color, intensity * 0.7f);
-            
-            /* Draw bright center */
-            uint32_t bright_color = blend_colors(lights[i].color, 0xFFFFFFFF, intensity * 0.5f);
-            for (int dy = -2; dy <= 2; dy++) {
-                for (int dx = -2; dx <= 2; dx++) {
-                    float dist = sqrtf(dx * dx + dy * dy);
-                    if (dist <= 2) {
-                        put_pixel(lights[i].x + dx, lights[i].y + dy, bright_color);
-                    }
-                }
-            }
-        }
-    }
+static void release_occlusion(void) {
+    free(occlusion.visible);
+    occlusion.visible = NULL;
 }
 
-/* Render falling snow */
-static void render_snow(void) {
-    for (int i = 0; i < MAX_SNOWFLAKES; i++) {
-        int x = (int)snowflakes[i].x;
-        int y = (int)snowflakes[i].y;
-        int size = snowflakes[i].size;
-        
-        /* Draw snowflake based on size */
-        uint32_t snow_color = 0xFFFFFFFF;
-        uint32_t snow_dim = 0xFFCCCCCC;
-        
-        if (size == 1) {
-            put_pixel(x, y, snow_color);
-        } else if (size == 2) {
-            put_pixel(x, y, snow_color);
-            put_pixel(x - 1, y, snow_dim);
-            put_pixel(x + 1, y, snow_dim);
-        } else {
-            /* Larger snowflake - star shape */
-            put_pixel(x, y, snow_color);
-            put_pixel(x - 1, y, snow_color);
-            put_pixel(x + 1, y, snow_color);
-            put_pixel(x, y - 1, snow_color);
-            put_pixel(x, y + 1, snow_color);
-            put_pixel(x - 1, y - 1, snow_dim);
-            put_pixel(x + 1, y - 1, snow_dim);
-            put_pixel(x - 1, y + 1, snow_dim);
-            put_pixel(x + 1, y + 1, snow_dim);
-        }
-    }
+/* Whether anyone reads the counts; primitives test this once per span or row, not per pixel */
+static inline int counting(void) {
+    return stats_mode || overdraw_mode;
 }
 
-/* Update animation state */
-static void update_animation(void) {
-    frame_count++;
-    
-    /* Update snowflakes */
-    for (int i = 0; i < MAX_SNOWFLAKES; i++) {
-        snowflakes[i].y += snowflakes[i].speed;
-        snowflakes[i].x += snowflakes[i].drift + sinf(snowflakes[i].y * 0.02f) * 0.5f;
-        
-        /* Wrap around */
-        if (snowflakes[i].y > HEIGHT) {
-            snowflakes[i].y = -10;
-            snowflakes[i].x = fast_random() * WIDTH;
-        }
-        if (snowflakes[i].x < 0) snowflakes[i].x += WIDTH;
-        if (snowflakes[i].x >= WIDTH) snowflakes[i].x -= WIDTH;
-    }
+/* Record an overwrite / a read-modify-write of the pixel at index i */
+static inline void count_write(int i) {
+    pixel_count.written++;
+    if (overdraw && overdraw[i] < UINT8_MAX) overdraw[i]++;
 }
 
-/* Render complete frame */
-static void render_frame(void) {
-    render_sky();
-    render_ground();
-    render_tree();
-    render_ornaments();
-    render_lights();
-    render_star();
-    render_snow();
+static inline void count_blend(int i) {
+    pixel_count.blended++;
+    if (overdraw && overdraw[i] < UINT8_MAX) overdraw[i]++;
 }
 
-/* Wayland registry handler */
-static void registry_handler(void *data, struct wl_registry *registry,
-                            uint32_t id, const char *interface, uint32_t version) {
-    if (strcmp(interface, wl_compositor_interface.name) == 0) {
-        compositor = wl_registry_bind(registry, id, &wl_compositor_interface, 4);
-    } else if (strcmp(interface, wl_shm_interface.name) == 0) {
-        shm = wl_registry_bind(registry, id, &wl_shm_interface, 1);
-    } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
-        xdg_wm_base = wl_registry_bind(registry, id, &xdg_wm_base_interface, 1);
+/* Add n pixels starting at index i, stride apart, to total */
+static inline void count_run(uint64_t *total, int i, int n, int stride) {
+    *total += n;
+    if (!overdraw) return;
+    for (int j = 0; j < n; j++) {
+        uint8_t *c = &overdraw[i + j * stride];
+        if (*c < UINT8_MAX) (*c)++;
     }
 }
 
-static void registry_remover(void *data, struct wl_registry *registry, uint32_t id) {
-    /* Handle global removal if needed */
+/* Record n overwrites starting at index i */
+static inline void count_span(int i, int n) {
+    if (counting()) count_run(&pixel_count.written, i, n, 1);
 }
 
-static const struct wl_registry_listener registry_listener = {
-    registry_handler,
-    registry_remover
-};
+/* Fill the framebuffer pixels covered by one scene pixel */
+static void put_cell(int x, int y, uint32_t color) {
+    int x0 = scene_x(x), x1 = scene_x(x + 1);
+    int y0 = scene_y(y), y1 = scene_y(y + 1);
+    if (x1 == x0) x1++;
+    if (y1 == y0) y1++;
+    if (x0 < 0) x0 = 0;
+    if (x1 > fb_width) x1 = fb_width;
+    if (y0 < 0) y0 = 0;
+    if (y1 > fb_height) y1 = fb_height;
+    if (x0 >= x1) return;
+    
+    for (int py = y0; py < y1; py++) {
+        for (int px = x0; px < x1; px++) {
+            pixels[py * fb_width + px] = color;
+        }
+        count_span(py * fb_width + x0, x1 - x0);
+    }
+}
+
+/* Draw a horizontal gradient line */
+static void draw_hline_gradient(int y, int x1, int x2, uint32_t c1, uint32_t c2) {
+    if (y < 0 || y >= fb_height) return;
+    if (x1 > x2) { int t = x1; x1 = x2; x2 = t; }
+    if (x1 < 0) x1 = 0;
+    if (x2 >= fb_width) x2 = fb_width - 1;
+    
+    int width = x2 - x1;
+    if (width <= 0) return;
+    
+    for (int x = x1; x <= x2; x++) {
+        float ratio = (float)(x - x1) / width;
+        pixels[y * fb_width + x] = blend_colors(c1, c2, ratio);
+    }
+    count_span(y * fb_width + x1, width + 1);
+}
+
+/* Needle colour; shade is -1 at a layer's left edge and 1 at its right, t 0 at its top and 1 at its bottom */
+static uint32_t tree_layer_color(float shade, float t, float noise) {
+    /* 3D shading - left side darker, right side lighter */
+    shade = (shade + 1) / 2;  /* 0 to 1 */
+    
+    /* Add vertical gradient */
+    float v_shade = 1.0f - t * 0.3f;
+    
+    uint32_t color;
+    if (shade < 0.3f) {
+        color = darken_color(TREE_DARK_COLOR, 0.7f + shade);
+    } else if (shade > 0.7f) {
+        color = blend_ramp(&tree_ramp[1], TREE_LIGHT_COLOR, TREE_HIGHLIGHT_COLOR, (shade - 0.7f) * 2);
+    } else {
+        color = blend_ramp(&tree_ramp[0], TREE_DARK_COLOR, TREE_LIGHT_COLOR, shade);
+    }
+    
+    color = brighten_color(color, v_shade);
+    
+    /* Add some texture/noise */
+    if (noise > 0.95f) {
+        color = darken_color(color, 0.8f);
+    }
+    return color;
+}
+
+/* Bark colour; shade is 1 on the trunk's axis and 0 at its edges */
+static uint32_t trunk_color(float shade, int grain_y, float noise) {
+    uint32_t trunk_dark = 0xFF3d2817;
+    uint32_t trunk_light = 0xFF5d4027;
+    
+    /* 3D cylindrical shading */
+    uint32_t color = blend_colors(trunk_dark, trunk_light, pow_lut(&pow_half, shade));
+    
+    /* Add wood grain texture */
+    if ((grain_y + (int)(noise * 3)) % 5 == 0) {
+        color = darken_color(color, 0.9f);
+    }
+    return color;
+}
+
+/*
+ * The undecorated tree at (u, v): u from the trunk's axis and v the scene
+ * y of the decorated tree, in its scene units. Painted in render_tree's
+ * order (each layer and its snow, then the trunk) and returned
+ * premultiplied: 0 outside, part alpha where snow overhangs a layer.
+ */
+static uint32_t tree_color(float u, float v, float noise) {
+    float au = fabsf(u);
+    
+    if (v >= TRUNK_TOP && v < TRUNK_BOTTOM && au <= TRUNK_HALF_WIDTH) {
+        return trunk_color(1.0f - au / TRUNK_HALF_WIDTH, (int)v, noise);
+    }
+    
+    uint32_t color = 0;
+    for (size_t l = 0; l < NUM_TREE_LAYERS; l++) {
+        int top_y = TREE_LAYERS[l].top_y;
+        int height = TREE_LAYERS[l].bottom_y - top_y;
+        if (v < top_y || v >= TREE_LAYERS[l].bottom_y) continue;
+        
+        float t = (v - top_y) / height;
+        float half = t * TREE_LAYERS[l].width;
+        if (au <= half && half > 0) {
+            color = tree_layer_color(u / half, t, noise);
+        }
+        
+        /* Snow cap; it can overhang the layer's tip */
+        float sy = v - (top_y + 10);
+        float dist = sqrtf(u * u + sy * sy);
+        if (sy >= 0 && sy < 8 && au <= 0.08f * TREE_LAYERS[l].width && dist < 10) {
+            float amount = 0.6f - dist * 0.05f;
+            color = color ? blend_colors(color, 0xFFFFFFFF, amount)
+                          : (uint32_t)(amount * 255) * 0x01010101u;
+        }
+    }
+    return color;
+}
+
+/*
+ * Round things are sprites: drawn once per thread at the size the current
+ * target needs (sizes follow the scene scale, i.e. the target height) and
+ * then blitted every frame. Each texel function returns premultiplied ARGB.
+ */
+#define STAR_CENTER_COLOR 0xFFFFD700
+#define STAR_BRIGHT_COLOR 0xFFFFFF00   /* What the pulse takes the star towards */
+#define STAR_RADIUS 25.0f              /* Scene pixels out to the points */
+#define STAR_INNER 0.382f              /* Inner corners, of the radius: a regular pentagram */
+#define STAR_TIP_SHADE 0.7f            /* Brightness at the points; 1 at the centre */
+
+/* Forest impostors: the tree pre-drawn this tall in pixels, doubling per LOD */
+#define IMPOSTOR_LODS 4
+#define IMPOSTOR_MIN_HEIGHT 32
+#define IMPOSTOR_MAX_HEIGHT (IMPOSTOR_MIN_HEIGHT << (IMPOSTOR_LODS - 1))
+
+static __thread struct {
+    SpriteAtlas *atlas;
+    int width, height;                 /* Target size they were drawn for */
+    int ornament[MAX_ORNAMENTS];
+    int light_core;
+    int star;
+    int star_shine;
+    int snowflake[3];                  /* By snowflake size */
+    int impostor[IMPOSTOR_LODS];       /* Drawn on first use; -1 until then */
+    int impostor_width[IMPOSTOR_LODS];
+    int forest;                        /* All of the forest, -1 if it covers nothing */
+    int forest_built;                  /* Drawn into this atlas, if it covers anything */
+} sprites;
+
+typedef struct {
+    int radius;
+    uint32_t color;
+} RoundSprite;
+
+/* Filled circle with 3D shading, lit from the top left */
+static uint32_t sphere_texel(int dx, int dy, void *ctx) {
+    const RoundSprite *sphere = ctx;
+    int radius = sphere->radius;
+    uint32_t base_color = sphere->color;
+    float dist = sqrtf(dx * dx + dy * dy);
+    if (dist > radius) return 0;
+    
+    float nx = dx / (float)radius;
+    float ny = dy / (float)radius;
+    float nz = sqrtf(fmax(0, 1 - nx*nx - ny*ny));
+    
+    /* Light direction */
+    float lx = -0.5f, ly = -0.5f, lz = 0.7f;
+    float len = sqrtf(lx*lx + ly*ly + lz*lz);
+    lx /= len; ly /= len; lz /= len;
+    
+    float diffuse = fmax(0, nx*lx + ny*ly + nz*lz);
+    float specular = pow_lut(&pow_specular, nz) * 0.5f;
+    
+    /* Edge darkening */
+    float edge = 1.0f - dist / radius;
+    edge = pow_lut(&pow_rim, edge);
+    
+    float brightness = 0.3f + diffuse * 0.5f + specular;
+    brightness *= edge;
+    
+    if (specular > 0.3f) {
+        /* Specular highlight */
+        return blend_colors(base_color, 0xFFFFFFFF, specular);
+    }
+    return brighten_color(base_color, brightness + 0.5f);
+}
+
+/* Solid white disc; tinted per blit */
+static uint32_t disc_texel(int dx, int dy, void *ctx) {
+    const RoundSprite *disc = ctx;
+    return sqrtf(dx * dx + dy * dy) <= disc->radius ? 0xFFFFFFFFu : 0;
+}
+
+typedef struct {
+    float points[20];          /* Outline, (x, y) pairs from the centre */
+    float radius;
+} StarSprite;
+
+/* The star's outline with exact edge coverage, shading off towards the points; tinted per blit */
+static uint32_t star_texel(int dx, int dy, void *ctx) {
+    const StarSprite *star = ctx;
+    float dist = sqrtf(dx * dx + dy * dy);
+    if (dist > star->radius + 1) return 0;
+    
+    uint32_t alpha = (uint32_t)(sprite_polygon_coverage(star->points, 10, dx - 0.5f, dy - 0.5f) * 255 + 0.5f);
+    if (!alpha) return 0;
+    
+    float shade = 1.0f - (1.0f - STAR_TIP_SHADE) * fminf(dist / star->radius, 1.0f);
+    return alpha << 24 | (uint32_t)(alpha * shade + 0.5f) * 0x010101u;
+}
+
+/* What takes the star centre from its colour to white, added on top of the disc */
+static uint32_t shine_texel(int dx, int dy, void *ctx) {
+    const RoundSprite *shine = ctx;
+    float dist = sqrtf(dx * dx + dy * dy);
+    if (dist > shine->radius) return 0;
+    
+    float brightness = pow_lut(&pow_half, 1.0f - dist / shine->radius);
+    uint32_t out = 0;
+    for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t headroom = 0xFF - ((shine->color >> shift) & 0xFF);
+        out |= (uint32_t)(headroom * brightness) << shift;
+    }
+    return out;
+}
+
+typedef struct {
+    int size;                  /* Snowflake size, 1 to 3 */
+    int cell;                  /* Pixels per scene pixel */
+} SnowflakeSprite;
+
+/* Snowflake drawn in scene pixels; the origin is the top left of its centre cell */
+static uint32_t snowflake_texel(int dx, int dy, void *ctx) {
+    const SnowflakeSprite *flake = ctx;
+    int cx = (dx + flake->cell) / flake->cell - 1;
+    int cy = (dy + flake->cell) / flake->cell - 1;
+    uint32_t snow_color = 0xFFFFFFFF;
+    uint32_t snow_dim = 0xFFCCCCCC;
+    
+    if (flake->size == 1) {
+        return cx == 0 && cy == 0 ? snow_color : 0;
+    }
+    if (flake->size == 2) {
+        if (cy != 0) return 0;
+        return cx == 0 ? snow_color : snow_dim;
+    }
+    /* Larger snowflake - star shape */
+    return cx == 0 || cy == 0 ? snow_color : snow_dim;
+}
+
+/* Add a square sprite of the given radius centred on its origin */
+static int add_round_sprite(int radius, uint32_t color, SpriteTexel texel) {
+    RoundSprite ctx = { radius, color };
+    return sprite_atlas_add(sprites.atlas, 2 * radius + 1, 2 * radius + 1,
+                            radius, radius, texel, &ctx);
+}
+
+/* (Re)draw the sprites when the target scale changed, or its width, which the forest layer spans */
+static void update_sprites(void) {
+    if (sprites.atlas && sprites.width == fb_width && sprites.height == fb_height) return;
+    
+    sprite_atlas_destroy(sprites.atlas);
+    sprites.atlas = sprite_atlas_create(linear_light);
+    sprites.width = fb_width;
+    sprites.height = fb_height;
+    if (!sprites.atlas) return;
+    
+    for (int i = 0; i < MAX_ORNAMENTS; i++) {
+        sprites.ornament[i] = add_round_sprite(scene_len(ornaments[i].radius), ornaments[i].color, sphere_texel);
+    }
+    
+    sprites.light_core = add_round_sprite(scene_len(2), 0, disc_texel);
+    
+    StarSprite star = { .radius = STAR_RADIUS * scene_scale };
+    for (int k = 0; k < 10; k++) {
+        float angle = (k * 36 - 90) * (float)M_PI / 180;
+        float r = k & 1 ? star.radius * STAR_INNER : star.radius;
+        star.points[2 * k] = r * cosf(angle);
+        star.points[2 * k + 1] = r * sinf(angle);
+    }
+    int star_radius = (int)ceilf(star.radius) + 1;
+    sprites.star = sprite_atlas_add(sprites.atlas, 2 * star_radius + 1, 2 * star_radius + 1,
+                                    star_radius, star_radius, star_texel, &star);
+    sprites.star_shine = add_round_sprite(scene_len(8), STAR_CENTER_COLOR, shine_texel);
+    
+    /* Snowflakes are 1 or 3 cells wide, a cell being a scene pixel */
+    int cell = scene_scale > 1.0f ? (int)(scene_scale + 0.5f) : 1;
+    for (int size = 1; size <= 3; size++) {
+        SnowflakeSprite ctx = { size, cell };
+        sprites.snowflake[size - 1] = sprite_atlas_add(sprites.atlas, 3 * cell, 3 * cell,
+                                                       cell, cell, snowflake_texel, &ctx);
+    }
+    
+    for (int lod = 0; lod < IMPOSTOR_LODS; lod++) {
+        sprites.impostor[lod] = -1;
+    }
+    sprites.forest = -1;
+    sprites.forest_built = 0;
+}
+
+/* The undecorated tree, pixels_per_unit pixels per scene unit; origin at the trunk's foot */
+static uint32_t impostor_texel(int dx, int dy, void *ctx) {
+    float pixels_per_unit = *(const float *)ctx;
+    float u = (dx + 0.5f) / pixels_per_unit;
+    float v = TRUNK_BOTTOM + (dy + 0.5f) / pixels_per_unit;
+    return tree_color(u, v, still_noise(dx, dy));
+}
+
+static int impostor_sprite(int lod) {
+    if (sprites.impostor[lod] >= 0 || !sprites.atlas) return sprites.impostor[lod];
+    
+    int height = IMPOSTOR_MIN_HEIGHT << lod;
+    float pixels_per_unit = (float)height / (TRUNK_BOTTOM - TREE_TOP);
+    int half = (int)ceilf(TREE_HALF_WIDTH * pixels_per_unit);
+    sprites.impostor[lod] = sprite_atlas_add(sprites.atlas, 2 * half + 1, height, half, height,
+                                             impostor_texel, &pixels_per_unit);
+    sprites.impostor_width[lod] = 2 * half + 1;
+    return sprites.impostor[lod];
+}
+
+static void release_sprites(void) {
+    sprite_atlas_destroy(sprites.atlas);
+    sprites.atlas = NULL;
+}
+
+/* Blit a batch in order and account for the pixels it touched */
+static void blit_sprites(const SpriteBlit *blits, int count) {
+    if (!sprites.atlas) return;
+    
+    sprite_blit(sprites.atlas, blits, count, pixels, fb_width, fb_height);
+    if (!counting()) return;   /* Nobody reads the counts */
+    for (int i = 0; i < count; i++) {
+        uint32_t n = sprite_coverage(sprites.atlas, &blits[i], fb_width, fb_height, overdraw);
+        if (blits[i].mode == BLIT_OPAQUE) {
+            pixel_count.written += n;
+        } else {
+            pixel_count.blended += n;
+        }
+    }
+}
+
+/*
+ * Lights and the star glow through bloom: their cores are splatted into a
+ * quarter-resolution buffer that is blurred and added on top of the frame
+ * in one pass, whatever the number of lights. The blur follows the scene
+ * scale, so like the sprites it is per thread and per target size.
+ */
+#define BLOOM_SIGMA 6.0f               /* Scene pixels */
+#define LIGHT_BLOOM_GAIN 1.2f
+#define STAR_BLOOM_RADIUS 30
+#define STAR_BLOOM_GAIN 0.35f
+
+static __thread Bloom *bloom = NULL;
+static __thread int bloom_width = 0, bloom_height = 0;
+
+/* Recreate for a new target size and forget last frame's sources */
+static void update_bloom(void) {
+    if (!bloom || bloom_width != fb_width || bloom_height != fb_height) {
+        bloom_destroy(bloom);
+        bloom = bloom_create(fb_width, fb_height, BLOOM_SIGMA * scene_scale, linear_light);
+        bloom_width = fb_width;
+        bloom_height = fb_height;
+    }
+    if (bloom) bloom_clear(bloom);
+}
+
+static void release_bloom(void) {
+    bloom_destroy(bloom);
+    bloom = NULL;
+}
+
+static void emit_bloom(int x, int y, int radius, uint32_t color, float gain) {
+    if (bloom) bloom_emit(bloom, x, y, radius, brighten_color(color, gain));
+}
+
+/* Sky gradient colour of framebuffer row y */
+static uint32_t sky_row_color(int y) {
+    uint32_t sky_top = 0xFF0a0a2e;      /* Dark blue */
+    uint32_t sky_bottom = 0xFF1a1a4e;   /* Lighter blue */
+    
+    return blend_colors(sky_top, sky_bottom, (float)y / fb_height);
+}
+
+/* The gradient only depends on the target height; keep it per thread */
+static __thread uint32_t *sky_rows = NULL;
+static __thread int sky_rows_height = 0;
+
+static void update_sky_rows(void) {
+    if (sky_rows && sky_rows_height == fb_height) return;
+    
+    free(sky_rows);
+    sky_rows = malloc((size_t)fb_height * sizeof(*sky_rows));
+    if (!sky_rows) return;   /* render_sky blends per row instead */
+    sky_rows_height = fb_height;
+    
+    for (int y = 0; y < fb_height; y++) {
+        sky_rows[y] = sky_row_color(y);
+    }
+}
+
+static void release_sky_rows(void) {
+    free(sky_rows);
+    sky_rows = NULL;
+}
+
+/* Render gradient night sky with stars */
+static void render_sky(void) {
+    update_sky_rows();
+    
+    for (int y = 0; y < fb_height; y++) {
+        uint32_t color = sky_rows ? sky_rows[y] : sky_row_color(y);
+        Span spans[2];
+        visible_spans(SHAPE_SKY, y, spans);
+        
+        for (int i = 0; i < 2; i++) {
+            for (int x = spans[i].x0; x < spans[i].x1; x++) {
+                pixels[y * fb_width + x] = color;
+            }
+            if (spans[i].x0 < spans[i].x1) count_span(y * fb_width + spans[i].x0, spans[i].x1 - spans[i].x0);
+        }
+    }
+    
+    /* Add twinkling stars, spread across however wide the scene is */
+    float spread = (scene_right - scene_left) / WIDTH;
+    for (int i = 0; i < NUM_SKY_STARS; i++) {
+        int x = (int)(scene_left + sky_stars[i].x * spread);
+        int y = sky_stars[i].y;
+        
+        /* Twinkle based on frame */
+        float twinkle = lut_sin(sim.frame * TWINKLE_STEP + sky_stars[i].phase) * 0.5f + 0.5f;
+        uint32_t brightness = (uint32_t)(200 + 55 * twinkle);
+        uint32_t color = 0xFF000000 | (brightness << 16) | (brightness << 8) | brightness;
+        
+        put_cell(x, y, color);
+        if (twinkle > 0.7f) {
+            /* Larger star */
+            uint32_t halo = darken_color(color, 0.5f);
+            put_cell(x - 1, y, halo);
+            put_cell(x + 1, y, halo);
+            put_cell(x, y - 1, halo);
+            put_cell(x, y + 1, halo);
+        }
+    }
+}
+
+/* Render snow-covered ground */
+static void render_ground(void) {
+    for (int y = scene_y(GROUND_TOP); y < fb_height; y++) {
+        float height_factor = (y / scene_scale - GROUND_TOP) / (HEIGHT - GROUND_TOP);
+        Span spans[2];
+        visible_spans(SHAPE_GROUND, y, spans);
+        
+        for (int i = 0; i < 2; i++) {
+            for (int x = spans[i].x0; x < spans[i].x1; x++) {
+                /* Add texture variation */
+                float noise = pixel_noise(x, y) * 0.1f;
+                uint32_t color = blend_ramp(&ground_ramp, SNOW_WHITE_COLOR, SNOW_SHADOW_COLOR, height_factor * 0.3f + noise);
+                pixels[y * fb_width + x] = color;
+            }
+            if (spans[i].x0 < spans[i].x1) count_span(y * fb_width + spans[i].x0, spans[i].x1 - spans[i].x0);
+        }
+    }
+}
+
+/* Distant trees fade into the night: colour factor for a tree of this scale */
+static float forest_haze(float scale) {
+    return 0.45f + 0.55f * scale / FOREST_MAX_SCALE;
+}
+
+/* Fully rasterize a forest tree whose foot is at pixel (axis, base), pixels_per_unit pixels per scene unit */
+static void draw_forest_tree(int axis, int base, float pixels_per_unit, float haze) {
+    int half = (int)ceilf(TREE_HALF_WIDTH * pixels_per_unit);
+    int top = base - (int)ceilf((TRUNK_BOTTOM - TREE_TOP) * pixels_per_unit);
+    int x0 = axis - half < 0 ? 0 : axis - half;
+    int x1 = axis + half + 1 > fb_width ? fb_width : axis + half + 1;
+    int y0 = top < 0 ? 0 : top;
+    int y1 = base > fb_height ? fb_height : base;
+    
+    for (int y = y0; y < y1; y++) {
+        float v = TRUNK_BOTTOM - (base - y - 0.5f) / pixels_per_unit;
+        for (int x = x0; x < x1; x++) {
+            uint32_t color = tree_color((x - axis + 0.5f) / pixels_per_unit, v, still_noise(x, y));
+            if (!color) continue;
+            
+            int i = y * fb_width + x;
+            uint32_t alpha = color >> 24;
+            if (alpha == 0xFF) {
+                pixels[i] = darken_color(color, haze);
+                continue;
+            }
+            
+            /* Snow overhang, premultiplied over whatever is there */
+            uint32_t out = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                uint32_t src = ((color >> shift) & 0xFF) * (shift < 24 ? haze : 1.0f);
+                out |= (src + ((pixels[i] >> shift) & 0xFF) * (255 - alpha) / 255) << shift;
+            }
+            pixels[i] = out;
+        }
+    }
+}
+
+/*
+ * Far to near: trees up to IMPOSTOR_MAX_HEIGHT pixels tall are resized
+ * blits of the smallest impostor at least that tall, batched; nearer ones
+ * are rasterized like the decorated tree, after flushing the batch.
+ */
+static void draw_forest(void) {
+    SpriteBlit blits[64];
+    int count = 0;
+    float spread = scene_right - scene_left;
+    
+    for (int i = 0; i < forest_size; i++) {
+        const TreeInstance *tree = &forest[i];
+        float pixels_per_unit = tree->scale * scene_scale;
+        float haze = forest_haze(tree->scale);
+        int axis = scene_x(scene_left + tree->x * spread);
+        int base = scene_y(tree->base_y);
+        int height = (int)((TRUNK_BOTTOM - TREE_TOP) * pixels_per_unit + 0.5f);
+        if (height < 1) continue;
+        
+        if (height > IMPOSTOR_MAX_HEIGHT) {
+            blit_sprites(blits, count);
+            count = 0;
+            draw_forest_tree(axis, base, pixels_per_unit, haze);
+            continue;
+        }
+        
+        int lod = 0;
+        while ((IMPOSTOR_MIN_HEIGHT << lod) < height) lod++;
+        int sprite = impostor_sprite(lod);
+        int width = (int)((int64_t)sprites.impostor_width[lod] * height / (IMPOSTOR_MIN_HEIGHT << lod));
+        uint32_t tint = 0xFF000000 | (uint32_t)(haze * 255) * 0x010101u;
+        blits[count++] = (SpriteBlit){ sprite, axis, base, BLIT_OVER, tint, width > 0 ? width : 1, height };
+        
+        if (count == (int)(sizeof(blits) / sizeof(blits[0]))) {
+            blit_sprites(blits, count);
+            count = 0;
+        }
+    }
+    blit_sprites(blits, count);
+}
+
+typedef struct {
+    const uint32_t *pixels;
+    int width;
+} ForestLayer;
+
+/* The origin is the target's top left, so (dx, dy) is a target pixel */
+static uint32_t forest_layer_texel(int dx, int dy, void *ctx) {
+    const ForestLayer *layer = ctx;
+    return layer->pixels[(size_t)dy * layer->width + dx];
+}
+
+static int row_is_clear(const uint32_t *row, int width) {
+    for (int x = 0; x < width; x++) {
+        if (row[x]) return 0;
+    }
+    return 1;
+}
+
+/*
+ * The forest never moves, so it is drawn once per target size into a clear
+ * buffer and the rows holding trees become one more sprite; each frame
+ * is then a single blit. Counts are taken from that blit, not the build.
+ */
+static void update_forest_layer(void) {
+    if (!sprites.atlas || sprites.forest_built) return;
+    
+    uint32_t *layer = calloc((size_t)fb_width * fb_height, sizeof(uint32_t));
+    if (!layer) return;
+    
+    uint32_t *target = pixels;
+    uint8_t *counts = overdraw;
+    uint64_t written = pixel_count.written, blended = pixel_count.blended;
+    pixels = layer;
+    overdraw = NULL;
+    draw_forest();
+    pixels = target;
+    overdraw = counts;
+    pixel_count.written = written;
+    pixel_count.blended = blended;
+    
+    int top = 0, bottom = fb_height;
+    while (top < bottom && row_is_clear(layer + (size_t)top * fb_width, fb_width)) top++;
+    while (bottom > top && row_is_clear(layer + (size_t)(bottom - 1) * fb_width, fb_width)) bottom--;
+    
+    ForestLayer ctx = { layer, fb_width };
+    sprites.forest = sprite_atlas_add(sprites.atlas, fb_width, bottom - top, 0, -top, forest_layer_texel, &ctx);
+    sprites.forest_built = 1;
+    free(layer);
+}
+
+static void render_forest(void) {
+    if (forest_size == 0) return;
+    
+    update_forest_layer();
+    SpriteBlit blit = { sprites.forest, 0, 0, BLIT_OVER, 0xFFFFFFFF };
+    blit_sprites(&blit, 1);
+}
+
+/* Per-thread rasterizer state for the tree mesh, sized to the target */
+static __thread MeshRaster *mesh_raster = NULL;
+static __thread int mesh_raster_width = 0, mesh_raster_height = 0;
+
+static void release_mesh_raster(void) {
+    mesh_raster_destroy(mesh_raster);
+    mesh_raster = NULL;
+}
+
+/* How far the tree has turned */
+static Phase tree_spin(void) {
+    return sim.frame * TREE_SPIN_STEP;
+}
+
+/*
+ * Where the decoration hung at scene (x, y) on the flat tree is now, in
+ * scene coordinates; 0 while it is round the back. On the mesh the flat
+ * tree's width wraps all the way round the outermost layer, centre to
+ * the front and both edges meeting at the back, and turns with it.
+ */
+static int place_decoration(int x, int y, float *out_x, float *out_y) {
+    *out_x = x;
+    *out_y = y;
+    if (!tree_mesh) return 1;
+    
+    float radius = 1.0f;
+    for (size_t l = 0; l < NUM_TREE_LAYERS; l++) {
+        int top_y = TREE_LAYERS[l].top_y;
+        if (y < top_y || y >= TREE_LAYERS[l].bottom_y) continue;
+        float r = (float)(y - top_y) / (TREE_LAYERS[l].bottom_y - top_y) * TREE_LAYERS[l].width;
+        if (r > radius) radius = r;
+    }
+    
+    float around = (x - TREE_CENTER_X) / radius;
+    if (around < -1) around = -1;
+    if (around > 1) around = 1;
+    Phase angle = (Phase)(int64_t)(around * 2147483648.0f) - tree_spin();
+    
+    float facing = lut_cos(angle);
+    if (facing < DECORATION_HIDE) return 0;
+    
+    float perspective = MESH_CAMERA_DISTANCE / (MESH_CAMERA_DISTANCE - radius * facing);
+    *out_x = TREE_CENTER_X + radius * lut_sin(angle) * perspective;
+    *out_y = MESH_CAMERA_Y + (y - MESH_CAMERA_Y) * perspective;
+    return 1;
+}
+
+/* Draw the tree mesh as it has turned by now */
+static void render_tree_mesh(void) {
+    if (!mesh_raster || mesh_raster_width != fb_width || mesh_raster_height != fb_height) {
+        mesh_raster_destroy(mesh_raster);
+        mesh_raster = mesh_raster_create(fb_width, fb_height);
+        mesh_raster_width = fb_width;
+        mesh_raster_height = fb_height;
+    }
+    if (!mesh_raster) return;
+    
+    /* Turn about the axis; the camera looks at it from MESH_CAMERA_DISTANCE in front */
+    float c = lut_cos(tree_spin()), s = lut_sin(tree_spin());
+    MeshView view = {
+        .rotation = { { c, 0, s }, { 0, 1, 0 }, { -s, 0, c } },
+        .offset = { 0, -MESH_CAMERA_Y, MESH_CAMERA_DISTANCE },
+        .focal = MESH_CAMERA_DISTANCE * scene_scale,
+        .center_x = (TREE_CENTER_X - scene_left) * scene_scale,
+        .center_y = MESH_CAMERA_Y * scene_scale,
+        .light = { MESH_LIGHT[0], MESH_LIGHT[1], MESH_LIGHT[2] },
+        .ambient = MESH_AMBIENT,
+    };
+    pixel_count.written += mesh_draw(mesh_raster, tree_mesh, &view, pixels, overdraw);
+}
+
+/* Render the 3D Christmas tree */
+static void render_tree(void) {
+    int center_x = scene_x(TREE_CENTER_X);
+    
+    render_forest();
+    if (tree_mesh) {
+        render_tree_mesh();
+        return;
+    }
+    
+    /* Draw multiple overlapping triangle layers, each only where the ones in front leave it visible */
+    for (size_t l = 0; l < NUM_TREE_LAYERS; l++) {
+        int top_y = TREE_LAYERS[l].top_y;
+        int bottom_y = TREE_LAYERS[l].bottom_y;
+        int half_width = TREE_LAYERS[l].width;
+        int height = bottom_y - top_y;
+        
+        for (int y = scene_y(top_y); y < scene_y(bottom_y); y++) {
+            if (y < 0 || y >= fb_height) continue;
+            
+            float t = (y / scene_scale - top_y) / height;
+            int width_at_y = tree_layer_half_width(l, y);
+            Span spans[2];
+            visible_spans(SHAPE_TREE_LAYER + l, y, spans);
+            
+            for (int i = 0; i < 2; i++) {
+                for (int x = spans[i].x0; x < spans[i].x1; x++) {
+                    int dx = x - center_x;
+                    float shade = (float)dx / width_at_y;  /* -1 to 1 */
+                    
+                    pixels[y * fb_width + x] = tree_layer_color(shade, t, pixel_noise(x, y));
+                }
+                if (spans[i].x0 < spans[i].x1) count_span(y * fb_width + spans[i].x0, spans[i].x1 - spans[i].x0);
+            }
+        }
+        
+        /* Add "snow" on layer edges */
+        int snow_y = scene_y(top_y + 10);
+        int snow_width = scene_len(0.08f * half_width);
+        for (int dx = -snow_width; dx <= snow_width; dx++) {
+            int x = center_x + dx;
+            if (x < 0 || x >= fb_width) continue;
+            
+            /* dist grows with dy, so what gets blended is one run down the column */
+            int first = 0, n = 0;
+            for (int dy = 0; dy < scene_len(8); dy++) {
+                int y = snow_y + dy;
+                if (y < 0 || y >= fb_height) continue;
+                
+                float dist = sqrtf(dx * dx + dy * dy) / scene_scale;
+                if (dist < 10) {
+                    uint32_t snow = blend_colors(pixels[y * fb_width + x], 0xFFFFFFFF, 0.6f - dist * 0.05f);
+                    pixels[y * fb_width + x] = snow;
+                    if (!n++) first = y;
+                }
+            }
+            if (n && counting()) count_run(&pixel_count.blended, first * fb_width + x, n, fb_width);
+        }
+    }
+    
+    /* Draw trunk */
+    int trunk_half = scene_len(TRUNK_HALF_WIDTH);
+    
+    int trunk_x0 = center_x - trunk_half < 0 ? 0 : center_x - trunk_half;
+    int trunk_x1 = center_x + trunk_half + 1 > fb_width ? fb_width : center_x + trunk_half + 1;
+    
+    for (int y = scene_y(TRUNK_TOP); y < scene_y(TRUNK_BOTTOM); y++) {
+        if (y < 0 || y >= fb_height || trunk_x0 >= trunk_x1) continue;
+        int grain_y = (int)(y / scene_scale);
+        for (int x = trunk_x0; x < trunk_x1; x++) {
+            int dx = x - center_x;
+            float shade = 1.0f - fabsf((float)dx / trunk_half);
+            pixels[y * fb_width + x] = trunk_color(shade, grain_y, pixel_noise(x, y));
+        }
+        count_span(y * fb_width + trunk_x0, trunk_x1 - trunk_x0);
+    }
+}
+
+/* Render golden star on top */
+static void render_star(void) {
+    int cx = 400, cy = 95;
+    
+    /* Animated glow */
+    float pulse = lut_sin(sim.frame * STAR_PULSE_STEP) * 0.3f + 0.7f;
+    
+    /* Outer glow comes from the bloom pass */
+    int px = scene_x(cx), py = scene_y(cy);
+    emit_bloom(px, py, scene_len(STAR_BLOOM_RADIUS), STAR_CENTER_COLOR, pulse * STAR_BLOOM_GAIN);
+    
+    /* The pre-drawn star tinted by the pulse, its centre brightened towards white */
+    uint32_t star_color = blend_colors(STAR_CENTER_COLOR, STAR_BRIGHT_COLOR, pulse);
+    uint32_t shine = (uint32_t)(pulse * 255) * 0x01010101u;
+    SpriteBlit star[] = {
+        { sprites.star, px, py, BLIT_OVER, star_color },
+        { sprites.star_shine, px, py, BLIT_ADD, shine },
+    };
+    blit_sprites(star, 2);
+}
+
+/* Render ornaments */
+static void render_ornaments(void) {
+    SpriteBlit blits[MAX_ORNAMENTS];
+    int count = 0;
+    
+    for (int i = 0; i < MAX_ORNAMENTS; i++) {
+        float x, y;
+        if (!place_decoration(ornaments[i].x, ornaments[i].y, &x, &y)) continue;
+        blits[count++] = (SpriteBlit){ sprites.ornament[i], scene_x(x), scene_y(y), BLIT_OVER, 0xFFFFFFFF };
+        
+        /* Add hanging string; it ends above the ornament, so draw it first */
+        uint32_t string_color = 0xFF444444;
+        for (int dy = -15; dy < 0; dy++) {
+            float wave = lut_sinf(dy * 0.3f + ornaments[i].x * 0.1f) * 2;
+            put_cell((int)floorf(x) + (int)wave, 
+                     (int)floorf(y) + dy - ornaments[i].radius, 
+                     string_color);
+        }
+    }
+    
+    blit_sprites(blits, count);
+}
+
+/* Where light i is in framebuffer pixels and how bright; 0 while it is off or round the back */
+static int light_state(int i, int *x, int *y, float *intensity) {
+    /* Calculate if light is "on" or "off" based on time and phase */
+    float phase = lut_sin(sim.frame * LIGHT_BLINK_STEP + (Phase)lights[i].phase * LIGHT_PHASE_STEP);
+    if (phase <= -0.3f) return 0;
+    
+    float lx, ly;
+    if (!place_decoration(lights[i].x, lights[i].y, &lx, &ly)) return 0;
+    *x = scene_x(lx);
+    *y = scene_y(ly);
+    *intensity = pow_lut(&pow_half, (phase + 0.3f) / 1.3f);
+    return 1;
+}
+
+/* Render twinkling lights */
+static void render_lights(void) {
+    SpriteBlit blits[LIGHT_BATCH];
+    
+    for (int first = 0; first < num_lights; first += LIGHT_BATCH) {
+        int end = num_lights - first < LIGHT_BATCH ? num_lights : first + LIGHT_BATCH;
+        int count = 0;
+        for (int i = first; i < end; i++) {
+            int x, y;
+            float intensity;
+            if (!light_state(i, &x, &y, &intensity)) continue;
+            
+            /* Bright center now, glow in the bloom pass */
+            uint32_t bright_color = blend_colors(lights[i].color, 0xFFFFFFFF, intensity * 0.5f);
+            blits[count++] = (SpriteBlit){ sprites.light_core, x, y, BLIT_OVER, bright_color };
+            emit_bloom(x, y, scene_len(lights[i].radius), lights[i].color, intensity * LIGHT_BLOOM_GAIN);
+        }
+        blit_sprites(blits, count);
+    }
+}
+
+/*
+ * The lights also light the needles around them: each light that is on
+ * brightens the tree within LIGHT_REACH bulb radii in its own colour,
+ * through a light grid that only visits the lights near each tile. The
+ * tree's pixels are given per row: the flat tree's outline, or what the
+ * mesh drew this frame. Per thread and per target size, like bloom.
+ */
+#define LIGHT_REACH 8                  /* Bulb radii */
+#define LIGHT_DIFFUSE_GAIN 0.9f
+
+static __thread LightGrid *light_grid = NULL;
+static __thread LightSpan *tree_rows = NULL;
+static __thread int light_grid_width = 0, light_grid_height = 0;
+
+static void release_light_grid(void) {
+    light_grid_destroy(light_grid);
+    light_grid = NULL;
+    free(tree_rows);
+    tree_rows = NULL;
+}
+
+/* Pixels of row y the tree covers, including the gaps between its parts */
+static LightSpan tree_row_span(int y) {
+    LightSpan row = { fb_width, 0 };
+    
+    if (tree_mesh) {
+        if (!mesh_raster || !mesh_row_extent(mesh_raster, y, &row.x0, &row.x1)) row = (LightSpan){ 0, 0 };
+        return row;
+    }
+    for (int shape = SHAPE_TREE_LAYER; shape <= SHAPE_TRUNK; shape++) {
+        Span span;
+        if (!shape_span(shape, y, &span)) continue;
+        if (span.x0 < row.x0) row.x0 = span.x0;
+        if (span.x1 > row.x1) row.x1 = span.x1;
+    }
+    return row;
+}
+
+/* Light the tree from every light that is on */
+static void render_tree_lighting(void) {
+    if (!light_grid || light_grid_width != fb_width || light_grid_height != fb_height) {
+        release_light_grid();
+        light_grid = light_grid_create(fb_width, fb_height, linear_light);
+        tree_rows = malloc((size_t)fb_height * sizeof(*tree_rows));
+        light_grid_width = fb_width;
+        light_grid_height = fb_height;
+    }
+    if (!light_grid || !tree_rows) return;
+    
+    /* Past the default string the lights share out the same light between them */
+    float gain = LIGHT_DIFFUSE_GAIN;
+    if (num_lights > DEFAULT_LIGHTS) gain *= (float)DEFAULT_LIGHTS / num_lights;
+    
+    light_grid_clear(light_grid);
+    for (int i = 0; i < num_lights; i++) {
+        int x, y;
+        float intensity;
+        if (!light_state(i, &x, &y, &intensity)) continue;
+        
+        uint32_t color = darken_color(lights[i].color, intensity * gain);
+        if (!light_grid_add(light_grid, x, y, scene_len(lights[i].radius * LIGHT_REACH), color)) break;
+    }
+    
+    for (int y = 0; y < fb_height; y++) {
+        tree_rows[y] = tree_row_span(y);
+    }
+    pixel_count.blended += light_grid_apply(light_grid, pixels, tree_rows, overdraw);
+}
+
+/*
+ * Drifts are drawn from a per-thread cache holding, per framebuffer
+ * column, the rows its snow covers and their colours. The cache follows
+ * sim.landings: while it is at most SNOW_LOG landings behind, only the
+ * columns those landings touched are redrawn, each once however many
+ * landed on it. Anything else, such as a new target size or seeking
+ * backwards, redraws every column. The passes beneath repaint the frame
+ * every time, so the cached rows are copied back each frame, but only
+ * across the columns that have ever held snow.
+ */
+#define DRIFT_TOP_COLOR 0xFFFAFCFF
+#define DRIFT_SHADOW_COLOR 0xFFC4D4EA
+
+static __thread struct {
+    int width, height;
+    float left;                        /* sim.left it was drawn for */
+    uint32_t landings;                 /* sim.landings it shows */
+    int rows;                          /* Room per column in color */
+    int *top, *bottom;                 /* Per column, rows [top, bottom) */
+    uint32_t *color;                   /* Per column, rows entries from its top */
+    uint8_t *dirty;                    /* Per column, to redraw */
+    int x0, x1;                        /* Columns that may hold snow; empty if x0 >= x1 */
+} drifts;
+
+static void release_drifts(void) {
+    free(drifts.top);
+    free(drifts.bottom);
+    free(drifts.color);
+    free(drifts.dirty);
+    drifts.top = drifts.bottom = NULL;
+    drifts.color = NULL;
+    drifts.dirty = NULL;
+}
+
+/* Redraw the cached snow of framebuffer column x */
+static void draw_drift_column(int x) {
+    float u = scene_left + (x + 0.5f) / scene_scale;
+    int c = (int)floorf(u - sim.left);
+    drifts.top[x] = drifts.bottom[x] = 0;
+    if (c < 0 || c >= snow_columns || sim.snow_depth[c] == 0) return;
+    
+    /* Follow the exact outline underneath rather than the column's */
+    int capacity;
+    float floor_y = snow_surface(u, &capacity);
+    int bottom = scene_y(floor_y);
+    int top = scene_y(floor_y - (float)sim.snow_depth[c] / SNOW_UNITS);
+    if (bottom > fb_height) bottom = fb_height;
+    if (top < bottom - drifts.rows) top = bottom - drifts.rows;
+    if (top < 0) top = 0;
+    if (top >= bottom) return;
+    
+    drifts.top[x] = top;
+    drifts.bottom[x] = bottom;
+    if (x < drifts.x0) drifts.x0 = x;
+    if (x >= drifts.x1) drifts.x1 = x + 1;
+    uint32_t *color = drifts.color + (size_t)x * drifts.rows;
+    for (int y = top; y < bottom; y++) {
+        float shade = (float)(y - top) / (bottom - top) * 0.5f + still_noise(x, y) * 0.15f;
+        color[y - top] = blend_colors(DRIFT_TOP_COLOR, DRIFT_SHADOW_COLOR, shade);
+    }
+}
+
+/* Bring the cache up to this thread's simulation; 0 without one */
+static int update_drifts(void) {
+    int rebuild = drifts.left != sim.left || sim.landings < drifts.landings ||
+                  sim.landings - drifts.landings > SNOW_LOG;
+    
+    if (!drifts.top || drifts.width != fb_width || drifts.height != fb_height) {
+        release_drifts();
+        drifts.rows = scene_len(SNOW_GROUND_DEPTH / SNOW_UNITS) + 2;
+        drifts.top = malloc((size_t)fb_width * sizeof(int));
+        drifts.bottom = malloc((size_t)fb_width * sizeof(int));
+        drifts.color = malloc((size_t)fb_width * drifts.rows * sizeof(uint32_t));
+        drifts.dirty = calloc(fb_width, 1);
+        if (!drifts.top || !drifts.bottom || !drifts.color || !drifts.dirty) {
+            release_drifts();
+            return 0;
+        }
+        drifts.width = fb_width;
+        drifts.height = fb_height;
+        rebuild = 1;
+    }
+    
+    if (rebuild) {
+        drifts.x0 = fb_width;
+        drifts.x1 = 0;
+        for (int x = 0; x < fb_width; x++) {
+            draw_drift_column(x);
+        }
+    } else if (drifts.landings != sim.landings) {
+        /* Landings pile up where the snow already lies; mark, then redraw each column once */
+        int first = fb_width, last = 0;
+        for (uint32_t i = drifts.landings; i != sim.landings; i++) {
+            int c = sim.landed[i % SNOW_LOG];
+            int x0 = scene_x(sim.left + c - SNOW_SPREAD);
+            int x1 = scene_x(sim.left + c + SNOW_SPREAD + 1) + 1;
+            if (x0 < 0) x0 = 0;
+            if (x1 > fb_width) x1 = fb_width;
+            if (x0 >= x1) continue;
+            memset(drifts.dirty + x0, 1, x1 - x0);
+            if (x0 < first) first = x0;
+            if (x1 > last) last = x1;
+        }
+        for (int x = first; x < last; x++) {
+            if (!drifts.dirty[x]) continue;
+            drifts.dirty[x] = 0;
+            draw_drift_column(x);
+        }
+    }
+    drifts.left = sim.left;
+    drifts.landings = sim.landings;
+    return 1;
+}
+
+/* Render the snow that has settled */
+static void render_drifts(void) {
+    if (!update_drifts()) return;
+    
+    int counted = counting();
+    for (int x = drifts.x0; x < drifts.x1; x++) {
+        const uint32_t *color = drifts.color + (size_t)x * drifts.rows;
+        for (int y = drifts.top[x]; y < drifts.bottom[x]; y++) {
+            pixels[y * fb_width + x] = color[y - drifts.top[x]];
+        }
+        if (counted && drifts.top[x] < drifts.bottom[x]) {
+            count_run(&pixel_count.written, drifts.top[x] * fb_width + x, drifts.bottom[x] - drifts.top[x], fb_width);
+        }
+    }
+}
+
+/* Render falling snow */
+static void render_snow(void) {
+    SpriteBlit blits[SNOW_BATCH];
+    int count;
+    
+    for (uint32_t first = 0; first < sim.num_snowflakes; first += count) {
+        const Snowflake *run = snowflake_run(first, &count);
+        for (int i = 0; i < count; i++) {
+            const Snowflake *s = &run[i];
+            int x = (int)floorf(s->x);
+            int y = (int)s->y;
+            int size = s->size;
+            
+            /* Draw snowflake based on size */
+            if (size < 1) size = 1;
+            if (size > 3) size = 3;
+            blits[i] = (SpriteBlit){ sprites.snowflake[size - 1], scene_x(x), scene_y(y), BLIT_OVER, 0xFFFFFFFF };
+        }
+        blit_sprites(blits, count);
+    }
+}
+
+/* Add the blurred glow of everything emitted this frame */
+static void render_bloom(void) {
+    if (bloom) pixel_count.blended += bloom_apply(bloom, pixels, overdraw);
+}
+
+/* Top of the snow lying in column c, in scene y */
+static float snow_top(int c) {
+    return snow_floor[c] - (float)sim.snow_depth[c] / SNOW_UNITS;
+}
+
+/* Move up to amount units of snow from column from to column to, as far as to holds it */
+static void slide_snow(int from, int to, int amount) {
+    int room = snow_capacity[to] - sim.snow_depth[to];
+    if (amount > room) amount = room;
+    sim.snow_depth[from] -= amount;
+    sim.snow_depth[to] += amount;
+}
+
+/* A flake of this size comes to rest in column c: a small mound whose sides slide off if too steep */
+static void land_flake(int c, int size) {
+    uint8_t *depth = sim.snow_depth;
+    
+    for (int i = c - 1; i <= c + 1; i++) {
+        if (i < 0 || i >= snow_columns) continue;
+        int total = depth[i] + (i == c ? 4 * size : 2 * size);
+        depth[i] = total > snow_capacity[i] ? snow_capacity[i] : total;
+    }
+    
+    /* Only on level ground; what lies on the tree stays on its own column */
+    for (int dir = -1; dir <= 1; dir += 2) {
+        for (int i = c; i != c + 2 * dir; i += dir) {
+            int next = i + dir;
+            if (i < 0 || i >= snow_columns || next < 0 || next >= snow_columns) continue;
+            if (snow_floor[next] != snow_floor[i] || depth[i] <= depth[next] + SNOW_STEP) continue;
+            slide_snow(i, next, (depth[i] - depth[next] - SNOW_STEP + 1) / 2);
+        }
+    }
+    
+    sim.landed[sim.landings % SNOW_LOG] = (uint16_t)c;
+    sim.landings++;
+}
+
+/* Advance the simulation by one tick */
+static void update_animation(void) {
+    sim.frame++;
+    
+    /* This tick's wind where each flake is */
+    float span = sim.right - sim.left;
+    if (wind.x0 != sim.left || wind.width != span) wind_init(&wind, SIM_SEED, sim.left, 0, span, HEIGHT);
+    wind_update(&wind, sim.frame);
+    
+    int count;
+    for (uint32_t first = 0; first < sim.num_snowflakes; first += count) {
+        Snowflake *run = snowflake_run(first, &count);
+        float x[SNOW_BATCH], y[SNOW_BATCH], wind_x[SNOW_BATCH], wind_y[SNOW_BATCH];
+        for (int i = 0; i < count; i++) {
+            x[i] = run[i].x;
+            y[i] = run[i].y;
+        }
+        wind_sample(&wind, x, y, wind_x, wind_y, count);
+        
+        /* Update snowflakes */
+        for (int i = 0; i < count; i++) {
+            Snowflake *s = &run[i];
+            float was = s->y;
+            float fall = s->speed + wind_y[i] * WIND_LIFT;
+            s->y += fall > s->speed * MIN_FALL ? fall : s->speed * MIN_FALL;
+            s->x += s->drift + wind_x[i];
+            
+            /* Settle where it reaches the snow's surface from above; flakes starting below it fall through */
+            int c = (int)(s->x - sim.left);
+            int landed = c >= 0 && c < snow_columns && was < snow_top(c) && s->y >= snow_top(c);
+            if (landed) land_flake(c, s->size);
+            
+            /* Landed or fell out of view: start again from the top */
+            if (landed || s->y > HEIGHT) {
+                s->y = -10;
+                s->x = sim.left + fast_random(&sim.rng) * span;
+            }
+            if (s->x < sim.left) s->x += span;
+            if (s->x >= sim.right) s->x -= span;
+        }
+    }
+}
+
+static void sim_snapshot(SimState *out) {
+    *out = sim;
+}
+
+static void sim_restore(const SimState *state) {
+    sim = *state;
+}
+
+/* Keep the current state if it is the next checkpoint nobody has stored yet */
+static void record_checkpoint(void) {
+    pthread_mutex_lock(&checkpoint_lock);
+    if (sim.frame == num_checkpoints * SIM_CHECKPOINT_INTERVAL) {
+        if (num_checkpoints == max_checkpoints) {
+            uint32_t max = max_checkpoints ? max_checkpoints * 2 : 16;
+            SimState *grown = realloc(checkpoints, max * sizeof(SimState));
+            if (grown) {
+                checkpoints = grown;
+                max_checkpoints = max;
+            }
+        }
+        if (num_checkpoints < max_checkpoints) {
+            checkpoints[num_checkpoints++] = sim;
+        }
+    }
+    pthread_mutex_unlock(&checkpoint_lock);
+}
+
+/*
+ * Bring this thread's state to tick `frame`: continue from the current
+ * state when that is closest, otherwise restore the nearest checkpoint at
+ * or before it. Checkpoints passed on the way are stored for other threads.
+ * The result is identical to stepping from the origin.
+ */
+static void sim_seek(uint32_t frame) {
+    pthread_mutex_lock(&checkpoint_lock);
+    if (num_checkpoints > 0) {
+        uint32_t slot = frame / SIM_CHECKPOINT_INTERVAL;
+        if (slot >= num_checkpoints) slot = num_checkpoints - 1;
+        if (sim.frame > frame || checkpoints[slot].frame > sim.frame) {
+            sim = checkpoints[slot];
+        }
+    }
+    pthread_mutex_unlock(&checkpoint_lock);
+    
+    while (sim.frame < frame) {
+        update_animation();
+        if (sim.frame % SIM_CHECKPOINT_INTERVAL == 0) record_checkpoint();
+    }
+}
+
+/* Start a fresh simulation; its initial state becomes the first checkpoint */
+static void sim_init(float left, float right) {
+    init_snowflakes(left, right);
+    init_snow_floor(left, right);
+    
+    pthread_mutex_lock(&checkpoint_lock);
+    num_checkpoints = 0;
+    pthread_mutex_unlock(&checkpoint_lock);
+    record_checkpoint();
+}
+
+/* Quality tiers (--quality, or live over --control); each draws the passes of the ones below */
+#define QUALITY_LOW 0                  /* The scene */
+#define QUALITY_MEDIUM 1               /* Snow lying on it and glow */
+#define QUALITY_HIGH 2                 /* Light from the lights falling on the tree */
+static int quality = QUALITY_HIGH;
+
+/* Render passes in painter's order */
+static const struct {
+    const char *name;
+    void (*render)(void);
+    int quality;               /* Lowest tier that draws it */
+} render_passes[] = {
+    { "sky", render_sky, QUALITY_LOW },
+    { "ground", render_ground, QUALITY_LOW },
+    { "tree", render_tree, QUALITY_LOW },
+    { "drifts", render_drifts, QUALITY_MEDIUM },
+    { "lighting", render_tree_lighting, QUALITY_HIGH },
+    { "ornaments", render_ornaments, QUALITY_LOW },
+    { "lights", render_lights, QUALITY_LOW },
+    { "star", render_star, QUALITY_LOW },
+    { "bloom", render_bloom, QUALITY_MEDIUM },
+    { "snow", render_snow, QUALITY_LOW },
+};
+#define NUM_RENDER_PASSES (sizeof(render_passes) / sizeof(render_passes[0]))
+
+static __thread uint64_t pass_ns[NUM_RENDER_PASSES];
+
+/* Pixels written and blended per pass, summed over all rendering threads */
+static struct {
+    pthread_mutex_t lock;
+    uint64_t frames;
+    uint64_t pixels;
+    uint64_t written[NUM_RENDER_PASSES];
+    uint64_t blended[NUM_RENDER_PASSES];
+} pixel_totals = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread uint64_t frame_written;   /* Last frame, for the --stats line */
+
+/* Counters are per thread; every rendering thread adds into the totals */
+static __thread PerfCounters *perf_counters = NULL;
+static __thread int perf_counters_tried = 0;
+
+static struct {
+    pthread_mutex_t lock;
+    int warned;
+    unsigned mask;
+    uint64_t frames;
+    uint64_t pixels;
+    PerfSample pass[NUM_RENDER_PASSES];
+} perf_totals = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* This thread's counters, opened on first use; NULL when unavailable */
+static PerfCounters *thread_perf_counters(void) {
+    if (perf_counters_tried) return perf_counters;
+    perf_counters_tried = 1;
+    
+    char reason[160];
+    perf_counters = perf_counters_open(reason, sizeof(reason));
+    
+    pthread_mutex_lock(&perf_totals.lock);
+    if (perf_counters) {
+        perf_totals.mask |= perf_counters_mask(perf_counters);
+    } else if (!perf_totals.warned) {
+        perf_totals.warned = 1;
+        fprintf(stderr, "🔬 Hardware counters unavailable, rendering without them: %s\n", reason);
+    }
+    pthread_mutex_unlock(&perf_totals.lock);
+    
+    return perf_counters;
+}
+
+/* Called by threads that render and then exit */
+static void release_perf_counters(void) {
+    perf_counters_close(perf_counters);
+    perf_counters = NULL;
+    perf_counters_tried = 0;
+}
+
+/* Heatmap colours by write count: 0 black, 1 blue ... 7+ white */
+static const uint32_t OVERDRAW_COLORS[] = {
+    0xFF000000, 0xFF1030A0, 0xFF10A040, 0xFFA0C010,
+    0xFFF0A000, 0xFFF04000, 0xFFD00060, 0xFFFFFFFF
+};
+#define NUM_OVERDRAW_COLORS (sizeof(OVERDRAW_COLORS) / sizeof(OVERDRAW_COLORS[0]))
+
+/* Size and clear this thread's write counts for the current target */
+static int begin_overdraw(void) {
+    size_t size = (size_t)fb_width * fb_height;
+    if (size > overdraw_size) {
+        uint8_t *grown = realloc(overdraw, size);
+        if (!grown) return -1;
+        overdraw = grown;
+        overdraw_size = size;
+    }
+    memset(overdraw, 0, size);
+    return 0;
+}
+
+/* Replace the frame with its write counts */
+static void draw_overdraw_heatmap(void) {
+    size_t size = (size_t)fb_width * fb_height;
+    for (size_t i = 0; i < size; i++) {
+        uint8_t n = overdraw[i];
+        pixels[i] = OVERDRAW_COLORS[n < NUM_OVERDRAW_COLORS ? n : NUM_OVERDRAW_COLORS - 1];
+    }
+}
+
+/* Called by threads that render and then exit */
+static void release_overdraw(void) {
+    free(overdraw);
+    overdraw = NULL;
+    overdraw_size = 0;
+}
+
+/* Free what a thread built up for rendering; for threads about to exit */
+static void release_render_thread(void) {
+    release_perf_counters();
+    release_overdraw();
+    release_occlusion();
+    release_sky_rows();
+    release_sprites();
+    release_bloom();
+    release_mesh_raster();
+    release_light_grid();
+    release_drifts();
+}
+
+/* Render complete frame */
+static void render_frame(void) {
+    int timed = stats_mode || trace_enabled;
+    int counted = stats_mode || overdraw_mode;
+    PerfCounters *perf = perf_mode ? thread_perf_counters() : NULL;
+    PerfSample before, after, delta[NUM_RENDER_PASSES];
+    uint64_t written[NUM_RENDER_PASSES], blended[NUM_RENDER_PASSES];
+    
+    /* Sprites follow the target's scale; the scene is set up by now */
+    update_sprites();
+    update_bloom();
+    if (overdraw_mode && begin_overdraw() < 0) {
+        release_overdraw();
+    }
+    if (perf && perf_counters_read(perf, &before) < 0) perf = NULL;
+    
+    for (size_t i = 0; i < NUM_RENDER_PASSES; i++) {
+        uint64_t start = timed ? trace_now() : 0;
+        pixel_count.written = 0;
+        pixel_count.blended = 0;
+        if (quality >= render_passes[i].quality) render_passes[i].render();
+        written[i] = pixel_count.written;
+        blended[i] = pixel_count.blended;
+        
+        if (perf) {
+            if (perf_counters_read(perf, &after) < 0) {
+                perf = NULL;
+            } else {
+                perf_sample_delta(&delta[i], &after, &before);
+                before = after;
+            }
+        }
+        
+        if (!timed) continue;
+        pass_ns[i] = trace_now() - start;
+        trace_span(render_passes[i].name, start, sim.frame);
+    }
+    
+    if (perf) {
+        pthread_mutex_lock(&perf_totals.lock);
+        perf_totals.frames++;
+        perf_totals.pixels += (uint64_t)fb_width * fb_height;
+        for (size_t i = 0; i < NUM_RENDER_PASSES; i++) {
+            for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+                perf_totals.pass[i].value[c] += delta[i].value[c];
+            }
+        }
+        pthread_mutex_unlock(&perf_totals.lock);
+    }
+    
+    if (counted) {
+        frame_written = 0;
+        pthread_mutex_lock(&pixel_totals.lock);
+        pixel_totals.frames++;
+        pixel_totals.pixels += (uint64_t)fb_width * fb_height;
+        for (size_t i = 0; i < NUM_RENDER_PASSES; i++) {
+            pixel_totals.written[i] += written[i];
+            pixel_totals.blended[i] += blended[i];
+            frame_written += written[i] + blended[i];
+        }
+        pthread_mutex_unlock(&pixel_totals.lock);
+    }
+    
+    if (overdraw) draw_overdraw_heatmap();
+}
+
+/*
+ * Per-pass pixel summary for --stats and --overdraw. Overdraw is writes
+ * and blends per framebuffer pixel; anything above 1.0 was drawn and
+ * then covered or blended over.
+ */
+static void print_pixel_report(void) {
+    if (!pixel_totals.frames) return;
+    
+    double frames = pixel_totals.frames;
+    double pixels_per_frame = pixel_totals.pixels / frames;
+    uint64_t total = 0;
+    
+    fprintf(stderr, "🎨 Pixels per frame (%.0f in the framebuffer):\n", pixels_per_frame);
+    fprintf(stderr, "   %-10s %12s %12s %9s\n", "pass", "written", "blended", "per px");
+    for (size_t i = 0; i < NUM_RENDER_PASSES; i++) {
+        uint64_t pass = pixel_totals.written[i] + pixel_totals.blended[i];
+        fprintf(stderr, "   %-10s %12.0f %12.0f %9.3f\n", render_passes[i].name,
+                pixel_totals.written[i] / frames, pixel_totals.blended[i] / frames,
+                pass / (double)pixel_totals.pixels);
+        total += pass;
+    }
+    fprintf(stderr, "   overdraw %.2fx\n", total / (double)pixel_totals.pixels);
+}
+
+/* One counter per pixel, or n/a when the PMU doesn't provide it */
+static void print_perf_ratio(PerfCounter counter, double value, double per, int width, int precision) {
+    if (perf_totals.mask & (1u << counter) && per > 0) {
+        fprintf(stderr, " %*.*f", width, precision, value / per);
+    } else {
+        fprintf(stderr, " %*s", width, "n/a");
+    }
+}
+
+/*
+ * Per-pass summary for --perf. Low IPC with many cache misses per pixel
+ * means the pass waits on memory; high IPC means it is compute bound.
+ */
+static void print_perf_report(void) {
+    if (!perf_mode || !perf_totals.frames) return;
+    
+    double pixels = perf_totals.pixels;
+    fprintf(stderr, "🔬 Hardware counters over %llu frames (%.0f pixels/frame):\n",
+            (unsigned long long)perf_totals.frames, pixels / perf_totals.frames);
+    fprintf(stderr, "   %-10s %12s %6s %14s %15s\n", "pass", "cycles/px", "IPC", "cache-miss/px", "branch-miss/px");
+    
+    for (size_t i = 0; i < NUM_RENDER_PASSES; i++) {
+        const uint64_t *v = perf_totals.pass[i].value;
+        int have_ipc = (perf_totals.mask & (1u << PERF_CYCLES)) && (perf_totals.mask & (1u << PERF_INSTRUCTIONS));
+        
+        fprintf(stderr, "   %-10s", render_passes[i].name);
+        print_perf_ratio(PERF_CYCLES, v[PERF_CYCLES], pixels, 12, 2);
+        if (have_ipc && v[PERF_CYCLES]) {
+            fprintf(stderr, " %6.2f", (double)v[PERF_INSTRUCTIONS] / v[PERF_CYCLES]);
+        } else {
+            fprintf(stderr, " %6s", "n/a");
+        }
+        print_perf_ratio(PERF_CACHE_MISSES, v[PERF_CACHE_MISSES], pixels, 14, 4);
+        print_perf_ratio(PERF_BRANCH_MISSES, v[PERF_BRANCH_MISSES], pixels, 15, 4);
+        fputc('\n', stderr);
+    }
+}
+
+/* Flush requests to the compositor, counting wire bytes */
+static int display_flush(void) {
+    int ret = wl_display_flush(display);
+    if (stats_mode) {
+        frame_io.flushes++;
+        if (ret != 0) frame_io.sends++;
+        if (ret > 0) frame_io.bytes_out += ret;
+    }
+    return ret;
+}
+
+/* Read queued events, counting what was waiting on the socket */
+static int display_read_events(void) {
+    if (stats_mode) {
+        int pending = 0;
+        if (ioctl(wl_display_get_fd(display), FIONREAD, &pending) == 0) {
+            frame_io.bytes_in += pending;
+        }
+        frame_io.reads++;
+    }
+    return wl_display_read_events(display);
+}
+
+/* Print pass timings and event loop cost for the frame just committed */
+static void report_frame_io(void) {
+    uint32_t syscalls = frame_io.polls + frame_io.sends + frame_io.reads + frame_io.timer_ops;
+    
+    fprintf(stderr, "frame %u:", sim.frame);
+    for (size_t i = 0; i < NUM_RENDER_PASSES; i++) {
+        fprintf(stderr, " %s %.2f", render_passes[i].name, pass_ns[i] / 1e6);
+    }
+    fprintf(stderr, " ms | overdraw %.2fx | syscalls %u (poll %u) flush %u out %llu B in %llu B\n",
+            frame_written / (double)((uint64_t)fb_width * fb_height),
+            syscalls, frame_io.polls, frame_io.flushes,
+            (unsigned long long)frame_io.bytes_out, (unsigned long long)frame_io.bytes_in);
+    
+    io_totals.frames++;
+    io_totals.syscalls += syscalls;
+    io_totals.flushes += frame_io.flushes;
+    io_totals.bytes_out += frame_io.bytes_out;
+    io_totals.bytes_in += frame_io.bytes_in;
+    
+    memset(&frame_io, 0, sizeof(frame_io));
+}
+
+/* Per-frame averages over the whole run */
+static void print_io_stats(void) {
+    if (!stats_mode || !io_totals.frames) return;
+    
+    double n = io_totals.frames;
+    printf("📡 Per frame: %.1f syscalls, %.1f flushes, %.0f B out, %.0f B in\n",
+           io_totals.syscalls / n, io_totals.flushes / n,
+           io_totals.bytes_out / n, io_totals.bytes_in / n);
+}
+
+/* Presentation clock announcement; all frame timestamps use this clock */
+static void presentation_clock_id(void *data, struct wp_presentation *presentation,
+                                  uint32_t clk_id) {
+    presentation_clock = (clockid_t)clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+    presentation_clock_id
+};
+
+/* Wayland registry handler */
+static void registry_handler(void *data, struct wl_registry *registry,
+                            uint32_t id, const char *interface, uint32_t version) {
+    if (strcmp(interface, wl_compositor_interface.name) == 0) {
+        compositor = wl_registry_bind(registry, id, &wl_compositor_interface, 4);
+    } else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        shm = wl_registry_bind(registry, id, &wl_shm_interface, 1);
+    } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+        /* Version 6 adds the "suspended" toplevel state */
+        xdg_wm_base = wl_registry_bind(registry, id, &xdg_wm_base_interface,
+                                       version < 6 ? version : 6);
+    } else if (strcmp(interface, wp_presentation_interface.name) == 0) {
+        presentation = wl_registry_bind(registry, id, &wp_presentation_interface, 1);
+        wp_presentation_add_listener(presentation, &presentation_listener, NULL);
+    }
+}
+
+static void registry_remover(void *data, struct wl_registry *registry, uint32_t id) {
+    /* Handle global removal if needed */
+}
+
+static const struct wl_registry_listener registry_listener = {
+    registry_handler,
+    registry_remover
+};
 
 /* XDG WM base ping handler */
 static void xdg_wm_base_ping(void *data, struct xdg_wm_base *xdg_wm_base, uint32_t serial) {
     xdg_wm_base_pong(xdg_wm_base, serial);
 }
 
-static const struct xdg_wm_base_listener xdg_wm_base_listener = {
-    xdg_wm_base_ping
-};
+static const struct xdg_wm_base_listener xdg_wm_base_listener = {
+    xdg_wm_base_ping
+};
+
+static void resume_rendering(void);
+
+/* XDG surface configure handler */
+static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface, uint32_t serial) {
+    xdg_surface_ack_configure(xdg_surface, serial);
+    configured = 1;
+    
+    /* Unsuspended or refocused while parked: restart the frame loop */
+    if (idle && wake_on_configure && buffer) {
+        resume_rendering();
+    }
+    wake_on_configure = 0;
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+    xdg_surface_configure
+};
+
+/* XDG toplevel handlers */
+static void xdg_toplevel_configure(void *data, struct xdg_toplevel *toplevel,
+                                   int32_t width, int32_t height,
+                                   struct wl_array *states) {
+    /* Window resized - we ignore for now and keep fixed size */
+    uint32_t *state;
+    int was_suspended = suspended;
+    int was_activated = activated;
+    
+    suspended = 0;
+    activated = 0;
+    wl_array_for_each(state, states) {
+        if (*state == XDG_TOPLEVEL_STATE_SUSPENDED) suspended = 1;
+        if (*state == XDG_TOPLEVEL_STATE_ACTIVATED) activated = 1;
+    }
+    
+    wake_on_configure = !suspended && (was_suspended || (!was_activated && activated));
+    
+    /* Drop a pending late-latched render; nobody will see it */
+    if (suspended && timer_armed) {
+        struct itimerspec off = { 0 };
+        timerfd_settime(timer_fd, 0, &off, NULL);
+        timer_armed = 0;
+        scheduled_target_ns = 0;
+        idle = 1;
+    }
+}
+
+static void xdg_toplevel_close(void *data, struct xdg_toplevel *toplevel) {
+    running = 0;
+}
+
+static void xdg_toplevel_configure_bounds(void *data, struct xdg_toplevel *toplevel,
+                                          int32_t width, int32_t height) {
+    /* Bounds suggested by compositor */
+}
+
+static void xdg_toplevel_wm_capabilities(void *data, struct xdg_toplevel *toplevel,
+                                         struct wl_array *capabilities) {
+    /* WM capabilities */
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+    xdg_toplevel_configure,
+    xdg_toplevel_close,
+    xdg_toplevel_configure_bounds,
+    xdg_toplevel_wm_capabilities
+};
+
+/* Create the shared memory backing; needs no compositor, so it can go first */
+static int create_shm_memory(void) {
+    shm_fd = memfd_create("christmas_tree", MFD_CLOEXEC);
+    if (shm_fd < 0) {
+        perror("memfd_create");
+        return -1;
+    }
+    
+    if (ftruncate(shm_fd, BUFFER_SIZE) < 0) {
+        perror("ftruncate");
+        close(shm_fd);
+        return -1;
+    }
+    
+    shm_data = mmap(NULL, BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (shm_data == MAP_FAILED) {
+        perror("mmap");
+        shm_data = NULL;
+        close(shm_fd);
+        return -1;
+    }
+    
+    return 0;
+}
+
+/* Compositor is done reading the buffer */
+static void buffer_release(void *data, struct wl_buffer *wl_buffer) {
+    trace_instant("buffer_release", TRACE_NO_ARG);
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    buffer_release
+};
+
+/* Wrap the shared memory in a wl_buffer once wl_shm is bound */
+static int create_shm_buffer(void) {
+    struct wl_shm_pool *pool = wl_shm_create_pool(shm, shm_fd, BUFFER_SIZE);
+    buffer = wl_shm_pool_create_buffer(pool, 0, WIDTH, HEIGHT, STRIDE, WL_SHM_FORMAT_ARGB8888);
+    wl_shm_pool_destroy(pool);
+    close(shm_fd);
+    shm_fd = -1;
+    
+    if (buffer) wl_buffer_add_listener(buffer, &buffer_listener, NULL);
+    return buffer ? 0 : -1;
+}
+
+/* Current time on the given clock in nanoseconds */
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Current time on the presentation clock in nanoseconds */
+static uint64_t now_ns(void) {
+    return clock_ns(presentation_clock);
+}
+
+/* Presentation feedback: the frame reached the screen */
+static void feedback_sync_output(void *data, struct wp_presentation_feedback *feedback,
+                                 struct wl_output *output) {
+    /* Single-output timing is all we track */
+}
+
+static void feedback_presented(void *data, struct wp_presentation_feedback *feedback,
+                               uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+                               uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo,
+                               uint32_t flags) {
+    FrameFeedback *fb = data;
+    uint64_t sec = ((uint64_t)tv_sec_hi << 32) | tv_sec_lo;
+    uint64_t present = sec * NSEC_PER_SEC + tv_nsec;
+    
+    present_stats.presented++;
+    
+    /* Timestamps are only comparable with startup on the monotonic clock */
+    if (fb->first && presentation_clock == CLOCK_MONOTONIC && present > startup_ns) {
+        printf("⏱️  First frame presented %.1f ms after start\n", (present - startup_ns) / 1e6);
+    }
+    
+    /* Committed before we were hidden: timing says nothing about pacing */
+    if (fb->epoch != present_epoch) {
+        wp_presentation_feedback_destroy(feedback);
+        free(fb);
+        return;
+    }
+    
+    last_present_ns = present;
+    if (refresh) refresh_ns = refresh;
+    
+    /* The startup frame was rendered before the clock was known */
+    if (!fb->first && present > fb->start_ns) {
+        uint64_t latency = present - fb->start_ns;
+        present_stats.latency_samples++;
+        present_stats.latency_sum_ns += latency;
+        if (latency > present_stats.latency_max_ns) present_stats.latency_max_ns = latency;
+    }
+    
+    /* A frame more than half a refresh late slipped to a later vblank */
+    if (fb->target_ns && refresh_ns) {
+        if (present > fb->target_ns + refresh_ns / 2) {
+            present_stats.missed++;
+            latch_margin_ns += LATCH_MARGIN_STEP_NS;
+            if (latch_margin_ns > refresh_ns / 2) latch_margin_ns = refresh_ns / 2;
+        } else {
+            /* Creep back towards the deadline while we keep making it */
+            latch_margin_ns -= latch_margin_ns / 64;
+            if (latch_margin_ns < LATCH_MARGIN_MIN_NS) latch_margin_ns = LATCH_MARGIN_MIN_NS;
+        }
+    }
+    
+    wp_presentation_feedback_destroy(feedback);
+    free(fb);
+}
+
+static void feedback_discarded(void *data, struct wp_presentation_feedback *feedback) {
+    present_stats.discarded++;
+    wp_presentation_feedback_destroy(feedback);
+    free(data);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+    feedback_sync_output,
+    feedback_presented,
+    feedback_discarded
+};
+
+/*
+ * Pick the vblank the next frame should land on and the latest time rendering
+ * can start and still make it. Returns 0 until feedback has given us a phase.
+ */
+static uint64_t predict_target(uint64_t now, uint64_t *start) {
+    if (!refresh_ns || !last_present_ns) return 0;
+    
+    uint64_t budget = render_ewma_ns + latch_margin_ns;
+    uint64_t target = last_present_ns + refresh_ns;
+    if (now + budget > target) {
+        target += ((now + budget - target) / refresh_ns + 1) * refresh_ns;
+    }
+    
+    *start = target - budget;
+    return target;
+}
+
+/* Frame callback handler */
+static void frame_done(void *data, struct wl_callback *callback, uint32_t time);
+
+static const struct wl_callback_listener frame_listener = {
+    frame_done
+};
+
+/* Attach the rendered buffer, ask for the next frame and feedback, commit */
+static void commit_frame(uint64_t start_ns, uint64_t target_ns) {
+    uint64_t commit_start = trace_now();
+    
+    /* Hand the finished frame to local consumers first; it never blocks */
+    if (frame_ring) {
+        memcpy(frame_ring_begin(frame_ring), shm_data, BUFFER_SIZE);
+        frame_ring_publish(frame_ring, sim.frame, now_ns() - start_ns);
+    }
+    
+    /* Attach buffer and commit */
+    wl_surface_attach(surface, buffer, 0, 0);
+    wl_surface_damage(surface, 0, 0, WIDTH, HEIGHT);
+    
+    /* Request next frame */
+    frame_callback = wl_surface_frame(surface);
+    wl_callback_add_listener(frame_callback, &frame_listener, NULL);
+    
+    if (presentation) {
+        FrameFeedback *fb = malloc(sizeof(*fb));
+        if (fb) {
+            fb->start_ns = start_ns;
+            fb->target_ns = target_ns;
+            fb->epoch = present_epoch;
+            fb->first = !first_commit_ns;
+            struct wp_presentation_feedback *feedback =
+                wp_presentation_feedback(presentation, surface);
+            wp_presentation_feedback_add_listener(feedback, &feedback_listener, fb);
+        }
+    }
+    
+    wl_surface_commit(surface);
+    last_commit_ns = now_ns();
+    trace_span("commit", commit_start, sim.frame);
+}
+
+/* Advance, render and commit one frame aimed at target_ns (0 if unknown) */
+static void render_and_commit(uint64_t target_ns) {
+    uint64_t start = now_ns();
+    last_render_ns = start;
+    
+    /* A single shm buffer: drawing into it is the acquire */
+    trace_instant("buffer_acquire", sim.frame + 1);
+    
+    /* Update and render */
+    update_animation();
+    render_frame();
+    
+    uint64_t elapsed = now_ns() - start;
+    render_ewma_ns = render_ewma_ns ? (render_ewma_ns * 7 + elapsed) / 8 : elapsed;
+    
+    commit_frame(start, target_ns);
+    
+    if (stats_mode) report_frame_io();
+}
+
+/*
+ * Restart the frame loop after the window was hidden. Animation advances one
+ * step per rendered frame, so there is no backlog to catch up on; only the
+ * vblank phase is stale and gets relearned from fresh feedback.
+ */
+static void resume_rendering(void) {
+    if (frame_callback) {
+        wl_callback_destroy(frame_callback);
+        frame_callback = NULL;
+    }
+    
+    idle = 0;
+    present_epoch++;
+    last_present_ns = 0;
+    timer_armed = 0;
+    scheduled_target_ns = 0;
+    
+    render_and_commit(0);
+}
+
+static void frame_done(void *data, struct wl_callback *callback, uint32_t time) {
+    trace_instant("frame_callback", time);
+    wl_callback_destroy(callback);
+    frame_callback = NULL;
+    
+    /* Some compositors keep throttled callbacks coming while suspended */
+    if (suspended) {
+        idle = 1;
+        return;
+    }
+    
+    if (idle) {
+        resume_rendering();
+        return;
+    }
+    
+    /*
+     * Late-latch: sleep until just before the deadline so content is fresh.
+     * A frame rate cap only moves the earliest start; the vblank we aim for
+     * is still picked from feedback when there is any.
+     */
+    uint64_t now = now_ns();
+    uint64_t start = frame_period_ns ? last_render_ns + frame_period_ns : 0;
+    uint64_t target = predict_target(start > now ? start : now, &start);
+    if (timer_fd >= 0 && start > now) {
+        struct itimerspec its = {
+            .it_value = { start / NSEC_PER_SEC, start % NSEC_PER_SEC }
+        };
+        if (stats_mode) frame_io.timer_ops++;
+        if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == 0) {
+            timer_armed = 1;
+            scheduled_target_ns = target;
+            return;
+        }
+    }
+    
+    render_and_commit(target);
+}
+
+/* Scheduled render start reached */
+static void handle_frame_timer(void) {
+    uint64_t expirations;
+    if (stats_mode) frame_io.timer_ops++;
+    if (read(timer_fd, &expirations, sizeof(expirations)) < 0) return;
+    
+    timer_armed = 0;
+    render_and_commit(scheduled_target_ns);
+    scheduled_target_ns = 0;
+}
 
-/* XDG surface configure handler */
-static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface, uint32_t serial) {
-    xdg_surface_ack_configure(xdg_surface, serial);
-    configured = 1;
+/* Dispatch Wayland events, the frame timer and local clients until closed or disconnected */
+static int run_event_loop(void) {
+    struct pollfd fds[4] = {
+        { .fd = wl_display_get_fd(display), .events = POLLIN },
+        { .fd = timer_fd, .events = POLLIN },
+        { .fd = frame_ring ? frame_ring_listen_fd(frame_ring) : -1, .events = POLLIN },
+        { .fd = control ? control_fd(control) : -1, .events = POLLIN },
+    };
+    
+    while (running) {
+        while (wl_display_prepare_read(display) != 0) {
+            if (wl_display_dispatch_pending(display) < 0) return -1;
+        }
+        
+        if (display_flush() < 0 && errno != EAGAIN) {
+            wl_display_cancel_read(display);
+            return -1;
+        }
+        
+        /* Wake up to notice when frame callbacks stop arriving */
+        int timeout = -1;
+        if (!idle && frame_callback && !timer_armed) {
+            uint64_t now = now_ns();
+            uint64_t deadline = last_commit_ns + IDLE_TIMEOUT_NS;
+            timeout = deadline > now ? (int)((deadline - now) / 1000000) + 1 : 0;
+        }
+        
+        if (stats_mode) frame_io.polls++;
+        int ready = poll(fds, 4, timeout);
+        if (ready < 0) {
+            wl_display_cancel_read(display);
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        
+        if (fds[0].revents & POLLIN) {
+            if (display_read_events() < 0) return -1;
+        } else {
+            wl_display_cancel_read(display);
+        }
+        
+        if (wl_display_dispatch_pending(display) < 0) return -1;
+        
+        if (timer_fd >= 0 && (fds[1].revents & POLLIN)) {
+            handle_frame_timer();
+        }
+        
+        if (fds[2].revents & POLLIN) {
+            frame_ring_accept(frame_ring);
+        }
+        
+        /* Between frames, so setters can resize whatever the next one draws */
+        if (fds[3].revents & POLLIN) {
+            control_dispatch(control);
+        }
+        
+        /* Occluded or minimized: the outstanding callback fires on return */
+        if (ready == 0 && frame_callback && now_ns() - last_commit_ns >= IDLE_TIMEOUT_NS) {
+            idle = 1;
+        }
+    }
+    
+    return 0;
 }
 
-static const struct xdg_surface_listener xdg_surface_listener = {
-    xdg_surface_configure
-};
+/* Summarize presentation feedback collected during the run */
+static void print_present_stats(void) {
+    if (!presentation || !present_stats.presented) return;
+    
+    printf("📊 Frames presented: %u, missed deadlines: %u, discarded: %u\n",
+           present_stats.presented, present_stats.missed, present_stats.discarded);
+    printf("   Refresh %.2f Hz, render %.2f ms, render-to-present %.2f ms avg / %.2f ms max\n",
+           refresh_ns ? (double)NSEC_PER_SEC / refresh_ns : 0.0,
+           render_ewma_ns / 1e6,
+           present_stats.latency_samples ?
+               present_stats.latency_sum_ns / 1e6 / present_stats.latency_samples : 0.0,
+           present_stats.latency_max_ns / 1e6);
+}
 
-/* XDG toplevel handlers */
-static void xdg_toplevel_configure(void *data, struct xdg_toplevel *toplevel,
-                                   int32_t width, int32_t height,
-                                   struct wl_array *states) {
-    /* Window resized - we ignore for now and keep fixed size */
+/*
+ * Scene setup and first render; runs while the compositor handshake is in
+ * flight. The simulation state is per thread, so hand it back in arg.
+ */
+static void *prepare_first_frame(void *arg) {
+    trace_thread_name("scene");
+    
+    /* Initialize animation elements; the occlusion set_render_target builds depends on them */
+    init_scene();
+    set_render_target(shm_data, WIDTH, HEIGHT);
+    sim_init(scene_left, scene_right);
+    
+    /* Initial render, unless startup has already failed */
+    if (running) render_frame();
+    
+    sim_snapshot(arg);
+    release_render_thread();
+    return NULL;
 }
 
-static void xdg_toplevel_close(void *data, struct xdg_toplevel *toplevel) {
-    running = 0;
+/* Shared by export workers */
+static struct {
+    VideoWriter *writer;
+    SimState origin;
+    pthread_mutex_t lock;
+    int next_frame;            /* Next frame index to hand out */
+    int failed;
+} export_job = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* Simulation tick shown in export frame `index` */
+static uint32_t export_tick(int index) {
+    /* Frame 0 is the initial state; later frames sit at (start + index) / fps seconds */
+    return (uint64_t)(export_start + index) * SIM_RATE / export_fps;
 }
 
-static void xdg_toplevel_configure_bounds(void *data, struct xdg_toplevel *toplevel,
-                                          int32_t width, int32_t height) {
-    /* Bounds suggested by compositor */
+/*
+ * Export worker: take the next frame index, seek this thread's simulation
+ * to it and render into a writer slot. The slot is acquired before the
+ * index under the job lock, so the oldest unwritten frame always holds a
+ * slot and the in-order writer cannot stall on a frame nobody can render.
+ */
+static void *export_worker(void *arg) {
+    sim_restore(&export_job.origin);
+    trace_thread_name("export-worker");
+    
+    for (;;) {
+        uint32_t *frame = NULL;
+        int index = 0;
+        uint64_t wait = trace_now();
+        
+        pthread_mutex_lock(&export_job.lock);
+        if (!export_job.failed && export_job.next_frame < export_frames) {
+            frame = video_writer_acquire(export_job.writer);
+            if (frame) {
+                index = export_job.next_frame++;
+            } else {
+                export_job.failed = 1;
+            }
+        }
+        pthread_mutex_unlock(&export_job.lock);
+        
+        if (!frame) {
+            break;
+        }
+        trace_span("buffer_acquire", wait, index);
+        
+        uint64_t start = trace_now();
+        sim_seek(export_tick(index));
+        set_render_target(frame, export_width, export_height);
+        render_frame();
+        video_writer_submit(export_job.writer, frame, index);
+        trace_span("frame", start, index);
+    }
+    
+    release_render_thread();
+    return NULL;
 }
 
-static void xdg_toplevel_wm_capabilities(void *data, struct xdg_toplevel *toplevel,
-                                         struct wl_array *capabilities) {
-    /* WM capabilities */
+/* Farm worker process: this process's simulation starts at the origin */
+static void farm_render(void *ctx, uint32_t *frame, int index) {
+    sim_seek(export_tick(index));
+    set_render_target(frame, export_width, export_height);
+    render_frame();
 }
 
-static const struct xdg_toplevel_listener xdg_toplevel_listener = {
-    xdg_toplevel_configure,
-    xdg_toplevel_close,
-    xdg_toplevel_configure_bounds,
-    xdg_toplevel_wm_capabilities
-};
+/* What a farm worker counted, for --stats and --perf reports in the coordinator */
+typedef struct {
+    uint64_t frames, pixels;
+    uint64_t written[NUM_RENDER_PASSES], blended[NUM_RENDER_PASSES];
+    unsigned perf_mask;
+    uint64_t perf_frames, perf_pixels;
+    PerfSample perf_pass[NUM_RENDER_PASSES];
+} FarmReport;
 
-/* Create shared memory buffer */
-static int create_shm_buffer(void) {
-    int fd = memfd_create("christmas_tree", 0);
-    if (fd < 0) {
-        perror("memfd_create");
-        return -1;
+/* Farm worker process, after its last frame: hand over its totals */
+static void farm_report(void *ctx, void *out) {
+    FarmReport *report = out;
+    
+    pthread_mutex_lock(&pixel_totals.lock);
+    report->frames = pixel_totals.frames;
+    report->pixels = pixel_totals.pixels;
+    memcpy(report->written, pixel_totals.written, sizeof(report->written));
+    memcpy(report->blended, pixel_totals.blended, sizeof(report->blended));
+    pthread_mutex_unlock(&pixel_totals.lock);
+    
+    pthread_mutex_lock(&perf_totals.lock);
+    report->perf_mask = perf_totals.mask;
+    report->perf_frames = perf_totals.frames;
+    report->perf_pixels = perf_totals.pixels;
+    memcpy(report->perf_pass, perf_totals.pass, sizeof(report->perf_pass));
+    pthread_mutex_unlock(&perf_totals.lock);
+}
+
+/* Farm coordinator: add a worker's totals to ours, which it never renders into */
+static void farm_merge(void *ctx, const void *in) {
+    const FarmReport *report = in;
+    
+    pthread_mutex_lock(&pixel_totals.lock);
+    pixel_totals.frames += report->frames;
+    pixel_totals.pixels += report->pixels;
+    for (size_t i = 0; i < NUM_RENDER_PASSES; i++) {
+        pixel_totals.written[i] += report->written[i];
+        pixel_totals.blended[i] += report->blended[i];
     }
+    pthread_mutex_unlock(&pixel_totals.lock);
     
-    if (ftruncate(fd, BUFFER_SIZE) < 0) {
-        perror("ftruncate");
-        close(fd);
+    pthread_mutex_lock(&perf_totals.lock);
+    perf_totals.mask |= report->perf_mask;
+    perf_totals.frames += report->perf_frames;
+    perf_totals.pixels += report->perf_pixels;
+    for (size_t i = 0; i < NUM_RENDER_PASSES; i++) {
+        for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+            perf_totals.pass[i].value[c] += report->perf_pass[i].value[c];
+        }
+    }
+    pthread_mutex_unlock(&perf_totals.lock);
+}
+
+/* Farm coordinator: copy a finished frame out of the worker's buffer */
+static int farm_emit(void *ctx, const uint32_t *frame, int index) {
+    uint64_t wait = trace_now();
+    uint32_t *slot = video_writer_acquire(export_job.writer);
+    if (!slot) {
+        export_job.failed = 1;
         return -1;
     }
+    trace_span("buffer_acquire", wait, index);
     
-    shm_data = mmap(NULL, BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (shm_data == MAP_FAILED) {
-        perror("mmap");
-        close(fd);
-        return -1;
+    uint64_t start = trace_now();
+    memcpy(slot, frame, (size_t)export_width * export_height * 4);
+    video_writer_submit(export_job.writer, slot, index);
+    trace_span("emit", start, index);
+    return 0;
+}
+
+/*
+ * Render frames headlessly into the video writer. Animation time comes from
+ * the frame index, never the wall clock, so exports are reproducible and run
+ * as fast as the renderer allows. Worker threads render whole frames in
+ * parallel, each seeking its own copy of the simulation; slots are filled
+ * in place and the writer thread streams them out in order.
+ */
+static int run_export(void) {
+    signal(SIGPIPE, SIG_IGN);
+    
+    if (export_jobs <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        export_jobs = cpus > 0 ? (int)cpus : 1;
     }
     
-    struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, BUFFER_SIZE);
-    buffer = wl_shm_pool_create_buffer(pool, 0, WIDTH, HEIGHT, STRIDE, WL_SHM_FORMAT_ARGB8888);
-    wl_shm_pool_destroy(pool);
-    close(fd);
+    /* Farm workers render into their own buffers; only the coordinator's copies need slots */
+    export_job.writer = video_writer_open(export_path, export_format,
+                                          export_width, export_height, export_fps,
+                                          (export_farm > 0 ? 0 : export_jobs) + EXPORT_QUEUE_DEPTH);
+    if (!export_job.writer) {
+        return 1;
+    }
+    
+    init_scene();
+    set_render_target(NULL, export_width, export_height);
+    sim_init(scene_left, scene_right);
+    sim_snapshot(&export_job.origin);
+    
+    uint64_t start = clock_ns(CLOCK_MONOTONIC);
+    int status = 0;
+    
+    if (export_farm > 0) {
+        FarmConfig farm = {
+            .workers = export_farm,
+            .frames = export_frames,
+            .range = FARM_RANGE_FRAMES,
+            .width = export_width,
+            .height = export_height,
+            .render = farm_render,
+            .emit = farm_emit,
+            .report_size = sizeof(FarmReport),
+            .report = farm_report,
+            .merge = farm_merge,
+        };
+        FarmStats farm_stats;
+        if (frame_farm_run(&farm, &farm_stats) < 0) {
+            status = 1;
+        }
+        fprintf(stderr, "🏭 Farm: %d workers, %u ranges of up to %d frames, coordinator idle %.1f ms\n",
+                export_farm, farm_stats.ranges, FARM_RANGE_FRAMES, farm_stats.wait_ns / 1e6);
+    } else {
+        pthread_t *workers = calloc(export_jobs, sizeof(pthread_t));
+        int started = 0;
+        while (workers && started < export_jobs &&
+               pthread_create(&workers[started], NULL, export_worker, NULL) == 0) {
+            started++;
+        }
+        if (started == 0) {
+            export_worker(NULL);
+        }
+        for (int i = 0; i < started; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        free(workers);
+    }
+    
+    if (export_job.failed) {
+        status = 1;
+    }
     
+    VideoWriterStats stats;
+    if (video_writer_close(export_job.writer, &stats) < 0) {
+        status = 1;
+    }
+    
+    double seconds = (clock_ns(CLOCK_MONOTONIC) - start) / 1e9;
+    fprintf(stderr, "🎬 Exported %u frames at %dx%d in %.2f s (%.1f fps, %.1f MB, writer wait %.1f ms)\n",
+            stats.frames, export_width, export_height, seconds,
+            seconds > 0 ? stats.frames / seconds : 0.0,
+            stats.bytes / 1e6, stats.producer_wait_ns / 1e6);
+    print_perf_report();
+    print_pixel_report();
+    
+    return status;
+}
+
+/* Ctrl+C ends the terminal loop cleanly so the screen gets restored */
+static void handle_terminal_signal(int sig) {
+    if (sig == SIGWINCH) {
+        terminal_resized = 1;
+    } else {
+        running = 0;
+    }
+}
+
+/* Write everything, retrying short writes; -1 once the reader is gone */
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
     return 0;
 }
 
-/* Frame callback handler */
-static void frame_done(void *data, struct wl_callback *callback, uint32_t time);
+/* Terminal size in cells and cell size in pixels; COLUMNS/LINES when not a tty */
+static void terminal_size(int *cols, int *rows, int *cell_w, int *cell_h) {
+    struct winsize ws = { 0 };
+    *cols = 80;
+    *rows = 24;
+    *cell_w = 8;
+    *cell_h = 16;
+    
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col && ws.ws_row) {
+        *cols = ws.ws_col;
+        *rows = ws.ws_row;
+        if (ws.ws_xpixel && ws.ws_ypixel) {
+            *cell_w = ws.ws_xpixel / ws.ws_col;
+            *cell_h = ws.ws_ypixel / ws.ws_row;
+        }
+    } else {
+        const char *c = getenv("COLUMNS"), *l = getenv("LINES");
+        if (c && atoi(c) > 0) *cols = atoi(c);
+        if (l && atoi(l) > 0) *rows = atoi(l);
+    }
+}
 
-static const struct wl_callback_listener frame_listener = {
-    frame_done
-};
+/* Fold an output's counters into the run totals (resizes start a new one) */
+static void close_terminal_output(TermOutput *term, TermStats *totals) {
+    if (!term) return;
+    
+    TermStats s;
+    term_output_stats(term, &s);
+    if (!totals->frames) totals->first_frame_bytes = s.first_frame_bytes;
+    totals->frames += s.frames;
+    totals->bytes += s.bytes;
+    totals->cells_sent += s.cells_sent;
+    if (s.max_frame_bytes > totals->max_frame_bytes) totals->max_frame_bytes = s.max_frame_bytes;
+    term_output_destroy(term);
+}
 
-static void frame_done(void *data, struct wl_callback *callback, uint32_t time) {
-    wl_callback_destroy(callback);
+/*
+ * Render to the terminal in real time. The bottom line is kept free for
+ * the --stats status line, which also keeps sixel images from scrolling.
+ * Only changed cells are written each frame; bytes per frame are tracked
+ * so the output can be tuned for slow links.
+ */
+static int run_terminal(void) {
+    int tty = isatty(STDOUT_FILENO);
+    int fps = fps_set ? export_fps : TERM_DEFAULT_FPS;
     
-    /* Update and render */
-    update_animation();
-    render_frame();
+    if (terminal_sixel < 0) {
+        terminal_sixel = tty && isatty(STDIN_FILENO) &&
+                         term_detect_sixel(STDIN_FILENO, STDOUT_FILENO, TERM_DETECT_TIMEOUT_MS);
+    }
+    TermMode mode = terminal_sixel ? TERM_MODE_SIXEL : TERM_MODE_HALFBLOCK;
     
-    /* Attach buffer and commit */
-    wl_surface_attach(surface, buffer, 0, 0);
-    wl_surface_damage(surface, 0, 0, WIDTH, HEIGHT);
+    struct sigaction sa = { .sa_handler = handle_terminal_signal };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGWINCH, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
     
-    /* Request next frame */
-    struct wl_callback *cb = wl_surface_frame(surface);
-    wl_callback_add_listener(cb, &frame_listener, NULL);
+    static const char enter[] = "\033[?1049h\033[?25l\033[2J";
+    static const char leave[] = "\033[0m\033[?25h\033[?1049l";
+    if (tty) write_all(STDOUT_FILENO, enter, sizeof(enter) - 1);
     
-    wl_surface_commit(surface);
+    init_scene();
+    
+    TermOutput *term = NULL;
+    uint32_t *fb = NULL;
+    TermStats totals = { 0 };
+    int cols = 0, rows = 0, status = 0;
+    int simulating = 0;
+    uint32_t frames = 0;
+    uint64_t start = clock_ns(CLOCK_MONOTONIC);
+    uint64_t frame_ns = NSEC_PER_SEC / fps;
+    uint64_t deadline = start;
+    
+    while (running && (!frames_set || frames < (uint32_t)export_frames)) {
+        if (!term || terminal_resized) {
+            int cell_w, cell_h, fb_w, fb_h;
+            terminal_resized = 0;
+            terminal_size(&cols, &rows, &cell_w, &cell_h);
+            
+            close_terminal_output(term, &totals);
+            free(fb);
+            
+            fb = NULL;
+            term = term_output_create(mode, cols, rows > 1 ? rows - 1 : 1,
+                                      cell_w, cell_h, terminal_threshold);
+            if (term) {
+                term_output_fb_size(term, &fb_w, &fb_h);
+                fb = malloc((size_t)fb_w * fb_h * 4);
+            }
+            if (!term || !fb) {
+                status = 1;
+                break;
+            }
+            set_render_target(fb, fb_w, fb_h);
+            
+            /*
+             * A new aspect ratio widens or narrows the span the snow wraps
+             * within, and what lies on the ground is kept per column of it.
+             * Start that simulation over; the clock below catches it up to
+             * where it would be had the terminal always been this shape.
+             */
+            if (!simulating || sim.left != scene_left || sim.right != scene_right) {
+                sim_init(scene_left, scene_right);
+                simulating = 1;
+            }
+            if (tty) write_all(STDOUT_FILENO, "\033[2J", 4);
+        }
+        
+        /* Animation follows the clock; a slow link drops frames, not time */
+        uint64_t now = clock_ns(CLOCK_MONOTONIC);
+        uint32_t tick = (now - start) * SIM_RATE / NSEC_PER_SEC;
+        sim_seek(tick);
+        render_frame();
+        
+        uint64_t encode_start = trace_now();
+        const char *data;
+        size_t len = term_output_encode(term, fb, &data);
+        trace_span("encode", encode_start, sim.frame);
+        
+        uint64_t write_start = trace_now();
+        if (write_all(STDOUT_FILENO, data, len) < 0) {
+            status = 1;
+            break;
+        }
+        trace_span("write", write_start, len);
+        frames++;
+        
+        if (stats_mode) {
+            TermStats s;
+            term_output_stats(term, &s);
+            char line[160];
+            int n = snprintf(line, sizeof(line),
+                             "\033[%d;1H\033[0m\033[2Kframe %u  %zu B  avg %.0f B/frame  %.1f KB/s  %s",
+                             rows, sim.frame, len,
+                             (double)s.bytes / s.frames, (double)s.bytes / s.frames * fps / 1024,
+                             mode == TERM_MODE_SIXEL ? "sixel" : "half-block");
+            write_all(STDOUT_FILENO, line, n < (int)sizeof(line) ? n : (int)sizeof(line) - 1);
+        }
+        
+        deadline += frame_ns;
+        now = clock_ns(CLOCK_MONOTONIC);
+        if (deadline < now) {
+            deadline = now;
+        } else {
+            struct timespec ts = { deadline / NSEC_PER_SEC, deadline % NSEC_PER_SEC };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+    }
+    
+    if (tty) write_all(STDOUT_FILENO, leave, sizeof(leave) - 1);
+    
+    close_terminal_output(term, &totals);
+    free(fb);
+    
+    if (totals.frames) {
+        double seconds = (clock_ns(CLOCK_MONOTONIC) - start) / 1e9;
+        fprintf(stderr, "🖥️  Terminal (%s, %dx%d cells): %u frames, first %.1f KB, "
+                "then avg %.0f B/frame, max %.0f B, %.1f KB/s\n",
+                mode == TERM_MODE_SIXEL ? "sixel" : "half-block", cols, rows, totals.frames,
+                totals.first_frame_bytes / 1024.0,
+                totals.frames > 1 ? (double)(totals.bytes - totals.first_frame_bytes) / (totals.frames - 1) : 0.0,
+                (double)totals.max_frame_bytes,
+                seconds > 0 ? totals.bytes / 1024.0 / seconds : 0.0);
+    }
+    print_perf_report();
+    print_pixel_report();
+    
+    return status;
+}
+
+/* Setters for --control; each runs between frames on the main thread */
+static int control_snowflakes(int value, void *ctx) {
+    set_snowflake_count(value);
+    return 0;
+}
+
+/* Lights have a stream of their own, so the ones already hung stay put */
+static int control_lights(int value, void *ctx) {
+    uint64_t rng = SCENE_SEED;
+    num_lights = value;
+    init_lights(&rng);
+    return 0;
+}
+
+static int control_jobs(int value, void *ctx) {
+    row_pool_stop();
+    return row_pool_start(value - 1);
+}
+
+static int control_quality(int value, void *ctx) {
+    quality = value;
+    return 0;
+}
+
+static int control_fps(int value, void *ctx) {
+    frame_period_ns = value ? NSEC_PER_SEC / value : 0;
+    return 0;
+}
+
+/* Listen on control_path for live changes to what each frame costs */
+static void start_control(int jobs) {
+    control = control_create(control_path);
+    if (!control) return;
+    
+    control_add(control, "snowflakes", 0, MAX_SNOWFLAKES, sim.num_snowflakes, control_snowflakes, NULL);
+    control_add(control, "lights", 0, MAX_LIGHTS, num_lights, control_lights, NULL);
+    control_add(control, "jobs", 1, ROW_POOL_MAX_JOBS, jobs, control_jobs, NULL);
+    control_add(control, "quality", QUALITY_LOW, QUALITY_HIGH, quality, control_quality, NULL);
+    control_add(control, "fps", 0, CONTROL_MAX_FPS, 0, control_fps, NULL);
+    printf("🎛️  Taking live changes on %s\n", control_path);
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options]\n"
+           "  -s, --stats          print per-frame pass timings, syscalls and wire traffic\n"
+           "      --trace PATH     write a frame timeline for chrome://tracing or Perfetto\n"
+           "      --perf           count cycles, instructions and misses per render pass\n"
+           "      --overdraw       show how many times each pixel is drawn instead of the scene\n"
+           "  -e, --export PATH    render headlessly to PATH (\"-\" for stdout) and exit\n"
+           "  -n, --frames N       frames to export (default 300)\n"
+           "      --size WxH       export resolution (default %dx%d)\n"
+           "      --fps N          export frame rate (default 60)\n"
+           "      --start N        first frame to export (default 0)\n"
+           "  -j, --jobs N         render threads (default: one per CPU)\n"
+           "      --farm N         render in N worker processes instead of threads\n"
+           "      --forest N       add N undecorated trees behind the tree (default 0)\n"
+           "      --rotate         draw the tree as a turning 3D mesh\n"
+           "      --lights N       hang N lights on the tree (default %d)\n"
+           "      --linear         blend colours, sprites, lighting and glow in linear light\n"
+           "      --quality N      0 draws the scene, 1 adds lying snow and glow, 2 tree lighting (default 2)\n"
+           "      --control PATH   take live changes to snow, lights, jobs, quality and fps on a socket at PATH\n"
+           "  -p, --publish PATH   share frames with local processes via a socket at PATH\n"
+           "  -t, --terminal[=M]   draw in this terminal: half-block, sixel or auto (default)\n"
+           "      --term-threshold N  re-send a cell only when a channel moved more than N (default %d)\n"
+           "      --format FMT     y4m or raw BGRA (default from extension, else y4m)\n"
+           "  -h, --help           show this help\n", prog, WIDTH, HEIGHT, DEFAULT_LIGHTS,
+           TERM_CHANGE_THRESHOLD);
+}
+
+/* Guess the export format from the file name */
+static VideoFormat format_from_path(const char *path) {
+    const char *ext = strrchr(path, '.');
+    if (ext && (strcmp(ext, ".raw") == 0 || strcmp(ext, ".bgra") == 0)) {
+        return VIDEO_FORMAT_RAW;
+    }
+    return VIDEO_FORMAT_Y4M;
+}
+
+/* Parse command line options; returns 0 to continue, 1 to exit */
+static int parse_args(int argc, char *argv[], int *status) {
+    enum { OPT_SIZE = 256, OPT_FPS, OPT_FORMAT, OPT_START, OPT_FARM, OPT_TERM_THRESHOLD, OPT_TRACE, OPT_PERF, OPT_OVERDRAW,
+           OPT_FOREST, OPT_ROTATE, OPT_LIGHTS, OPT_LINEAR, OPT_QUALITY, OPT_CONTROL };
+    static const struct option long_options[] = {
+        { "stats", no_argument, NULL, 's' },
+        { "export", required_argument, NULL, 'e' },
+        { "frames", required_argument, NULL, 'n' },
+        { "size", required_argument, NULL, OPT_SIZE },
+        { "fps", required_argument, NULL, OPT_FPS },
+        { "format", required_argument, NULL, OPT_FORMAT },
+        { "start", required_argument, NULL, OPT_START },
+        { "jobs", required_argument, NULL, 'j' },
+        { "farm", required_argument, NULL, OPT_FARM },
+        { "publish", required_argument, NULL, 'p' },
+        { "trace", required_argument, NULL, OPT_TRACE },
+        { "perf", no_argument, NULL, OPT_PERF },
+        { "overdraw", no_argument, NULL, OPT_OVERDRAW },
+        { "forest", required_argument, NULL, OPT_FOREST },
+        { "rotate", no_argument, NULL, OPT_ROTATE },
+        { "lights", required_argument, NULL, OPT_LIGHTS },
+        { "linear", no_argument, NULL, OPT_LINEAR },
+        { "quality", required_argument, NULL, OPT_QUALITY },
+        { "control", required_argument, NULL, OPT_CONTROL },
+        { "terminal", optional_argument, NULL, 't' },
+        { "term-threshold", required_argument, NULL, OPT_TERM_THRESHOLD },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    
+    while ((opt = getopt_long(argc, argv, "se:n:j:p:t::h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            stats_mode = 1;
+            break;
+        case 'e':
+            export_path = optarg;
+            break;
+        case 'n':
+            export_frames = atoi(optarg);
+            frames_set = 1;
+            if (export_frames <= 0) {
+                fprintf(stderr, "Error: --frames must be positive.\n");
+                *status = 2;
+                return 1;
+            }
+            break;
+        case OPT_SIZE:
+            if (sscanf(optarg, "%dx%d", &export_width, &export_height) != 2 ||
+                export_width <= 0 || export_height <= 0) {
+                fprintf(stderr, "Error: --size expects WIDTHxHEIGHT.\n");
+                *status = 2;
+                return 1;
+            }
+            break;
+        case OPT_FPS:
+            export_fps = atoi(optarg);
+            fps_set = 1;
+            if (export_fps <= 0) {
+                fprintf(stderr, "Error: --fps must be positive.\n");
+                *status = 2;
+                return 1;
+            }
+            break;
+        case OPT_START:
+            export_start = atoi(optarg);
+            if (export_start < 0) {
+                fprintf(stderr, "Error: --start must not be negative.\n");
+                *status = 2;
+                return 1;
+            }
+            break;
+        case 'j':
+            export_jobs = atoi(optarg);
+            if (export_jobs <= 0) {
+                fprintf(stderr, "Error: --jobs must be positive.\n");
+                *status = 2;
+                return 1;
+            }
+            break;
+        case 'p':
+            publish_path = optarg;
+            break;
+        case OPT_TRACE:
+            trace_path = optarg;
+            break;
+        case OPT_PERF:
+            perf_mode = 1;
+            break;
+        case OPT_OVERDRAW:
+            overdraw_mode = 1;
+            break;
+        case OPT_FOREST:
+            forest_size = atoi(optarg);
+            if (forest_size < 0 || forest_size > MAX_FOREST_TREES) {
+                fprintf(stderr, "Error: --forest takes 0 to %d trees.\n", MAX_FOREST_TREES);
+                *status = 2;
+                return 1;
+            }
+            break;
+        case OPT_ROTATE:
+            rotate_mode = 1;
+            break;
+        case OPT_LIGHTS:
+            num_lights = atoi(optarg);
+            if (num_lights < 0 || num_lights > MAX_LIGHTS) {
+                fprintf(stderr, "Error: --lights takes 0 to %d lights.\n", MAX_LIGHTS);
+                *status = 2;
+                return 1;
+            }
+            break;
+        case OPT_LINEAR:
+            linear_light = 1;
+            break;
+        case OPT_QUALITY:
+            quality = atoi(optarg);
+            if (quality < QUALITY_LOW || quality > QUALITY_HIGH) {
+                fprintf(stderr, "Error: --quality takes %d to %d.\n", QUALITY_LOW, QUALITY_HIGH);
+                *status = 2;
+                return 1;
+            }
+            break;
+        case OPT_CONTROL:
+            control_path = optarg;
+            break;
+        case 't':
+            terminal_output = 1;
+            if (!optarg || strcmp(optarg, "auto") == 0) {
+                terminal_sixel = -1;
+            } else if (strcmp(optarg, "half-block") == 0 || strcmp(optarg, "halfblock") == 0) {
+                terminal_sixel = 0;
+            } else if (strcmp(optarg, "sixel") == 0) {
+                terminal_sixel = 1;
+            } else {
+                fprintf(stderr, "Error: unknown terminal mode '%s' (half-block, sixel or auto).\n", optarg);
+                *status = 2;
+                return 1;
+            }
+            break;
+        case OPT_TERM_THRESHOLD:
+            terminal_threshold = atoi(optarg);
+            if (terminal_threshold < 0 || terminal_threshold > 255) {
+                fprintf(stderr, "Error: --term-threshold takes 0 to 255.\n");
+                *status = 2;
+                return 1;
+            }
+            break;
+        case OPT_FARM:
+            export_farm = atoi(optarg);
+            if (export_farm <= 0) {
+                fprintf(stderr, "Error: --farm must be positive.\n");
+                *status = 2;
+                return 1;
+            }
+            break;
+        case OPT_FORMAT:
+            if (strcmp(optarg, "y4m") == 0) {
+                export_format = VIDEO_FORMAT_Y4M;
+            } else if (strcmp(optarg, "raw") == 0) {
+                export_format = VIDEO_FORMAT_RAW;
+            } else {
+                fprintf(stderr, "Error: unknown format '%s' (y4m or raw).\n", optarg);
+                *status = 2;
+                return 1;
+            }
+            export_format_set = 1;
+            break;
+        case 'h':
+            usage(argv[0]);
+            *status = 0;
+            return 1;
+        default:
+            usage(argv[0]);
+            *status = 2;
+            return 1;
+        }
+    }
+    
+    if (export_path && !export_format_set) {
+        export_format = format_from_path(export_path);
+    }
+    
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
+    startup_ns = clock_ns(CLOCK_MONOTONIC);
+    
+    int status;
+    if (parse_args(argc, argv, &status)) {
+        return status;
+    }
+    
+    /* Flushed by its own thread; closed on every exit path */
+    if (trace_path) {
+        if (trace_open(trace_path) < 0) {
+            return 1;
+        }
+        atexit(trace_close);
+        trace_thread_name("main");
+    }
+    
+    if (export_path) {
+        return run_export();
+    }
+    
+    /* Bloom rows go to helper threads; exports already keep every CPU busy */
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int helpers = cpus > ROW_POOL_HELPERS ? ROW_POOL_HELPERS : (int)cpus - 1;
+    row_pool_start(helpers);
+    atexit(row_pool_stop);
+    
+    if (terminal_output) {
+        return run_terminal();
+    }
+    
     printf("🎄 Beautiful 3D Christmas Tree - Wayland Edition 🎄\n");
     printf("    Merry Christmas! Press Ctrl+C or close window to exit.\n\n");
     
+    /* Render the first frame while we talk to the compositor */
+    if (create_shm_memory() < 0) {
+        return 1;
+    }
+    
+    pthread_t scene_thread;
+    SimState first_state;
+    int scene_threaded = pthread_create(&scene_thread, NULL, prepare_first_frame, &first_state) == 0;
+    if (!scene_threaded) {
+        prepare_first_frame(&first_state);
+    }
+    
     /* Connect to Wayland display */
     display = wl_display_connect(NULL);
     if (!display) {
         fprintf(stderr, "Error: Cannot connect to Wayland display.\n");
         fprintf(stderr, "Make sure you're running under a Wayland compositor.\n");
-        return 1;
+        goto fail;
     }
     
     /* Get registry and bind globals */
@@ -739,7 +3736,7 @@ int main(int argc, char *argv[]) {
     
     if (!compositor || !shm || !xdg_wm_base) {
         fprintf(stderr, "Error: Missing required Wayland interfaces.\n");
-        return 1;
+        goto fail;
     }
     
     xdg_wm_base_add_listener(xdg_wm_base, &xdg_wm_base_listener, NULL);
@@ -755,37 +3752,63 @@ int main(int argc, char *argv[]) {
     xdg_toplevel_set_app_id(xdg_toplevel, "christmas-tree");
     
     wl_surface_commit(surface);
-    wl_display_roundtrip(display);
+    
+    /* Wait for the initial configure; the sync of a full roundtrip adds nothing */
+    while (!configured) {
+        if (wl_display_dispatch(display) < 0) {
+            fprintf(stderr, "Error: Lost connection before the window was configured.\n");
+            goto fail;
+        }
+    }
     
     /* Create shared memory buffer */
     if (create_shm_buffer() < 0) {
-        return 1;
+        goto fail;
     }
     
-    /* Initialize animation elements */
-    init_snowflakes();
-    init_lights();
-    init_ornaments();
+    if (scene_threaded) {
+        pthread_join(scene_thread, NULL);
+    }
+    sim_restore(&first_state);
+    set_render_target(shm_data, WIDTH, HEIGHT);
     
-    /* Initial render */
-    render_frame();
+    if (publish_path) {
+        frame_ring = frame_ring_create(publish_path, WIDTH, HEIGHT, FRAME_RING_SLOTS);
+        if (frame_ring) {
+            printf("📡 Publishing frames on %s\n", publish_path);
+        }
+    }
     
-    /* Attach buffer and commit */
-    wl_surface_attach(surface, buffer, 0, 0);
-    wl_surface_damage(surface, 0, 0, WIDTH, HEIGHT);
+    if (control_path) {
+        start_control(helpers + 1);
+    }
     
-    /* Start frame callback loop */
-    struct wl_callback *cb = wl_surface_frame(surface);
-    wl_callback_add_listener(cb, &frame_listener, NULL);
+    /* Attach the first frame and start the frame callback loop */
+    commit_frame(now_ns(), 0);
+    first_commit_ns = clock_ns(CLOCK_MONOTONIC);
+    printf("⏱️  First frame committed %.1f ms after start\n", (first_commit_ns - startup_ns) / 1e6);
     
-    wl_surface_commit(surface);
+    /* Frame timer for late-latching and the fps cap; without it we render on the callback */
+    if (presentation || control) {
+        timer_fd = timerfd_create(presentation_clock, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (timer_fd < 0) {
+            perror("timerfd_create");
+        }
+    }
     
     /* Main event loop */
-    while (running && wl_display_dispatch(display) != -1) {
-        /* Events processed in dispatch */
-    }
+    run_event_loop();
+    
+    print_present_stats();
+    print_io_stats();
+    print_perf_report();
+    print_pixel_report();
     
     /* Cleanup */
+    if (timer_fd >= 0) close(timer_fd);
+    frame_ring_destroy(frame_ring);
+    control_destroy(control);
+    if (presentation) wp_presentation_destroy(presentation);
     if (buffer) wl_buffer_destroy(buffer);
     if (xdg_toplevel) xdg_toplevel_destroy(xdg_toplevel);
     if (xdg_surface) xdg_surface_destroy(xdg_surface);
@@ -796,4 +3819,12 @@ int main(int argc, char *argv[]) {
     printf("\n🎁 Thanks for watching! Merry Christmas! 🎁\n");
     
     return 0;
+    
+fail:
+    /* The scene thread may still be rendering on the row pool that exit stops */
+    running = 0;
+    if (scene_threaded) {
+        pthread_join(scene_thread, NULL);
+    }
+    return 1;
 }
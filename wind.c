@@ -0,0 +1,178 @@
+/**
+ * Wind - a changing 2D wind field for particles
+ * See wind.h. Each vortex is a Gaussian bump of potential, psi =
+ * strength * exp(-d^2 / radius^2), and adds (dpsi/dy, -dpsi/dx): it turns
+ * fastest radius / sqrt(2) from its centre, at 0.858 * strength / radius.
+ * Distances wrap across the field's width, so a vortex drifting off one
+ * side comes back in on the other. Sampling clamps, splits and blends in
+ * the same order in both paths, so SSE2 and scalar agree bit for bit.
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "wind.h"
+
+/* Node indices and the float grid coordinates they come from stay exact */
+_Static_assert(WIND_NODES < (1 << 24), "wind grid too large");
+
+#define WIND_BREEZE 0.12f          /* Per tick, to the right */
+#define WIND_GUST 0.3f
+#define WIND_GUST_TICKS 1500       /* One gust cycle */
+#define WIND_MIN_RADIUS 60.0f
+#define WIND_MAX_RADIUS 140.0f
+#define WIND_MIN_SPEED 0.3f        /* Fastest turning speed, per tick */
+#define WIND_MAX_SPEED 0.8f
+#define WIND_MIN_CROSSING 1200     /* Ticks for a vortex to drift across */
+#define WIND_MAX_CROSSING 3600
+#define WIND_MIN_BOB 600           /* Ticks per bob up and down */
+#define WIND_MAX_BOB 1800
+#define WIND_BOB 0.35f             /* Of the height, either side of the middle */
+
+/* 0 to 1 from a seeded LCG */
+static float next_unit(uint64_t *state) {
+    *state = *state * 6364136223846793005ull + 1442695040888963407ull;
+    return (*state >> 40) * (1.0f / 16777216.0f);
+}
+
+static Phase random_phase(uint64_t *state) {
+    *state = *state * 6364136223846793005ull + 1442695040888963407ull;
+    return (Phase)(*state >> 32);
+}
+
+/* One turn in `ticks` ticks */
+static Phase phase_step(float ticks) {
+    return (Phase)(4294967296.0 / ticks);
+}
+
+void wind_init(Wind *wind, uint64_t seed, float x0, float y0, float width, float height) {
+    uint64_t rng = seed;
+
+    wind->x0 = x0;
+    wind->y0 = y0;
+    wind->width = width;
+    wind->height = height;
+    wind->breeze = WIND_BREEZE;
+    wind->gust = WIND_GUST;
+    wind->gust_phase = random_phase(&rng);
+    wind->gust_step = phase_step(WIND_GUST_TICKS);
+
+    for (int k = 0; k < WIND_VORTICES; k++) {
+        WindVortex *v = &wind->vortex[k];
+        float speed = WIND_MIN_SPEED + (WIND_MAX_SPEED - WIND_MIN_SPEED) * next_unit(&rng);
+
+        v->x = random_phase(&rng);
+        v->y = random_phase(&rng);
+        v->step_x = phase_step(WIND_MIN_CROSSING + (WIND_MAX_CROSSING - WIND_MIN_CROSSING) * next_unit(&rng));
+        v->step_y = phase_step(WIND_MIN_BOB + (WIND_MAX_BOB - WIND_MIN_BOB) * next_unit(&rng));
+        v->radius = WIND_MIN_RADIUS + (WIND_MAX_RADIUS - WIND_MIN_RADIUS) * next_unit(&rng);
+        v->strength = speed * v->radius / 0.858f;
+        if (next_unit(&rng) < 0.5f) v->strength = -v->strength;
+    }
+    wind_update(wind, 0);
+}
+
+void wind_update(Wind *wind, uint32_t tick) {
+    float cx[WIND_VORTICES], cy[WIND_VORTICES], inv_r2[WIND_VORTICES], gain[WIND_VORTICES];
+    float half = wind->width / 2;
+
+    for (int k = 0; k < WIND_VORTICES; k++) {
+        const WindVortex *v = &wind->vortex[k];
+        cx[k] = wind->x0 + wind->width * ((Phase)(v->x + tick * v->step_x) * (1.0f / 4294967296.0f));
+        cy[k] = wind->y0 + wind->height * (0.5f + WIND_BOB * lut_sin(v->y + tick * v->step_y));
+        inv_r2[k] = 1.0f / (v->radius * v->radius);
+        gain[k] = 2 * v->strength * inv_r2[k];
+    }
+    float breeze = wind->breeze + wind->gust * lut_sin(wind->gust_phase + tick * wind->gust_step);
+
+    for (int row = 0; row <= WIND_ROWS; row++) {
+        float y = wind->y0 + wind->height * row / WIND_ROWS;
+        for (int col = 0; col <= WIND_COLUMNS; col++) {
+            float x = wind->x0 + wind->width * col / WIND_COLUMNS;
+            float u = breeze, w = 0;
+
+            for (int k = 0; k < WIND_VORTICES; k++) {
+                float dx = x - cx[k], dy = y - cy[k];
+                if (dx > half) dx -= wind->width;
+                if (dx < -half) dx += wind->width;
+                float g = gain[k] * expf(-(dx * dx + dy * dy) * inv_r2[k]);
+                u -= g * dy;
+                w += g * dx;
+            }
+            wind->vx[row * (WIND_COLUMNS + 1) + col] = u;
+            wind->vy[row * (WIND_COLUMNS + 1) + col] = w;
+        }
+    }
+    wind->tick = tick;
+}
+
+/* Bilinear blend of node values a (top left), b (top right), c, d with weights fx, fy */
+static inline float blend(float a, float b, float c, float d, float fx, float fy) {
+    float top = a + (b - a) * fx;
+    float bottom = c + (d - c) * fx;
+    return top + (bottom - top) * fy;
+}
+
+void wind_sample(const Wind *wind, const float *x, const float *y, float *vx, float *vy, int count) {
+    const float scale_x = WIND_COLUMNS / wind->width, scale_y = WIND_ROWS / wind->height;
+    const int stride = WIND_COLUMNS + 1;
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128 x0 = _mm_set1_ps(wind->x0), y0 = _mm_set1_ps(wind->y0);
+    const __m128 sx = _mm_set1_ps(scale_x), sy = _mm_set1_ps(scale_y);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 max_x = _mm_set1_ps(WIND_COLUMNS), max_y = _mm_set1_ps(WIND_ROWS);
+    const __m128 last_x = _mm_set1_ps(WIND_COLUMNS - 1), last_y = _mm_set1_ps(WIND_ROWS - 1);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 gx = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(x + i), x0), sx), zero), max_x);
+        __m128 gy = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(y + i), y0), sy), zero), max_y);
+        __m128i ix = _mm_cvttps_epi32(_mm_min_ps(gx, last_x));
+        __m128i iy = _mm_cvttps_epi32(_mm_min_ps(gy, last_y));
+        __m128 fx = _mm_sub_ps(gx, _mm_cvtepi32_ps(ix));
+        __m128 fy = _mm_sub_ps(gy, _mm_cvtepi32_ps(iy));
+
+        /* No gather in SSE2 (nor a 32-bit multiply): fetch each lane's four nodes */
+        int cell_x[4] __attribute__((aligned(16))), cell_y[4] __attribute__((aligned(16)));
+        _mm_store_si128((__m128i *)cell_x, ix);
+        _mm_store_si128((__m128i *)cell_y, iy);
+        float n[2][4][4];
+        for (int lane = 0; lane < 4; lane++) {
+            int node = cell_y[lane] * stride + cell_x[lane];
+            const float *field[2] = { wind->vx + node, wind->vy + node };
+            for (int f = 0; f < 2; f++) {
+                n[f][0][lane] = field[f][0];
+                n[f][1][lane] = field[f][1];
+                n[f][2][lane] = field[f][stride];
+                n[f][3][lane] = field[f][stride + 1];
+            }
+        }
+
+        float *out[2] = { vx + i, vy + i };
+        for (int f = 0; f < 2; f++) {
+            __m128 a = _mm_loadu_ps(n[f][0]), b = _mm_loadu_ps(n[f][1]);
+            __m128 c = _mm_loadu_ps(n[f][2]), d = _mm_loadu_ps(n[f][3]);
+            __m128 top = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), fx));
+            __m128 bottom = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(d, c), fx));
+            _mm_storeu_ps(out[f], _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), fy)));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        float gx = (x[i] - wind->x0) * scale_x;
+        float gy = (y[i] - wind->y0) * scale_y;
+        gx = gx < 0 ? 0 : gx > WIND_COLUMNS ? WIND_COLUMNS : gx;
+        gy = gy < 0 ? 0 : gy > WIND_ROWS ? WIND_ROWS : gy;
+        int ix = (int)(gx < WIND_COLUMNS - 1 ? gx : WIND_COLUMNS - 1);
+        int iy = (int)(gy < WIND_ROWS - 1 ? gy : WIND_ROWS - 1);
+        float fx = gx - ix, fy = gy - iy;
+
+        int node = iy * stride + ix;
+        vx[i] = blend(wind->vx[node], wind->vx[node + 1], wind->vx[node + stride], wind->vx[node + stride + 1], fx, fy);
+        vy[i] = blend(wind->vy[node], wind->vy[node + 1], wind->vy[node + stride], wind->vy[node + stride + 1], fx, fy);
+    }
+}
@@ -0,0 +1,50 @@
+/**
+ * Wind - a changing 2D wind field for particles
+ * A breeze that gusts plus a few vortices drifting through, evaluated
+ * once per tick at the nodes of a coarse grid. The vortices are the curl
+ * of a potential, so they swirl particles about without bunching them
+ * up. Particles sample the grid bilinearly, four at a time with SSE2.
+ * The field is a function of the seed and the tick only: any tick can be
+ * rebuilt on any thread and comes out the same.
+ */
+
+#ifndef WIND_H
+#define WIND_H
+
+#include <stdint.h>
+
+#include "lut.h"
+
+#define WIND_COLUMNS 16            /* Cells across; the field wraps around horizontally */
+#define WIND_ROWS 12
+#define WIND_VORTICES 4
+#define WIND_NODES ((WIND_COLUMNS + 1) * (WIND_ROWS + 1))
+
+typedef struct {
+    Phase x, y;                    /* Across the field, and bobbing up and down it */
+    Phase step_x, step_y;          /* Per tick */
+    float radius;
+    float strength;                /* Potential at the centre; the sign is the way it turns */
+} WindVortex;
+
+/* Plain data: set up with wind_init, no resources to free */
+typedef struct {
+    float x0, y0, width, height;   /* Area covered */
+    float breeze, gust;            /* Mean push to the right and how far gusts move it */
+    Phase gust_phase, gust_step;
+    WindVortex vortex[WIND_VORTICES];
+    uint32_t tick;                 /* What the nodes below hold */
+    float vx[WIND_NODES];          /* Velocity per node, row by row */
+    float vy[WIND_NODES];
+} Wind;
+
+/* Lay out a field over [x0, x0 + width) x [y0, y0 + height); lut_init must have run */
+void wind_init(Wind *wind, uint64_t seed, float x0, float y0, float width, float height);
+
+/* Evaluate the field at tick */
+void wind_update(Wind *wind, uint32_t tick);
+
+/* Velocity at each of count points; points outside the area take its edge */
+void wind_sample(const Wind *wind, const float *x, const float *y, float *vx, float *vy, int count);
+
+#endif /* WIND_H */